@@ -1,6 +1,17 @@
 #include <iostream>
 #include <string>
+#include <algorithm>
 #include <vector>
+#include <sstream>
+#include <optional>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <map>
+#include <iomanip>
+#include <csignal>
+#include <thread>
+#include <filesystem>
 #include "core/torrent.h"
 #include "core/peer.h"
 #include "core/tracker.h"
@@ -10,16 +21,427 @@
 #include "utils/error.h"
 #include "utils/terminal_ui.h"
 #include "core/DownloadManager.h"
+#include "core/event_loop.h"
+#include "core/tracker_session.h"
+#include "core/swarm_sim.h"
+#include "core/microbench.h"
+#include "core/metrics_server.h"
+#include "core/trace.h"
+#include "core/progress_renderer.h"
+#include "core/session.h"
+#include "core/control_server.h"
 
 using namespace std;
 using namespace BitTorrent;
 
+// Set by SIGUSR1 when --trace is active; the progress loop writes the trace file.
+static std::atomic<bool> g_traceRequested{false};
+// Set by SIGINT/SIGTERM or a "shutdown" request; the daemon exits once it is seen.
+static std::atomic<bool> g_shutdownRequested{false};
+
+// Parses "skip|low|normal|high" into a FilePriority.
+static FilePriority parsePriority(const string& name) {
+    if (name == "skip") return FilePriority::Skip;
+    if (name == "low") return FilePriority::Low;
+    if (name == "normal") return FilePriority::Normal;
+    if (name == "high") return FilePriority::High;
+    throw TorrentError("Unknown file priority: " + name);
+}
+
+// Parses a comma-separated list of file indices, e.g. "0,3,7".
+static vector<size_t> parseIndexList(const string& list) {
+    vector<size_t> indices;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) indices.push_back(stoul(item));
+    }
+    return indices;
+}
+
+// Azureus-style peer id: client tag followed by random digits (20 bytes total).
+static string generatePeerId() {
+    static const string prefix = "-BT0200-";
+    random_device rd;
+    mt19937 gen(rd());
+    uniform_int_distribution<int> digit(0, 9);
+    string id = prefix;
+    while (id.size() < 20) {
+        id += static_cast<char>('0' + digit(gen));
+    }
+    return id;
+}
+
+// scrape <torrent_file>...: swarm counts for every torrent, one batched request per tracker.
+static int runScrape(int argc, char* argv[]) {
+    vector<TorrentMetadata> torrents;
+    for (int i = 2; i < argc; ++i) {
+        torrents.push_back(TorrentMetadata::fromFile(argv[i]));
+    }
+    // Group info hashes by tracker so each tracker is asked once for all of its torrents
+    map<string, vector<string>> hashesByTracker;
+    for (const auto& torrent : torrents) {
+        for (const auto& tier : torrent.getAnnounceTiers()) {
+            for (const auto& url : tier) {
+                hashesByTracker[url].push_back(torrent.getInfoHash());
+            }
+        }
+    }
+    map<string, Tracker::ScrapeEntry> best;  // Per torrent, the tracker that sees the most peers
+    for (const auto& [url, hashes] : hashesByTracker) {
+        TerminalUI::logNetwork("Scraping " + url + " (" + to_string(hashes.size()) + " torrents)");
+        auto counts = Tracker::scrape(url, hashes);
+        if (!counts) continue;
+        for (const auto& [hash, entry] : *counts) {
+            auto& current = best[hash];
+            if (entry.seeders + entry.leechers > current.seeders + current.leechers) {
+                current = entry;
+            }
+        }
+    }
+    for (const auto& torrent : torrents) {
+        auto it = best.find(torrent.getInfoHash());
+        if (it == best.end()) {
+            TerminalUI::logWarning(torrent.getName() + ": no tracker answered");
+            continue;
+        }
+        TerminalUI::logInfo(torrent.getName() + ": " + to_string(it->second.seeders) + " seeders, " +
+                            to_string(it->second.leechers) + " leechers, " +
+                            to_string(it->second.completed) + " completed");
+    }
+    return best.empty() ? 1 : 0;
+}
+
+// simulate [options]: download a generated torrent from an in-process loopback swarm
+// and report throughput, time to first piece and client CPU per GB.
+static int runSimulate(int argc, char* argv[]) {
+    SwarmSimulator::Options options;
+    bool asJson = false;
+    string tracePath;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        auto value = [&]() -> string {
+            if (i + 1 >= argc) {
+                throw TorrentError("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--seeds") {
+            options.seeds = stoi(value());
+        } else if (arg == "--size") {
+            options.payload_bytes = stoull(value()) * 1024 * 1024;
+        } else if (arg == "--piece-kb") {
+            options.piece_length = stoull(value()) * 1024;
+        } else if (arg == "--latency") {
+            options.latency = chrono::milliseconds(stoi(value()));
+        } else if (arg == "--bandwidth") {
+            options.bandwidth = stoll(value()) * 1024;
+        } else if (arg == "--loss") {
+            options.loss = stod(value());
+        } else if (arg == "--udp") {
+            options.udp_tracker = true;
+        } else if (arg == "--json") {
+            asJson = true;
+        } else if (arg == "--trace") {
+            tracePath = value();
+        } else if (arg == "--disk") {
+            options.disk_dir = value();
+        } else {
+            throw TorrentError("Unknown option: " + arg);
+        }
+    }
+
+    if (!tracePath.empty()) {
+        Trace::enable();
+    }
+    TerminalUI::logInfo("Simulating " + to_string(options.seeds) + " seeds, " +
+                        to_string(options.payload_bytes >> 20) + " MiB payload on loopback");
+    SwarmSimulator simulator(options);
+    auto result = simulator.run();
+    if (!tracePath.empty()) {
+        Trace::writeJson(tracePath);
+    }
+
+    if (asJson) {
+        nlohmann::json report = {
+            {"seeds", options.seeds},
+            {"bytes", result.bytes},
+            {"piece_length", options.piece_length},
+            {"latency_ms", options.latency.count()},
+            {"bandwidth", options.bandwidth},
+            {"loss", options.loss},
+            {"tracker", options.udp_tracker ? "udp" : "http"},
+            {"complete", result.complete},
+            {"verified", result.verified},
+            {"seconds", result.seconds},
+            {"mb_per_sec", result.mb_per_sec},
+            {"time_to_first_piece_ms", result.time_to_first_piece_ms},
+            {"cpu_seconds", result.cpu_seconds},
+            {"cpu_seconds_per_gb", result.cpu_seconds_per_gb},
+            {"cpu_includes_stubs", result.cpu_includes_stubs}};
+        Logger::flush();
+        cout << report.dump() << endl;
+    } else {
+        ostringstream summary;
+        summary << fixed << setprecision(2) << result.mb_per_sec << " MB/s, first piece after "
+                << result.time_to_first_piece_ms << " ms, " << result.cpu_seconds_per_gb << " CPU s/GB"
+                << (result.cpu_includes_stubs ? " (including stubs)" : "");
+        if (result.verified) {
+            TerminalUI::logSuccess(summary.str());
+        } else {
+            TerminalUI::logError(string(result.complete ? "Payload mismatch: " : "Download incomplete: ") + summary.str());
+        }
+    }
+    return result.verified ? 0 : 1;
+}
+
+// bench [--filter <substr>] [--min-time <ms>] [--json]: run the microbenchmarks.
+static int runBench(int argc, char* argv[]) {
+    Microbench::Options options;
+    bool asJson = false;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            options.min_time = chrono::milliseconds(stoi(argv[++i]));
+        } else if (arg == "--json") {
+            asJson = true;
+        } else {
+            throw TorrentError("Unknown option: " + arg);
+        }
+    }
+    auto results = Microbench::run(options);
+    Logger::flush();
+    if (asJson) {
+        cout << Microbench::toJson(results).dump(2) << endl;
+        return 0;
+    }
+    cout << left << setw(36) << "benchmark" << right << setw(14) << "ns/op" << setw(14) << "cpu ns/op"
+         << setw(12) << "MB/s" << setw(12) << "iterations" << endl;
+    for (const auto& r : results) {
+        cout << left << setw(36) << r.name << right << fixed << setprecision(1) << setw(14) << r.real_ns
+             << setw(14) << r.cpu_ns << setw(12);
+        if (r.bytes_per_second > 0) {
+            cout << r.bytes_per_second / (1024.0 * 1024.0);
+        } else {
+            cout << "-";
+        }
+        cout << setw(12) << r.iterations << endl;
+    }
+    return 0;
+}
+
+// Command line of the session and daemon commands.
+struct SessionArgs {
+    Session::Options options;
+    vector<string> torrentFiles;
+    optional<uint16_t> metricsPort;
+    string socketPath = ControlServer::defaultSocketPath();  // daemon only
+};
+
+static SessionArgs parseSessionArgs(int argc, char* argv[], bool daemon) {
+    SessionArgs args;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        auto value = [&]() -> string {
+            if (i + 1 >= argc) {
+                throw TorrentError("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--active") {
+            args.options.active_downloads = stoul(value());
+        } else if (arg == "--max-peers") {
+            args.options.max_connections = stoul(value());
+        } else if (arg == "--max-memory") {
+            args.options.max_memory = stoull(value()) * 1024 * 1024;
+        } else if (arg == "--write-cache") {
+            args.options.write_cache = stoull(value()) * 1024 * 1024;
+        } else if (arg == "--rate-limit") {
+            args.options.download_rate = stoll(value()) * 1024;
+        } else if (arg == "--metrics-port") {
+            args.metricsPort = static_cast<uint16_t>(stoul(value()));
+        } else if (daemon && arg == "--socket") {
+            args.socketPath = value();
+        } else if (arg.rfind("--", 0) == 0) {
+            throw TorrentError("Unknown option: " + arg);
+        } else {
+            args.torrentFiles.push_back(arg);
+        }
+    }
+    args.options.export_metrics = args.metricsPort.has_value();
+    return args;
+}
+
+static shared_ptr<MetricsServer> startMetricsServer(Session& session, optional<uint16_t> port) {
+    if (!port) {
+        return nullptr;
+    }
+    auto server = make_shared<MetricsServer>(session.eventLoop().context(), "127.0.0.1", *port);
+    server->start();
+    TerminalUI::logInfo("Serving metrics on http://127.0.0.1:" + to_string(server->port()) + "/metrics");
+    return server;
+}
+
+// session <torrent>... [options]: download several torrents in one process under
+// shared limits, logging a status line per torrent every few seconds.
+static int runSession(int argc, char* argv[]) {
+    SessionArgs args = parseSessionArgs(argc, argv, false);
+    if (args.torrentFiles.empty()) {
+        throw TorrentError("No torrent files given");
+    }
+
+    Session session(args.options, generatePeerId());
+    auto metricsServer = startMetricsServer(session, args.metricsPort);
+    for (const auto& file : args.torrentFiles) {
+        session.add(file);
+    }
+
+    while (!session.waitIdle(chrono::seconds(5))) {
+        for (const auto& status : session.status()) {
+            if (status.state != Session::State::Downloading) {
+                continue;
+            }
+            ostringstream line;
+            line << status.name << ": " << status.piecesDone << "/" << status.piecesWanted << " pieces, "
+                 << TerminalUI::formatFileSize(status.bytesDone) << " of "
+                 << TerminalUI::formatFileSize(status.bytesWanted) << ", " << status.peers << " peers";
+            TerminalUI::logDownload(line.str());
+        }
+    }
+
+    int failed = 0;
+    for (const auto& status : session.status()) {
+        if (status.state == Session::State::Complete) {
+            TerminalUI::logSuccess(status.name + " saved to " + status.outputPath);
+        } else {
+            TerminalUI::logError(status.name + ": " + (status.error.empty() ? Session::stateName(status.state) : status.error));
+            failed++;
+        }
+    }
+    if (metricsServer) {
+        metricsServer->stop();
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+// daemon [torrent...] [options] [--socket <path>]: keep a session running and take
+// add/remove/pause/resume/status requests over a Unix domain socket.
+static int runDaemon(int argc, char* argv[]) {
+    SessionArgs args = parseSessionArgs(argc, argv, true);
+    Session session(args.options, generatePeerId());
+    auto metricsServer = startMetricsServer(session, args.metricsPort);
+    auto control = make_shared<ControlServer>(session.eventLoop().context(), args.socketPath, session,
+                                              [] { g_shutdownRequested.store(true); });
+    control->start();
+    for (const auto& file : args.torrentFiles) {
+        session.add(file);
+    }
+    signal(SIGINT, [](int) { g_shutdownRequested.store(true); });
+    signal(SIGTERM, [](int) { g_shutdownRequested.store(true); });
+    TerminalUI::logSuccess("Daemon listening on " + args.socketPath);
+
+    while (!g_shutdownRequested.load()) {
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+    TerminalUI::logInfo("Shutting down");
+    control->stop();
+    if (metricsServer) {
+        metricsServer->stop();
+    }
+    return 0;  // Session teardown stops the remaining torrents
+}
+
+// ctl [--socket <path>] <add <torrent>|remove <id>|pause <id>|resume <id>|status [id]|shutdown>:
+// send one request to a running daemon and print its JSON reply.
+static int runCtl(int argc, char* argv[]) {
+    string socketPath = ControlServer::defaultSocketPath();
+    vector<string> words;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else {
+            words.push_back(arg);
+        }
+    }
+    if (words.empty()) {
+        throw TorrentError("Expected a command: add, remove, pause, resume, status or shutdown");
+    }
+    nlohmann::json request = {{"cmd", words[0]}};
+    if (words.size() > 1) {
+        if (words[0] == "add") {
+            // The daemon may run from another directory
+            request["torrent"] = filesystem::absolute(words[1]).string();
+        } else {
+            request["id"] = words[1];
+        }
+    }
+
+    boost::asio::io_context io_context;
+    boost::asio::local::stream_protocol::socket socket(io_context);
+    boost::system::error_code ec;
+    socket.connect(boost::asio::local::stream_protocol::endpoint(socketPath), ec);
+    if (ec) {
+        throw NetworkError("No daemon on " + socketPath + ": " + ec.message());
+    }
+    boost::asio::write(socket, boost::asio::buffer(request.dump() + "\n"));
+    string line;
+    boost::asio::read_until(socket, boost::asio::dynamic_buffer(line), '\n');
+    auto response = nlohmann::json::parse(line.substr(0, line.find('\n')));
+    Logger::flush();
+    cout << response.dump(2) << endl;
+    return response.value("ok", false) ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) {
     // Handle help command or no arguments
     if (argc < 2 || (argc == 2 && (string(argv[1]) == "--help" || string(argv[1]) == "-h"))) {
         TerminalUI::printUsage(argv[0]);
         return 0;
     }
+
+    if (string(argv[1]) == "bench") {
+        try {
+            return runBench(argc, argv);
+        } catch (const std::exception& e) {
+            TerminalUI::logError("Benchmark failed: " + string(e.what()));
+            return 1;
+        }
+    }
+    if (string(argv[1]) == "session") {
+        try {
+            return runSession(argc, argv);
+        } catch (const std::exception& e) {
+            TerminalUI::logError("Session failed: " + string(e.what()));
+            return 1;
+        }
+    }
+    if (string(argv[1]) == "daemon") {
+        try {
+            return runDaemon(argc, argv);
+        } catch (const std::exception& e) {
+            TerminalUI::logError("Daemon failed: " + string(e.what()));
+            return 1;
+        }
+    }
+    if (string(argv[1]) == "ctl") {
+        try {
+            return runCtl(argc, argv);
+        } catch (const std::exception& e) {
+            TerminalUI::logError("Control request failed: " + string(e.what()));
+            return 1;
+        }
+    }
+    if (string(argv[1]) == "simulate") {
+        try {
+            return runSimulate(argc, argv);
+        } catch (const std::exception& e) {
+            TerminalUI::logError("Simulation failed: " + string(e.what()));
+            return 1;
+        }
+    }
     
     // Expecting: download_file <torrent_file>
     if (argc < 3) {
@@ -34,6 +456,14 @@ int main(int argc, char* argv[]) {
     const string command = argv[1];
     const string torrentFile = argv[2];
 
+    if (command == "scrape") {
+        try {
+            return runScrape(argc, argv);
+        } catch (const std::exception& e) {
+            TerminalUI::logError("Scrape failed: " + string(e.what()));
+            return 1;
+        }
+    }
     if (command != "download_file") {
         TerminalUI::logError("Unknown command: " + command);
         TerminalUI::logInfo("Use --help to see available commands");
@@ -41,6 +471,53 @@ int main(int argc, char* argv[]) {
     }
 
     try {
+        // Optional selective-download flags:
+        //   --only <i,j,...>                      download only these files
+        //   --priority <i>=<skip|low|normal|high> set one file's priority (repeatable)
+        //   --stream <pieces>                     sequential streaming window ahead of the cursor
+        //   --metrics-port <port>                 serve Prometheus metrics at /metrics
+        //   --metrics-bind <address>              listen address for metrics (default 127.0.0.1)
+        //   --trace <file>                        record a Chrome trace, written at exit and on SIGUSR1
+        //   --write-cache <MB>                    write-back cache size (default 64, 0 = write at the end)
+        optional<vector<size_t>> onlyFiles;
+        vector<pair<size_t, FilePriority>> filePriorities;
+        int streamWindow = 0;
+        optional<uint16_t> metricsPort;
+        string metricsBind = "127.0.0.1";
+        string tracePath;
+        size_t writeCacheMB = 64;
+        for (int i = 3; i < argc; ++i) {
+            const string arg = argv[i];
+            if (arg == "--only" && i + 1 < argc) {
+                onlyFiles = parseIndexList(argv[++i]);
+            } else if (arg == "--priority" && i + 1 < argc) {
+                const string spec = argv[++i];
+                size_t eq = spec.find('=');
+                if (eq == string::npos) {
+                    throw TorrentError("Expected --priority <index>=<level>, got: " + spec);
+                }
+                filePriorities.emplace_back(stoul(spec.substr(0, eq)), parsePriority(spec.substr(eq + 1)));
+            } else if (arg == "--stream" && i + 1 < argc) {
+                streamWindow = stoi(argv[++i]);
+            } else if (arg == "--metrics-port" && i + 1 < argc) {
+                metricsPort = static_cast<uint16_t>(stoul(argv[++i]));
+            } else if (arg == "--metrics-bind" && i + 1 < argc) {
+                metricsBind = argv[++i];
+            } else if (arg == "--trace" && i + 1 < argc) {
+                tracePath = argv[++i];
+            } else if (arg == "--write-cache" && i + 1 < argc) {
+                writeCacheMB = stoul(argv[++i]);
+            } else {
+                throw TorrentError("Unknown option: " + arg);
+            }
+        }
+
+        if (!tracePath.empty()) {
+            Trace::enable();
+            signal(SIGUSR1, [](int) { g_traceRequested.store(true); });
+            TerminalUI::logInfo("Tracing to " + tracePath + " (send SIGUSR1 to write it mid-download)");
+        }
+
         // Step 1: Load torrent metadata from file
         TerminalUI::logInfo("Loading torrent metadata from: " + torrentFile);
         
@@ -56,39 +533,81 @@ int main(int argc, char* argv[]) {
             metadata.getTotalPieces()
         );
         
-        // Step 2: Request peer list from tracker
-        TerminalUI::logNetwork("Connecting to tracker...");
-
-        auto response = Tracker::getPeers(
-            metadata, 
-            "00112233445566778899",  // Example peer_id (should be 20 bytes)
-            6881,                   // Port number to use for the tracker request
-            0,                      // Uploaded (0 for now)
-            0,                      // Downloaded (0 for now)
-            metadata.getTotalLength()
-        );
-        
-        if (!response || response->peers.empty()) {
-            throw NetworkError("Failed to get peers from tracker");
-        }
-        
-        TerminalUI::logSuccess("Successfully retrieved peer list from tracker");
-        
-        // Convert peer info to string format for display
-        vector<string> peerStrings;
-        for (const auto &peer_info : response->peers) {
-            peerStrings.push_back(peer_info.ip + ":" + to_string(peer_info.port));
+        if (metadata.isMultiFile()) {
+            vector<pair<string, long long>> files;
+            for (const auto& file : metadata.getFiles()) {
+                files.emplace_back(file.path, static_cast<long long>(file.length));
+            }
+            TerminalUI::printFileList(files);
         }
-        TerminalUI::printPeerList(peerStrings);
         
-        // Step 3: Create download manager and connect to peers
+        // Step 2: Create download manager and apply file selection (the tracker's
+        // "left" counter depends on it)
         TerminalUI::printSectionHeader("Download Process", TerminalUI::Symbols::DOWNLOAD);
         TerminalUI::logInfo("Initializing download manager...");
         
-        DownloadManager dm(&metadata, response->peers);
+        const string peerId = generatePeerId();
+        DownloadManager dm(&metadata, {}, peerId);
+        
+        const size_t fileCount = metadata.getFiles().size();
+        auto checkFileIndex = [&](size_t idx) {
+            if (idx >= fileCount) {
+                throw TorrentError("File index out of range: " + to_string(idx));
+            }
+        };
+        if (onlyFiles) {
+            for (size_t f = 0; f < fileCount; ++f) {
+                dm.setFilePriority(f, FilePriority::Skip);
+            }
+            for (size_t f : *onlyFiles) {
+                checkFileIndex(f);
+                dm.setFilePriority(f, FilePriority::Normal);
+            }
+        }
+        for (const auto& [f, priority] : filePriorities) {
+            checkFileIndex(f);
+            dm.setFilePriority(f, priority);
+        }
+        
+        // Step 3: Announce from the event loop; every (re-)announce feeds new peers
+        // into the download manager. Declared after dm so the loop is joined first.
+        // The tracker exchanges block, so each tier gets a pool thread (within reason)
+        // and the loop stays free for the metrics endpoint.
+        TerminalUI::logNetwork("Connecting to tracker...");
+        EventLoop eventLoop(2);
+        ThreadPool announcePool(std::clamp<size_t>(metadata.getAnnounceTiers().size(), 1, 16));
+        shared_ptr<MetricsServer> metricsServer;
+        if (metricsPort) {
+            dm.exportMetrics();
+            metricsServer = make_shared<MetricsServer>(eventLoop.context(), metricsBind, *metricsPort);
+            metricsServer->start();
+            TerminalUI::logInfo("Serving metrics on http://" + metricsBind + ":" +
+                                to_string(metricsServer->port()) + "/metrics");
+        }
+        atomic<bool> firstPeerList{true};
+        auto tracker = make_shared<TrackerSession>(
+            eventLoop.context(), announcePool, metadata, peerId, 6881,
+            [&dm] {
+                return TrackerSession::Stats{dm.getBytesUploaded(), dm.getBytesDownloaded(), dm.getBytesLeft()};
+            },
+            [&dm, &firstPeerList](const vector<Tracker::PeerInfo>& peers) {
+                if (firstPeerList.exchange(false)) {
+                    TerminalUI::logSuccess("Successfully retrieved peer list from tracker");
+                    vector<string> peerStrings;
+                    for (const auto &peer_info : peers) {
+                        peerStrings.push_back(peer_info.endpoint.toString());
+                    }
+                    TerminalUI::printPeerList(peerStrings);
+                    TerminalUI::logNetwork("Connecting to peers...");
+                }
+                dm.addPeers(peers);
+            });
+        tracker->start();
         
-        TerminalUI::logNetwork("Connecting to peers...");
-        dm.connectToPeers();
+        if (!dm.waitForPeers(chrono::seconds(60))) {
+            tracker->stop();
+            throw NetworkError("Failed to get peers from tracker");
+        }
         TerminalUI::logSuccess("Connected to available peers");
         
         // Step 4: Download all pieces with progress tracking
@@ -97,30 +616,56 @@ int main(int argc, char* argv[]) {
         // Create output directory if it doesn't exist
         system("mkdir -p ./downloads");
         
-        int totalPieces = metadata.getTotalPieces();
+        int totalPieces = dm.getWantedPieceCount();
         
         TerminalUI::logDownload("Starting download of " + to_string(totalPieces) + " pieces");
+        Logger::flush();
         cout << endl;
         
-        for (int pieceIndex = 0; pieceIndex < totalPieces; ++pieceIndex) {
-            TerminalUI::showProgress(pieceIndex, totalPieces, "Downloading pieces");
-            
-        auto pieceOpt = dm.downloadPiece(pieceIndex);
-        if (!pieceOpt.has_value()) {
-                cout << endl;
-                TerminalUI::logError("Failed to download piece " + to_string(pieceIndex));
-                TerminalUI::logInfo("You may want to try again or check your network connection");
-                return 1;
+        // One worker per connected peer; the renderer draws progress from its own
+        // thread, and this one only waits for the download to finish
+        ProgressRenderer renderer(dm.progress(), "Downloading pieces");
+        if (writeCacheMB > 0) {
+            // Pieces go to disk in batches as they arrive rather than all at the end
+            WriteCache::Options cacheOptions;
+            cacheOptions.capacity = writeCacheMB * 1024 * 1024;
+            dm.enableWriteBack(outputPath, cacheOptions);
+        }
+        dm.setStreamingWindow(streamWindow);
+        dm.start();
+        renderer.start();
+        while (!dm.isComplete() && dm.waitForProgress(chrono::milliseconds(200))) {
+            if (g_traceRequested.exchange(false)) {
+                Trace::writeJson(tracePath);
             }
         }
+        dm.stop();
+        dm.wait();
+        renderer.stop();
         
-        // Show completion of piece downloads
-        TerminalUI::showProgress(totalPieces, totalPieces, "Downloading pieces");
+        if (!dm.isComplete()) {
+            tracker->stop();
+            if (!tracePath.empty()) {
+                Trace::writeJson(tracePath);
+            }
+            if (dm.writeFailed()) {
+                TerminalUI::logError("Writing pieces under " + outputPath + " failed");
+                return 1;
+            }
+            TerminalUI::logError("Download stopped with " + to_string(totalPieces - dm.getDownloadedWantedCount()) + " pieces missing");
+            TerminalUI::logInfo("You may want to try again or check your network connection");
+            return 1;
+        }
+        tracker->completed();
         
         // Step 5: Assemble the final file
         TerminalUI::logInfo("Assembling downloaded pieces into final file...");
         
         bool assembleResult = dm.assembleFile(outputPath);
+        tracker->stop();
+        if (!tracePath.empty()) {
+            Trace::writeJson(tracePath);
+        }
         
         if (assembleResult) {
             TerminalUI::logSuccess("File assembly completed successfully");
@@ -1,54 +1,493 @@
 #include "DownloadManager.h"
 #include "torrent.h"      // Contains TorrentMetadata definition.
 #include "peer.h"         // Contains Peer definition.
+#include "storage.h"
+#include "metrics.h"
+#include "trace.h"
 #include "../utils/hash.h"  // For computeSHA1(), etc.
+#include "../utils/logger.h"
 #include <iostream>
 #include <fstream>
 #include <algorithm>
 #include <cassert>
+#include <unistd.h>
 using namespace std;
 
-DownloadManager::DownloadManager(const TorrentMetadata* metadata, const std::vector<Tracker::PeerInfo>& peersInfo){
+DownloadManager::DownloadManager(const TorrentMetadata* metadata, const std::vector<Tracker::PeerInfo>& peersInfo,
+                                 std::string peerId){
     m_metadata = metadata;
-    m_peersInfo = peersInfo;
+    m_peerId = std::move(peerId);
+    for(const auto& info : peersInfo){
+        if(m_knownPeers.insert(info.endpoint)){
+            m_peersInfo.push_back(info);
+        }
+    }
     m_totalPieces = metadata->getTotalPieces();
     m_downloadedPieces.assign(m_totalPieces, false);
     m_pieceData.resize(m_totalPieces);
-    string concatenatedHashes = metadata->getPieces();
-    for(size_t i=0 ; i<concatenatedHashes.size() ; i+=20){
-        m_pieceHashes.push_back(concatenatedHashes.substr(i,20));
-    }
+    m_storing.assign(m_totalPieces, false);
+    m_pieceHashes = metadata->getPieceHashes();
     m_piece_length = metadata->getPieceLength();
+    m_filePriority.assign(metadata->getFiles().size(), FilePriority::Normal);
+    m_piecePriority.assign(m_totalPieces, static_cast<uint8_t>(FilePriority::Normal));
+    m_inFlight.assign(m_totalPieces, 0);
+    m_availability.assign(m_totalPieces, 0);
+    m_progress.totalPieces = m_totalPieces;
+    m_progress.pieces = std::make_unique<std::atomic<uint8_t>[]>(m_totalPieces);
+    for(int i=0 ; i<m_totalPieces ; i++){
+        m_progress.pieces[i].store(Progress::Skipped, std::memory_order_relaxed);
+        publishPieceState(i);
+    }
+    m_progress.peers.store(std::make_shared<const std::vector<std::shared_ptr<Peer>>>());
+}
+
+DownloadManager::~DownloadManager(){
+    // Callbacks sample this object; once removed, no scrape can be inside one
+    for(const auto& name : m_metricNames){
+        Metrics::Registry::global().remove(name, m_metricLabels);
+    }
+    // No connection may be handed over while the pool is torn down
+    if(m_connector){
+        m_connector->stop();
+    }
+    m_connectLoop.reset();
+    stop();
+    wait();
+    // Peers of a paused torrent still point back at us
+    for(auto& peer : m_peers){
+        peer->setPieceAvailableHandler(nullptr);
+    }
+    if(m_shared.connections){
+        m_shared.connections->release(m_heldConnections);
+    }
 }
 
 void DownloadManager::connectToPeers(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queueConnections(m_peersInfo);
+}
 
-    for(size_t i = 0 ; i<m_peersInfo.size() ; i++){
-        // you have peerInfo object 
-        auto peer = std::make_shared<Peer>(m_peersInfo[i].ip,m_peersInfo[i].port, m_metadata->getTotalLength());
-        if(peer->connect(m_metadata->getInfoHash() , m_peersInfo[i].peer_id)){
-            m_peers.push_back(peer);
+void DownloadManager::addPeers(const std::vector<Tracker::PeerInfo>& peersInfo){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Tracker::PeerInfo> fresh;
+    for(const auto& info : peersInfo){
+        if(m_knownPeers.insert(info.endpoint)){
+            m_peersInfo.push_back(info);
+            fresh.push_back(info);
         }
-        else{
-            std::cerr << "Failed to connect to peer " << m_peersInfo[i].ip << ":" << m_peersInfo[i].port << std::endl;
+    }
+    queueConnections(fresh);
+}
+
+void DownloadManager::setSharedResources(const SharedResources& resources){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shared = resources;
+}
+
+void DownloadManager::enableWriteBack(const std::string& rootDir, const WriteCache::Options& options){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_writeCache = std::make_unique<WriteCache>(m_metadata, rootDir, options);
+    for(size_t f=0 ; f<m_filePriority.size() ; f++){
+        m_writeCache->setFileSkipped(f, m_filePriority[f] == FilePriority::Skip);
+    }
+}
+
+bool DownloadManager::writeFailed() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_writeCache && m_writeCache->failed();
+}
+
+void DownloadManager::setConnectOptions(const PeerConnector::Options& options){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_connectOptions = options;
+}
+
+void DownloadManager::queueConnections(const std::vector<Tracker::PeerInfo>& peersInfo){
+    if(!m_connector){
+        boost::asio::io_context* io_context = m_shared.io_context;
+        if(!io_context){
+            if(!m_connectLoop){
+                m_connectLoop = std::make_unique<EventLoop>(1);
+            }
+            io_context = &m_connectLoop->context();
+        }
+        m_connector = std::make_shared<PeerConnector>(
+            *io_context, m_metadata->getInfoHash(), m_peerId, m_connectOptions,
+            [this](PeerConnector::Connection&& connection){ onPeerConnected(std::move(connection)); });
+    }
+    for(const auto& info : peersInfo){
+        m_connector->enqueue(info);
+    }
+}
+
+void DownloadManager::onPeerConnected(PeerConnector::Connection&& connection){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_shared.connections){
+            if(!m_shared.connections->tryAcquire()){
+                BT_LOG_DEBUG("Connection limit reached, dropping " << connection.info.endpoint.toString());
+                ::close(connection.fd);
+                return;
+            }
+            m_heldConnections++;
         }
     }
+    auto peer = std::make_shared<Peer>(connection.info.ip(), connection.info.port(), m_totalPieces);
+    peer->adopt(connection.fd, connection.v6, std::move(connection.remote_peer_id), connection.bitfield,
+                connection.first_message);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    addConnectedPeer(std::move(peer));
+}
+
+void DownloadManager::addConnectedPeer(std::shared_ptr<Peer> peer){
+    for(int i=0 ; i<m_totalPieces ; i++){
+        if(peer->hasPiece(i)){
+            m_availability[i]++;
+        }
+    }
+    // HAVE messages arrive on the peer's worker thread, outside m_mutex
+    peer->setPieceAvailableHandler([this](uint32_t piece_idx){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_availability[piece_idx]++;
+        m_cv.notify_all();
+    });
+    peer->setRateLimiter(m_shared.rateLimiter);
+    m_peers.push_back(std::move(peer));
+    m_peerStats.push_back(PeerStats{});
+    m_peerStats.back().holdsConnection = m_shared.connections != nullptr;
+    m_progress.peers.store(std::make_shared<const std::vector<std::shared_ptr<Peer>>>(m_peers));
+    if(m_started && !m_stopping){
+        m_activeWorkers++;
+        m_workers.emplace_back(&DownloadManager::workerLoop, this, m_peers.size() - 1);
+    }
+    m_cv.notify_all();
+}
+
+bool DownloadManager::waitForPeers(std::chrono::milliseconds timeout){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_cv.wait_for(lock, timeout, [this]{ return !m_peers.empty(); });
+}
+
+int64_t DownloadManager::getBytesDownloaded() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytesDownloaded;
+}
+
+int64_t DownloadManager::getBytesUploaded() const {
+    // We do not seed yet
+    return 0;
+}
+
+int64_t DownloadManager::getBytesLeft() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int64_t left = 0;
+    for(int i=0 ; i<m_totalPieces ; i++){
+        if(m_piecePriority[i] > 0 && !m_downloadedPieces[i]){
+            left += static_cast<int64_t>(m_metadata->getActualPieceLength(i));
+        }
+    }
+    return left;
+}
+
+DownloadManager::Stats DownloadManager::getStats() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Stats stats;
+    stats.activeWorkers = m_activeWorkers;
+    for(const auto& peer : m_peers){
+        stats.connectedPeers += peer->isConnected() ? 1 : 0;
+    }
+    for(int i=0 ; i<m_totalPieces ; i++){
+        if(m_piecePriority[i] == 0){
+            continue;
+        }
+        stats.piecesWanted++;
+        if(m_downloadedPieces[i]){
+            stats.piecesDone++;
+        } else {
+            stats.bytesLeft += static_cast<int64_t>(m_metadata->getActualPieceLength(i));
+        }
+        stats.piecesInFlight += m_inFlight[i] > 0 ? 1 : 0;
+    }
+    stats.partialPieces = static_cast<int>(m_partialPieces.size());
+    for(const auto& peerStats : m_peerStats){
+        stats.downloadRate += peerStats.rate;
+    }
+    stats.bytesDownloaded = m_bytesDownloaded;
+    // The connector hands peers over while holding its own lock, so never ask it under ours
+    auto connector = m_connector;
+    lock.unlock();
+    stats.connectPending = connector ? connector->pending() : 0;
+    return stats;
+}
+
+DownloadManager::Stats DownloadManager::metricsSnapshot(){
+    std::lock_guard<std::mutex> lock(m_metricsMutex);
+    const auto now = std::chrono::steady_clock::now();
+    if(now - m_metricsTaken >= METRICS_SNAPSHOT_TTL){
+        m_metricsSnapshot = getStats();
+        m_metricsTaken = now;
+    }
+    return m_metricsSnapshot;
+}
+
+void DownloadManager::exportMetrics(){
+    using Type = Metrics::Registry::Type;
+    auto& registry = Metrics::Registry::global();
+    m_metricLabels = {{"info_hash", HashUtils::bytesToHex(m_metadata->getInfoHash())},
+                      {"name", m_metadata->getName()}};
+    auto publish = [&](const std::string& name, const std::string& help, Type type,
+                       std::function<double(const Stats&)> field){
+        registry.callback(name, help, type, m_metricLabels, [this, field]{ return field(metricsSnapshot()); });
+        m_metricNames.push_back(name);
+    };
+    publish("bt_torrent_progress_ratio", "Fraction of wanted pieces verified", Type::Gauge, [](const Stats& s){
+        return s.piecesWanted == 0 ? 1.0 : static_cast<double>(s.piecesDone) / s.piecesWanted;
+    });
+    publish("bt_torrent_pieces_done", "Wanted pieces verified", Type::Gauge,
+            [](const Stats& s){ return s.piecesDone; });
+    publish("bt_torrent_pieces_wanted", "Pieces selected for download", Type::Gauge,
+            [](const Stats& s){ return s.piecesWanted; });
+    publish("bt_torrent_downloaded_bytes_total", "Verified payload bytes", Type::Counter,
+            [](const Stats& s){ return static_cast<double>(s.bytesDownloaded); });
+    publish("bt_torrent_left_bytes", "Wanted bytes not yet verified", Type::Gauge,
+            [](const Stats& s){ return static_cast<double>(s.bytesLeft); });
+    publish("bt_torrent_download_rate_bytes", "Sum of smoothed per-peer download rates (bytes/sec)", Type::Gauge,
+            [](const Stats& s){ return s.downloadRate; });
+    publish("bt_torrent_peers", "Connected peers", Type::Gauge,
+            [](const Stats& s){ return s.connectedPeers; });
+    publish("bt_torrent_active_workers", "Peer workers still running", Type::Gauge,
+            [](const Stats& s){ return s.activeWorkers; });
+    publish("bt_torrent_pieces_in_flight", "Pieces being fetched right now", Type::Gauge,
+            [](const Stats& s){ return s.piecesInFlight; });
+    publish("bt_torrent_partial_pieces", "Stalled pieces waiting for another peer", Type::Gauge,
+            [](const Stats& s){ return s.partialPieces; });
+    publish("bt_torrent_connect_queue", "Endpoints waiting for or in connection setup", Type::Gauge,
+            [](const Stats& s){ return static_cast<double>(s.connectPending); });
 }
 
 vector<shared_ptr<Peer>> DownloadManager::getConnectedPeers() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
     return m_peers;
 }
 
 int DownloadManager::selectNextPiece() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return selectRarestPiece(nullptr);
+}
+
+int DownloadManager::selectRarestPiece(const Peer* peer, int skipFrom, int skipUntil) const {
+    int best = -1;
     for(int i=0 ; i<m_totalPieces ; i++){
-        if(!m_downloadedPieces[i]){
+        if(m_downloadedPieces[i] || m_inFlight[i] || m_piecePriority[i] == 0){
+            continue;
+        }
+        if(i >= skipFrom && i < skipUntil){
+            continue;
+        }
+        if(peer && !peer->hasPiece(i)){
+            continue;
+        }
+        if(best == -1 || m_piecePriority[i] > m_piecePriority[best] ||
+           (m_piecePriority[i] == m_piecePriority[best] && m_availability[i] < m_availability[best])){
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool DownloadManager::isFastPeer(size_t peerSlot) const {
+    std::vector<double> rates;
+    for(size_t i=0 ; i<m_peers.size() ; i++){
+        if(m_peers[i]->isConnected() && m_peerStats[i].rate > 0){
+            rates.push_back(m_peerStats[i].rate);
+        }
+    }
+    // Until peers have been measured, any of them may serve the window
+    if(rates.empty()){
+        return true;
+    }
+    std::nth_element(rates.begin(), rates.begin() + rates.size() / 2, rates.end());
+    return m_peerStats[peerSlot].rate >= rates[rates.size() / 2];
+}
+
+void DownloadManager::dropLostDeadlines(){
+    const auto now = std::chrono::steady_clock::now();
+    for(auto it = m_pieceDeadlines.begin() ; it != m_pieceDeadlines.end() ; ){
+        const int piece_idx = it->first;
+        bool available = false;
+        for(const auto& peer : m_peers){
+            if(peer->isConnected() && peer->hasPiece(piece_idx)){
+                available = true;
+                break;
+            }
+        }
+        if(it->second < now && !available && !m_inFlight[piece_idx]){
+            // Missed, and no connected peer could deliver it late; fall back to its priority
+            BT_LOG_DEBUG("Dropping missed deadline for piece " << piece_idx);
+            it = m_pieceDeadlines.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+}
+
+int DownloadManager::selectDeadlinePiece(size_t peerSlot){
+    // A piece is "critical" once less than this many expected transfer times remain;
+    // critical pieces may be fetched by up to MAX_DEADLINE_RACERS peers at once
+    static constexpr double CRITICAL_MARGIN = 2.0;
+    static constexpr uint8_t MAX_DEADLINE_RACERS = 3;
+
+    const Peer* peer = m_peers[peerSlot].get();
+    const double rate = m_peerStats[peerSlot].rate;
+    const auto now = std::chrono::steady_clock::now();
+
+    int best = -1;
+    auto bestDeadline = std::chrono::steady_clock::time_point::max();
+    for(const auto& [piece_idx, deadline] : m_pieceDeadlines){
+        if(m_downloadedPieces[piece_idx] || !peer->hasPiece(piece_idx) || deadline >= bestDeadline){
+            continue;
+        }
+        double remaining = std::chrono::duration<double>(deadline - now).count();
+        double expected = rate > 0 ? actualPieceLength(piece_idx) / rate : 0;
+
+        // Skip peers that measurably cannot make it, unless the deadline is already lost
+        if(remaining > 0 && expected > remaining){
+            continue;
+        }
+        bool critical = remaining <= CRITICAL_MARGIN * expected || remaining <= 0;
+        uint8_t racers = m_inFlight[piece_idx];
+        if(racers == 0 || (critical && racers < MAX_DEADLINE_RACERS)){
+            best = piece_idx;
+            bestDeadline = deadline;
+        }
+    }
+    return best;
+}
+
+int DownloadManager::selectPieceForPeer(size_t peerSlot){
+    const Peer* peer = m_peers[peerSlot].get();
+
+    int urgent = selectDeadlinePiece(peerSlot);
+    if(urgent != -1){
+        return urgent;
+    }
+
+    if(m_streamWindow == 0 && m_readUntil <= m_cursorPiece){
+        return selectRarestPiece(peer);
+    }
+    // Walk the missing pieces ahead of the cursor; a pending read() pulls in its
+    // whole range, even pieces that belong to skipped files
+    const bool fast = isFastPeer(peerSlot);
+    int remaining = m_streamWindow;
+    int i = m_cursorPiece;
+    for( ; i<m_totalPieces ; i++){
+        bool demanded = i < m_readUntil;
+        if(!demanded && remaining == 0){
+            break;
+        }
+        if(m_downloadedPieces[i] || (!demanded && m_piecePriority[i] == 0)){
+            continue;
+        }
+        if(!demanded){
+            remaining--;
+        }
+        if(fast && !m_inFlight[i] && peer->hasPiece(i)){
             return i;
         }
     }
-    return -1;
+    // The window is kept for fast peers; a slow one taking a piece there would hold it up
+    return selectRarestPiece(peer, fast ? 0 : m_cursorPiece, fast ? 0 : i);
+}
+
+void DownloadManager::setFilePriority(size_t file_index, FilePriority priority){
+    if(file_index >= m_filePriority.size()){
+        BT_LOG_WARN("Invalid file index: " << file_index);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_filePriority[file_index] = priority;
+    if(m_writeCache){
+        m_writeCache->setFileSkipped(file_index, priority == FilePriority::Skip);
+    }
+    updatePiecePriorities(file_index);
+    m_cv.notify_all();
+}
+
+FilePriority DownloadManager::getFilePriority(size_t file_index) const {
+    return m_filePriority[file_index];
+}
+
+void DownloadManager::updatePiecePriorities(size_t file_index){
+    const auto& file = m_metadata->getFiles()[file_index];
+    if(file.length == 0){
+        return;
+    }
+    int first = static_cast<int>(file.offset / m_piece_length);
+    int last = static_cast<int>((file.offset + file.length - 1) / m_piece_length);
+    for(int i=first ; i<=last ; i++){
+        const auto& span = m_metadata->getPieceFileSpan(i);
+        uint8_t priority = 0;
+        for(uint32_t f=span.first_file ; f<=span.last_file ; f++){
+            if(m_metadata->getFiles()[f].length > 0){
+                priority = std::max(priority, static_cast<uint8_t>(m_filePriority[f]));
+            }
+        }
+        m_piecePriority[i] = priority;
+        publishPieceState(i);
+    }
+}
+
+void DownloadManager::publishPieceState(int piece_idx){
+    uint8_t state = m_piecePriority[piece_idx] == 0 ? Progress::Skipped
+                  : m_downloadedPieces[piece_idx]  ? Progress::Done
+                  : m_inFlight[piece_idx] > 0      ? Progress::InFlight
+                                                   : Progress::Missing;
+    uint8_t previous = m_progress.pieces[piece_idx].exchange(state, std::memory_order_relaxed);
+    if(previous == state){
+        return;
+    }
+    const int64_t length = static_cast<int64_t>(m_metadata->getActualPieceLength(piece_idx));
+    if(previous == Progress::Skipped){
+        m_progress.piecesWanted.fetch_add(1, std::memory_order_relaxed);
+        m_progress.bytesWanted.fetch_add(length, std::memory_order_relaxed);
+    } else if(state == Progress::Skipped){
+        m_progress.piecesWanted.fetch_sub(1, std::memory_order_relaxed);
+        m_progress.bytesWanted.fetch_sub(length, std::memory_order_relaxed);
+    }
+    if(previous == Progress::Done){
+        m_progress.piecesDone.fetch_sub(1, std::memory_order_relaxed);
+        m_progress.bytesDone.fetch_sub(length, std::memory_order_relaxed);
+    } else if(state == Progress::Done){
+        m_progress.piecesDone.fetch_add(1, std::memory_order_relaxed);
+        m_progress.bytesDone.fetch_add(length, std::memory_order_relaxed);
+    }
+}
+
+bool DownloadManager::isPieceWanted(int piece_idx) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_piecePriority[piece_idx] > 0;
+}
+
+int DownloadManager::getWantedPieceCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<int>(std::count_if(m_piecePriority.begin(), m_piecePriority.end(),
+                                          [](uint8_t p) { return p > 0; }));
+}
+
+int DownloadManager::getDownloadedWantedCount() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int count = 0;
+    for(int i=0 ; i<m_totalPieces ; i++){
+        if(m_downloadedPieces[i] && m_piecePriority[i] > 0){
+            count++;
+        }
+    }
+    return count;
 }
  
 shared_ptr<Peer> DownloadManager::selectPeerForPiece(int pieceIdx)  {
+    std::lock_guard<std::mutex> lock(m_mutex);
     for(auto &peer : m_peers){
         if(peer->isConnected() && peer->hasPiece(pieceIdx)){
             return peer;
@@ -64,86 +503,465 @@ shared_ptr<Peer> DownloadManager::selectPeerForPiece(int pieceIdx)  {
 }
 
 int DownloadManager::actualPieceLength(int piece_idx){
-
-    int totalLength = static_cast<int>(m_metadata->getTotalLength());
-        if (piece_idx== m_totalPieces - 1) {
-            return totalLength - (m_totalPieces - 1) * m_piece_length;
-        }
-    return m_piece_length;
-
+    return static_cast<int>(m_metadata->getActualPieceLength(piece_idx));
 }
 
 void DownloadManager::updateDownloadedPiece(int piece_idx , const std::vector<uint8_t>& data){
     // mark this as downloaded 
    if (piece_idx >= 0 && piece_idx < m_totalPieces) {
-        m_pieceData[piece_idx] = data;
-        m_downloadedPieces[piece_idx] = true;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        storePiece(piece_idx, std::vector<uint8_t>(data), lock);
     }
 
 }
 
+bool DownloadManager::touchesSkippedFile(int piece_idx) const {
+    const auto& span = m_metadata->getPieceFileSpan(piece_idx);
+    for(uint32_t f=span.first_file ; f<=span.last_file ; f++){
+        if(m_filePriority[f] == FilePriority::Skip && m_metadata->getFiles()[f].length > 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DownloadManager::storePiece(int piece_idx, std::vector<uint8_t>&& data, std::unique_lock<std::mutex>& lock){
+    // A deadline race may have been won by another peer already
+    if(m_downloadedPieces[piece_idx] || m_storing[piece_idx]){
+        return true;
+    }
+    const int64_t size = static_cast<int64_t>(data.size());
+    // Write-back drops the bytes of skipped files, so read() could not get them back from
+    // disk; pieces touching one stay in m_pieceData and only a wanted part goes to the cache
+    const bool keep = !m_writeCache || touchesSkippedFile(piece_idx);
+    if(m_writeCache && m_piecePriority[piece_idx] > 0){
+        m_storing[piece_idx] = true;
+        m_inFlight[piece_idx]++;  // Keeps the pickers away while the lock is released
+        lock.unlock();
+        bool stored = keep ? m_writeCache->put(piece_idx, std::vector<uint8_t>(data))
+                           : m_writeCache->put(piece_idx, std::move(data));
+        lock.lock();
+        m_inFlight[piece_idx]--;
+        m_storing[piece_idx] = false;
+        if(!stored){
+            // Nothing more can reach the disk: wind every worker down
+            publishPieceState(piece_idx);
+            m_stopping = true;
+            m_cv.notify_all();
+            return false;
+        }
+    }
+    if(keep){
+        m_pieceData[piece_idx] = std::move(data);
+    }
+    m_bytesDownloaded += size;
+    m_downloadedPieces[piece_idx] = true;
+    publishPieceState(piece_idx);
+    m_pieceDeadlines.erase(piece_idx);
+    m_partialPieces.erase(piece_idx);
+    m_cv.notify_all();
+    return true;
+}
+
+namespace {
+auto& g_registry = Metrics::Registry::global();
+Metrics::Histogram& g_pieceLatency = g_registry.histogram(
+    "bt_piece_download_microseconds", "Time for one peer to deliver and verify a piece");
+Metrics::Histogram& g_hashLatency = g_registry.histogram(
+    "bt_hash_verify_microseconds", "SHA1 verification time per piece");
+Metrics::Counter& g_hashFailures = g_registry.counter(
+    "bt_hash_failures_total", "Pieces discarded because their SHA1 did not match");
+Metrics::Counter& g_piecesVerified = g_registry.counter(
+    "bt_pieces_verified_total", "Pieces downloaded and verified");
+}
+
+std::optional<std::vector<uint8_t>> DownloadManager::fetchAndVerify(Peer& peer, int piece_idx, Peer::PartialPiece& partial){
+    int pieceLen = actualPieceLength(piece_idx);
+    if (!peer.downloadBlocks(piece_idx, pieceLen, partial)) {
+        BT_LOG_DEBUG("Peer failed to download piece " << piece_idx);
+        return std::nullopt;
+    }
+    // verify sha1 hash of the piece 
+    auto hash = [&]{
+        Metrics::ScopedTimer hashTimer(g_hashLatency);
+        uint64_t hashStart = Trace::now();
+        std::string digest = HashUtils::computeSHA1(std::string(partial.data.begin(), partial.data.end()));
+        Trace::complete("hash", "piece", hashStart, Trace::now(), "piece", static_cast<uint64_t>(piece_idx));
+        return digest;
+    };
+    // A session's hash pool bounds hashing CPU across all torrents; the worker waits either way
+    std::string hashedVal = m_shared.hashPool ? m_shared.hashPool->submit(hash).get() : hash();
+    const auto& expected = m_pieceHashes[piece_idx];
+    if (hashedVal.size() != expected.size() ||
+        !std::equal(expected.begin(), expected.end(), reinterpret_cast<const uint8_t*>(hashedVal.data()))) {
+        BT_LOG_WARN("Hash mismatch for piece " << piece_idx);
+        g_hashFailures.add();
+        partial = Peer::PartialPiece{};
+        return std::nullopt;
+    }
+    return std::move(partial.data);
+}
+
 std::optional<std::vector<uint8_t>> DownloadManager::downloadPiece(int piece_idx){
-    cout << "downloading piece in download Manager" << endl;
+    BT_LOG_TRACE("downloading piece in download Manager");
     // check pieceidx 
-    if(piece_idx < 0 || piece_idx > m_totalPieces){
-        std::cerr << "Invalid piece index: " << piece_idx << std::endl;
+    if(piece_idx < 0 || piece_idx >= m_totalPieces){
+        BT_LOG_WARN("Invalid piece index: " << piece_idx);
         return std::nullopt;
     }
 
     // you have a valid idx so now select a peer 
     auto peer = selectPeerForPiece(piece_idx);
-    cout << "Peer has been selected : " << peer->m_ip << ":" << peer->m_port << endl;
 
     // check if you got a peer 
     if(!peer){
-        std::cerr << "No available peer for piece " << piece_idx << std::endl;
+        BT_LOG_DEBUG("No available peer for piece " << piece_idx);
         return std::nullopt;
     }
+    BT_LOG_TRACE("Peer has been selected : " << peer->m_ip << ":" << peer->m_port);
+
     // now call the download piece function of this peer for this peice
-    int pieceLen = actualPieceLength(piece_idx);
-    cout << "starting the download" << endl;
-    auto pieceDownloadOpt = peer->downloadPiece(piece_idx, pieceLen);
+    Peer::PartialPiece partial;
+    auto pieceDownloadOpt = fetchAndVerify(*peer, piece_idx, partial);
     if (!pieceDownloadOpt.has_value()) {
-        std::cerr << "Peer failed to download piece " << piece_idx << std::endl;
-        return std::nullopt;
-    }
-    // verify sha1 hash of the piece 
-    std::string hashedVal = HashUtils::computeSHA1(std::string(pieceDownloadOpt->begin(), pieceDownloadOpt->end()));
-    if (hashedVal != m_pieceHashes[piece_idx]) {
-        std::cerr << "Hash mismatch for piece " << piece_idx << std::endl;
         return std::nullopt;
     }
-    cout << "Piece " << piece_idx << " downloaded and verified successfully." << endl;
+    BT_LOG_DEBUG("Piece " << piece_idx << " downloaded and verified successfully.");
     updateDownloadedPiece(piece_idx, pieceDownloadOpt.value());
     return pieceDownloadOpt;
 }
 
+void DownloadManager::start(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_started && !m_stopping){
+        return;
+    }
+    m_started = true;
+    m_stopping = false;
+    if(m_disconnected){
+        // Peers join (and get their workers) again as their handshakes complete
+        m_disconnected = false;
+        queueConnections(m_peersInfo);
+    }
+    m_activeWorkers = static_cast<int>(m_peers.size());
+    for(size_t slot=0 ; slot<m_peers.size() ; slot++){
+        m_workers.emplace_back(&DownloadManager::workerLoop, this, slot);
+    }
+}
 
+void DownloadManager::workerLoop(size_t peerSlot){
+    static constexpr int MAX_PEER_FAILURES = 3;
+    static constexpr double RATE_SMOOTHING = 0.3;
+    static constexpr auto FAILURE_BACKOFF = std::chrono::seconds(1);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // Hold our own reference: m_peers may reallocate as peers are added
+    std::shared_ptr<Peer> peerRef = m_peers[peerSlot];
+    Peer& peer = *peerRef;
+    bool idle = false;
+    std::chrono::steady_clock::time_point idleSince;
 
-bool DownloadManager::assembleFile( std::string& outputPath) {
-    // check if all pieces have been downloaded 
-    outputPath += m_metadata->getName();
-    for(int i=0 ; i<m_totalPieces ; i++){
-        if(!m_downloadedPieces[i]){
-            cerr << "All pieces are not avialable" << endl;
-            return false;
+    while(!m_stopping && peer.isConnected()){
+        int piece_idx = selectPieceForPeer(peerSlot);
+        if(piece_idx == -1){
+            // Nothing to do right now; pieces may come back from failed peers or reads
+            dropLostDeadlines();
+            bool allDone = true;
+            for(int i=0 ; i<m_totalPieces && allDone ; i++){
+                // A pending read() still needs its pieces, skipped or not
+                allDone = m_downloadedPieces[i] || (m_piecePriority[i] == 0 && i >= m_readUntil);
+            }
+            if(allDone && m_streamWindow == 0 && m_pieceDeadlines.empty()){
+                break;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if(!idle){
+                idle = true;
+                idleSince = now;
+                m_idleWorkers++;
+            }
+            else if(m_idleWorkers == m_activeWorkers && now - idleSince >= IDLE_TIMEOUT){
+                // Nobody is fetching and no peer has what is missing: the download is stalled
+                BT_LOG_INFO("No peer has a missing piece; stopping worker for " << peer.m_ip << ":" << peer.m_port);
+                break;
+            }
+            // Keep the idle connection alive and pick up HAVEs that may give us work
+            lock.unlock();
+            peer.poll();
+            lock.lock();
+            // Deadline pieces turn critical with time alone, so poll faster while any exist
+            m_cv.wait_for(lock, m_pieceDeadlines.empty() ? std::chrono::milliseconds(500)
+                                                         : std::chrono::milliseconds(50));
+            continue;
+        }
+        if(idle){
+            idle = false;
+            m_idleWorkers--;
+        }
+        m_inFlight[piece_idx]++;
+        publishPieceState(piece_idx);
+        // Resume from whatever an earlier, stalled attempt left behind
+        Peer::PartialPiece partial;
+        auto resumed = m_partialPieces.find(piece_idx);
+        if(resumed != m_partialPieces.end()){
+            partial = std::move(resumed->second);
+            m_partialPieces.erase(resumed);
+        }
+        lock.unlock();
+
+        auto started = std::chrono::steady_clock::now();
+        auto data = fetchAndVerify(peer, piece_idx, partial);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+        lock.lock();
+        m_inFlight[piece_idx]--;
+        publishPieceState(piece_idx);
+        if(!data && !m_downloadedPieces[piece_idx] && partial.receivedCount() > 0){
+            // Keep the furthest-along copy (deadline races can leave two)
+            auto& kept = m_partialPieces[piece_idx];
+            if(partial.receivedCount() > kept.receivedCount()){
+                kept = std::move(partial);
+            }
+        }
+        PeerStats& stats = m_peerStats[peerSlot];
+        if(data){
+            g_pieceLatency.record(static_cast<uint64_t>(seconds * 1e6));
+            g_piecesVerified.add();
+            double rate = data->size() / std::max(seconds, 1e-6);
+            stats.rate = stats.rate == 0 ? rate : RATE_SMOOTHING * rate + (1 - RATE_SMOOTHING) * stats.rate;
+            stats.failures = 0;
+            // May release the lock while the write-back cache is full; `stats` is not used after
+            storePiece(piece_idx, std::move(*data), lock);
+        }
+        else if(++stats.failures >= MAX_PEER_FAILURES){
+            BT_LOG_INFO("Dropping peer " << peer.m_ip << ":" << peer.m_port << " after repeated failures");
+            peer.m_connected = false;
+        }
+        else{
+            // Step aside so an idle peer can pick up the piece (and its received blocks) first
+            m_cv.notify_all();
+            m_cv.wait_for(lock, FAILURE_BACKOFF);
+            continue;
+        }
+        m_cv.notify_all();
+    }
+    // A paused worker leaves a live connection behind; only a gone peer stops counting
+    if(!peer.isConnected() && m_peerStats[peerSlot].counted){
+        for(int i=0 ; i<m_totalPieces ; i++){
+            if(peer.hasPiece(i) && m_availability[i] > 0){
+                m_availability[i]--;
+            }
+        }
+        peer.setPieceAvailableHandler(nullptr);
+        m_peerStats[peerSlot].counted = false;
+    }
+    if(!peer.isConnected() && m_peerStats[peerSlot].holdsConnection){
+        // The connection is gone; its slot goes back to the session
+        m_shared.connections->release();
+        m_peerStats[peerSlot].holdsConnection = false;
+        m_heldConnections--;
+    }
+    if(idle){
+        m_idleWorkers--;
+    }
+    m_activeWorkers--;
+    m_cv.notify_all();
+}
+
+void DownloadManager::stop(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    m_cv.notify_all();
+}
+
+void DownloadManager::disconnect(){
+    // Taken out under the lock but stopped outside it: the connector calls back
+    // into onPeerConnected with its own lock held
+    std::shared_ptr<PeerConnector> connector;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        connector = std::move(m_connector);
+    }
+    if(connector){
+        connector->stop();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto& peer : m_peers){
+        peer->setPieceAvailableHandler(nullptr);
+        boost::system::error_code ec;
+        peer->m_socket->close(ec);
+        peer->m_connected = false;
+    }
+    if(m_shared.connections){
+        m_shared.connections->release(m_heldConnections);
+    }
+    m_heldConnections = 0;
+    m_peers.clear();
+    m_peerStats.clear();
+    std::fill(m_availability.begin(), m_availability.end(), 0);
+    m_progress.peers.store(std::make_shared<const std::vector<std::shared_ptr<Peer>>>());
+    if(m_writeCache){
+        m_writeCache->flush();
+    }
+    m_disconnected = true;
+}
+
+void DownloadManager::wait(){
+    // Call after stop(): no workers are added once m_stopping is set
+    for(auto &worker : m_workers){
+        if(worker.joinable()){
+            worker.join();
         }
     }
-    
-    // Ensure the directory exists (critical for Gitpod)
-    system("mkdir -p ./downloads");
-    
-    std::ofstream outfile(outputPath, std::ios::binary);
-    if(!outfile){
-        cerr << "error opening the path, recheck the path: " << outputPath << endl;
+    m_workers.clear();
+}
+
+bool DownloadManager::waitForProgress(std::chrono::milliseconds timeout){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_activeWorkers == 0){
         return false;
     }
+    m_cv.wait_for(lock, timeout);
+    return m_activeWorkers > 0;
+}
+
+bool DownloadManager::isComplete() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
     for(int i=0 ; i<m_totalPieces ; i++){
-        outfile.write(reinterpret_cast<const char*>(m_pieceData[i].data()), m_pieceData[i].size());
+        if(m_piecePriority[i] > 0 && !m_downloadedPieces[i]){
+            return false;
+        }
     }
-    outfile.close();
-    std::cout << "File assembled successfully: " << outputPath << std::endl;
     return true;
 }
 
+void DownloadManager::setStreamingWindow(int windowPieces){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_streamWindow = std::max(0, windowPieces);
+    m_cv.notify_all();
+}
+
+void DownloadManager::setReadCursor(size_t offset){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cursorPiece = static_cast<int>(std::min<size_t>(offset / m_piece_length, m_totalPieces));
+    m_cv.notify_all();
+}
+
+void DownloadManager::setPieceDeadline(int piece_idx, int deadline_ms){
+    if(piece_idx < 0 || piece_idx >= m_totalPieces){
+        BT_LOG_WARN("Invalid piece index: " << piece_idx);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_downloadedPieces[piece_idx]){
+        return;
+    }
+    m_pieceDeadlines[piece_idx] = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms);
+    m_cv.notify_all();
+}
+
+void DownloadManager::clearPieceDeadline(int piece_idx){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pieceDeadlines.erase(piece_idx);
+}
+
+std::optional<std::vector<uint8_t>> DownloadManager::read(size_t offset, size_t length){
+    size_t totalLength = m_metadata->getTotalLength();
+    if(offset >= totalLength){
+        return std::vector<uint8_t>{};
+    }
+    length = std::min(length, totalLength - offset);
+    if(length == 0){
+        return std::vector<uint8_t>{};
+    }
+    int first = static_cast<int>(offset / m_piece_length);
+    int last = static_cast<int>((offset + length - 1) / m_piece_length);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cursorPiece = first;
+    m_readUntil = last + 1;
+    m_cv.notify_all();
+
+    auto ready = [&]{
+        for(int i=first ; i<=last ; i++){
+            if(!m_downloadedPieces[i]){
+                return false;
+            }
+        }
+        return true;
+    };
+    while(!ready()){
+        // Workers only exit once they can make no further progress
+        if(m_stopping || m_activeWorkers == 0){
+            return std::nullopt;
+        }
+        m_cv.wait(lock);
+    }
+    // Nothing is demanded any more, unless a later read() has taken over the range
+    if(m_cursorPiece == first && m_readUntil == last + 1){
+        m_readUntil = m_cursorPiece;
+    }
+
+    // Verified pieces never change, so the write-back path copies without the lock
+    if(m_writeCache){
+        lock.unlock();
+    }
+    std::vector<uint8_t> out(length);
+    size_t pos = 0;
+    for(int i=first ; i<=last ; i++){
+        size_t pieceStart = static_cast<size_t>(i) * m_piece_length;
+        size_t from = std::max(offset, pieceStart) - pieceStart;
+        size_t to = std::min(offset + length, pieceStart + m_metadata->getActualPieceLength(i)) - pieceStart;
+        if(m_writeCache && m_pieceData[i].empty()){
+            if(!m_writeCache->read(i, from, out.data() + pos, to - from)){
+                return std::nullopt;
+            }
+        } else {
+            std::copy(m_pieceData[i].begin() + from, m_pieceData[i].begin() + to, out.begin() + pos);
+        }
+        pos += to - from;
+    }
+    return out;
+}
+
+bool DownloadManager::assembleFile( std::string& outputPath) {
+    // check if all wanted pieces have been downloaded 
+    for(int i=0 ; i<m_totalPieces ; i++){
+        if(isPieceWanted(i) && !m_downloadedPieces[i]){
+            BT_LOG_ERROR("All pieces are not avialable");
+            return false;
+        }
+    }
 
+    if(m_writeCache){
+        // Pieces were written as they arrived; only the tail is still cached
+        if(!m_writeCache->finalize()){
+            BT_LOG_ERROR("error flushing pieces under: " << outputPath);
+            return false;
+        }
+        outputPath = m_writeCache->getOutputPath();
+        BT_LOG_INFO("File assembled successfully: " << outputPath);
+        return true;
+    }
+
+    // Storage maps every piece onto the file(s) it spans and creates directories as needed;
+    // slices belonging to skipped files are dropped there
+    Storage storage(m_metadata, outputPath);
+    for(size_t f=0 ; f<m_filePriority.size() ; f++){
+        storage.setFileSkipped(f, m_filePriority[f] == FilePriority::Skip);
+    }
+    for(int i=0 ; i<m_totalPieces ; i++){
+        if(!isPieceWanted(i)){
+            continue;
+        }
+        if(!storage.writePiece(i, m_pieceData[i])){
+            BT_LOG_ERROR("error writing piece " << i << " under: " << outputPath);
+            return false;
+        }
+    }
+    if(!storage.finalize()){
+        return false;
+    }
+    outputPath = storage.getOutputPath();
+    BT_LOG_INFO("File assembled successfully: " << outputPath);
+    return true;
+}
\ No newline at end of file
@@ -2,9 +2,22 @@
 #include <vector>
 #include <string>
 #include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
 #include "torrent.h"      // Contains TorrentMetadata definition.
 #include "peer.h"         // Contains Peer definition.
 #include "tracker.h"    // Or wherever Tracker::PeerInfo is defined.
+#include "event_loop.h"
+#include "peer_connector.h"
+#include "metrics.h"
+#include "thread_pool.h"
+#include "resource_limits.h"
+#include "write_cache.h"
 #include <iostream>
 
 // Forward declarations
@@ -12,23 +25,149 @@ class TorrentMetadata;
 class Peer;
 class Tracker;
 
+// Per-file download priority. Pieces take the highest priority of the files they
+// overlap; pieces that only touch skipped files are never requested or written.
+enum class FilePriority : uint8_t {
+    Skip = 0,
+    Low = 1,
+    Normal = 4,
+    High = 7
+};
+
 class DownloadManager {
 public:
     // Constructor: Takes a pointer to TorrentMetadata and a list of PeerInfo objects.
-    DownloadManager(const TorrentMetadata* metadata, const std::vector<Tracker::PeerInfo>& peersInfo);
+    // peerId is our own 20-byte id, sent in every handshake.
+    DownloadManager(const TorrentMetadata* metadata, const std::vector<Tracker::PeerInfo>& peersInfo,
+                    std::string peerId = "00112233445566778899");
+    ~DownloadManager();
 
-    // Connect to peers: Create Peer objects from the PeerInfo list and attempt connections.
+    // Connect to peers: queue every endpoint from the PeerInfo list for connection.
+    // Returns immediately; peers join the pool as their handshakes complete.
     void connectToPeers();
 
+    // Feed peers from a (re-)announce into the connection pool. Endpoints seen before
+    // are ignored; new ones are connected and, once start() has run, get a worker.
+    void addPeers(const std::vector<Tracker::PeerInfo>& peersInfo);
+
+    // Process-wide resources owned by a Session and shared by its torrents. Any
+    // member left null falls back to this manager's own: a private connect loop,
+    // hashing on the worker thread, no connection or rate limit. Set before the
+    // first peer is queued; the resources must outlive the manager.
+    struct SharedResources {
+        boost::asio::io_context* io_context = nullptr;  // Connection establishment
+        ThreadPool* hashPool = nullptr;
+        ResourceBudget* connections = nullptr;          // One unit per connected peer
+        RateLimiter* rateLimiter = nullptr;             // Download rate over all peers
+    };
+    void setSharedResources(const SharedResources& resources);
+
+    // Limits for connection establishment. Takes effect for peers queued afterwards
+    // if called before the first peer is queued.
+    void setConnectOptions(const PeerConnector::Options& options);
+
+    // Write verified pieces under rootDir through a bounded write-back cache as they
+    // arrive, instead of holding them all in memory for assembleFile(). Workers wait
+    // while the cache is full. Call before start().
+    void enableWriteBack(const std::string& rootDir, const WriteCache::Options& options = {});
+    // True once a write-back failed; the workers stop and the download cannot complete.
+    bool writeFailed() const;
+
+    // Blocks until at least one peer is connected or the timeout expires.
+    bool waitForPeers(std::chrono::milliseconds timeout);
 
-    // Select the next piece to download (e.g., sequentially).
+    // Point-in-time view of the download for monitoring.
+    struct Stats {
+        int connectedPeers = 0;
+        int activeWorkers = 0;
+        int piecesDone = 0;       // Wanted pieces verified
+        int piecesWanted = 0;
+        int piecesInFlight = 0;   // Pieces some worker is fetching right now
+        int partialPieces = 0;    // Stalled pieces parked with some blocks received
+        size_t connectPending = 0; // Endpoints queued or mid-handshake on the connector
+        double downloadRate = 0;  // Sum of the smoothed per-peer rates, bytes/sec
+        int64_t bytesDownloaded = 0;
+        int64_t bytesLeft = 0;
+    };
+    Stats getStats() const;
+
+    // Lock-free view of the download for the terminal progress renderer. Workers
+    // update it under m_mutex as pieces change state; readers never take a lock,
+    // so sampling it cannot stall the network or hash path.
+    struct Progress {
+        enum PieceState : uint8_t { Skipped, Missing, InFlight, Done };
+        std::unique_ptr<std::atomic<uint8_t>[]> pieces;  // PieceState per piece
+        int totalPieces = 0;
+        std::atomic<int> piecesDone{0};      // Wanted pieces verified
+        std::atomic<int> piecesWanted{0};
+        std::atomic<int64_t> bytesDone{0};   // Wanted payload bytes verified
+        std::atomic<int64_t> bytesWanted{0};
+        // Every peer connected since the last disconnect(); replaced as a whole when one joins
+        std::atomic<std::shared_ptr<const std::vector<std::shared_ptr<Peer>>>> peers;
+    };
+    const Progress& progress() const { return m_progress; }
+
+    // Publish getStats() in the global metrics registry, labelled with this
+    // torrent's info hash and name; the series are removed again on destruction.
+    void exportMetrics();
+
+    // Transfer counters reported to the tracker.
+    int64_t getBytesDownloaded() const;
+    int64_t getBytesUploaded() const;
+    int64_t getBytesLeft() const;
+
+
+    // Select the next piece to download: highest priority first, then rarest, then in order.
+    // Returns -1 once every wanted piece has been downloaded.
     int selectNextPiece() const;
 
+    // Background download: one worker thread per connected peer pulls pieces from the picker.
+    // May be called again after stop() and wait() to resume with the peers still connected.
+    void start();
+    void stop();
+    void wait();
+    // After stop() and wait(): close every peer connection, return its unit of
+    // SharedResources::connections and write out the write-back cache, so a
+    // paused download holds only the pieces it keeps in memory without one. The
+    // next start() reconnects the peers seen so far.
+    void disconnect();
+    // Blocks until a piece completes or the timeout expires; false once all workers have exited.
+    // Workers also exit once every one of them has found nothing to fetch for IDLE_TIMEOUT.
+    static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(30);
+    bool waitForProgress(std::chrono::milliseconds timeout);
+    bool isComplete() const;
+
+    // Streaming mode: the `windowPieces` pieces ahead of the read cursor are requested
+    // first, and only from the fastest peers; everything else stays rarest-first.
+    // A window of 0 disables streaming.
+    void setStreamingWindow(int windowPieces);
+    void setReadCursor(size_t offset);
+
+    // Time-critical pieces: the piece should be verified within `deadline_ms` from now.
+    // Deadline pieces are picked before anything else, are raced on several peers once
+    // the deadline gets close, and are never given to peers too slow to make it.
+    void setPieceDeadline(int piece_idx, int deadline_ms);
+    void clearPieceDeadline(int piece_idx);
+
+    // Blocking read of payload bytes [offset, offset + length). Moves the read cursor to
+    // `offset` and waits only for the pieces covering the range. Returns nullopt if the
+    // download stops before those pieces arrive.
+    std::optional<std::vector<uint8_t>> read(size_t offset, size_t length);
+
+    // Selective download for multi-file torrents.
+    void setFilePriority(size_t file_index, FilePriority priority);
+    FilePriority getFilePriority(size_t file_index) const;
+    bool isPieceWanted(int piece_idx) const;
+    int getWantedPieceCount() const;
+    int getDownloadedWantedCount() const;
+
     // Download a given piece by selecting an appropriate peer, calling its download_piece method,
     // and verifying the piece.
     std::optional<std::vector<uint8_t>> downloadPiece(int piece_idx);
 
-    // Once all pieces are downloaded, assemble them into the final file.
+    // Once all pieces are downloaded, assemble them into the final file. With
+    // write-back enabled this only flushes the cache, and the directory passed in
+    // is ignored in favour of the one given to enableWriteBack().
     bool assembleFile( std::string& outputPath);
 
     // Accessor for connected peers.
@@ -40,28 +179,156 @@ public:
     // List of PeerInfo objects from the tracker.
     std::vector<Tracker::PeerInfo> m_peersInfo;
 
+    // Every endpoint ever handed to us, so re-announces only add new peers.
+    PeerEndpointSet m_knownPeers;
+
+    // Our own peer id for handshakes.
+    std::string m_peerId;
+
     // Active (connected) Peer objects.
     std::vector<std::shared_ptr<Peer>> m_peers;
 
     // Track which pieces have been successfully downloaded.
     std::vector<bool> m_downloadedPieces;
 
-    // Storage for raw piece data, indexed by piece index.
+    // Storage for raw piece data, indexed by piece index. Unused with write-back,
+    // where verified pieces go to m_writeCache instead.
     std::vector<std::vector<uint8_t>> m_pieceData;
+    std::unique_ptr<WriteCache> m_writeCache;
 
-    // Storage for expected values of piece hashes for verificariton 
-    std::vector<std::string> m_pieceHashes;
+    // Pieces a worker is handing to m_writeCache with m_mutex released; a racing
+    // peer that verifies the same piece meanwhile drops its copy.
+    std::vector<bool> m_storing;
+
+    // View of the expected piece hashes for verification (owned by m_metadata)
+    std::span<const TorrentMetadata::PieceHash> m_pieceHashes;
 
     int m_totalPieces;
 
+    // Priority of each file (indexed like TorrentMetadata::getFiles()) and the
+    // derived per-piece priority, the max over the files the piece spans.
+    std::vector<FilePriority> m_filePriority;
+    std::vector<uint8_t> m_piecePriority;
+
     int m_piece_length;
 
+    // Per-peer download rate (bytes/sec, smoothed), indexed like m_peers.
+    struct PeerStats {
+        double rate = 0;
+        int failures = 0;
+        bool holdsConnection = false;  // Took a unit of m_shared.connections
+        bool counted = true;           // Its pieces are in m_availability and its HAVEs reach us
+    };
+    std::vector<PeerStats> m_peerStats;
+
+    // Number of workers currently fetching each piece (more than one only for
+    // deadline races), and how many connected peers have each piece.
+    std::vector<uint8_t> m_inFlight;
+    std::vector<int> m_availability;
+
+    // Worker threads and the state they share; everything above that workers
+    // touch is guarded by m_mutex once start() has been called.
+    std::vector<std::thread> m_workers;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    int m_activeWorkers = 0;
+    int m_idleWorkers = 0;      // Workers whose peer currently has nothing for us
+    bool m_started = false;
+    bool m_stopping = false;
+    bool m_disconnected = false;  // disconnect() ran; start() reconnects
+
+    // Verified payload bytes received so far.
+    int64_t m_bytesDownloaded = 0;
+
+    // Streaming state: window size in pieces, the piece under the read cursor and
+    // the end (exclusive) of the range the current read() is waiting for.
+    int m_streamWindow = 0;
+    int m_cursorPiece = 0;
+    int m_readUntil = 0;
+
+    // Blocks already received for pieces whose download stalled or failed, so the
+    // next peer to pick the piece only requests what is still missing.
+    std::unordered_map<int, Peer::PartialPiece> m_partialPieces;
+
+    // Outstanding piece deadlines; entries are dropped once the piece is verified.
+    std::unordered_map<int, std::chrono::steady_clock::time_point> m_pieceDeadlines;
+
+    // Connection establishment runs on its own loop thread; peers are queued
+    // there and handed back fully handshaken.
+    PeerConnector::Options m_connectOptions;
+    SharedResources m_shared;
+    int m_heldConnections = 0;  // Units taken from m_shared.connections
+    std::unique_ptr<EventLoop> m_connectLoop;
+    std::shared_ptr<PeerConnector> m_connector;
+
+    // Published for lock-free readers; see progress().
+    Progress m_progress;
+
+    // Labels of the series registered by exportMetrics(); empty if not exported.
+    Metrics::Labels m_metricLabels;
+    std::vector<std::string> m_metricNames;
+    // One getStats() serves every series of a scrape; see metricsSnapshot().
+    static constexpr auto METRICS_SNAPSHOT_TTL = std::chrono::milliseconds(250);
+    std::mutex m_metricsMutex;
+    Stats m_metricsSnapshot;
+    std::chrono::steady_clock::time_point m_metricsTaken;
+
+    // Helper: getStats(), reused for METRICS_SNAPSHOT_TTL so a scrape scans the pieces once.
+    Stats metricsSnapshot();
+
+    // Helper: Queue endpoints on the connector, creating it on first use (caller holds m_mutex).
+    void queueConnections(const std::vector<Tracker::PeerInfo>& peersInfo);
+
+    // Helper: Wrap an established connection in a Peer and add it to the pool.
+    void onPeerConnected(PeerConnector::Connection&& connection);
+
+    // Helper: Register a connected peer and start its worker if running (caller holds m_mutex).
+    void addConnectedPeer(std::shared_ptr<Peer> peer);
+
+    // Helper: Worker loop for the peer at m_peers[peerSlot].
+    void workerLoop(size_t peerSlot);
+
+    // Helper: Pick a piece for a specific peer (caller holds m_mutex).
+    int selectPieceForPeer(size_t peerSlot);
+
+    // Helper: Most urgent deadline piece this peer can still deliver in time (caller holds m_mutex).
+    int selectDeadlinePiece(size_t peerSlot);
+
+    // Helper: Forget deadlines that have passed for pieces no connected peer has (caller holds m_mutex).
+    void dropLostDeadlines();
+
+    // Helper: Rarest-first pick among wanted, missing, unassigned pieces outside
+    // [skipFrom, skipUntil) (caller holds m_mutex).
+    int selectRarestPiece(const Peer* peer, int skipFrom = 0, int skipUntil = 0) const;
+
+    // Helper: True if the peer is at or above the median measured rate (caller holds m_mutex).
+    bool isFastPeer(size_t peerSlot) const;
+
+    // Helper: Download the missing blocks of one piece from one peer and check it against
+    // its SHA1. `partial` is cleared on a hash mismatch, since any of its blocks may be bad.
+    std::optional<std::vector<uint8_t>> fetchAndVerify(Peer& peer, int piece_idx, Peer::PartialPiece& partial);
+
     // Helper: Mark a piece as downloaded and store its data.
     void updateDownloadedPiece(int piece_idx, const std::vector<uint8_t>& data);
 
+    // Helper: Keep a verified piece in m_pieceData or put it in the write-back cache,
+    // releasing `lock` while put() waits for room. Pieces touching a skipped file are
+    // kept in m_pieceData either way, since their skipped bytes never reach the disk.
+    // Returns false if the write-back failed (caller holds m_mutex through `lock`).
+    bool storePiece(int piece_idx, std::vector<uint8_t>&& data, std::unique_lock<std::mutex>& lock);
+
+    // Helper: True if the piece overlaps a non-empty skipped file (caller holds m_mutex).
+    bool touchesSkippedFile(int piece_idx) const;
+
     // Helper: Calculate the actual length of a given piece.
     int actualPieceLength(int piece_idx);
 
+    // Helper: Bring m_progress in line with one piece's current state (caller holds m_mutex).
+    void publishPieceState(int piece_idx);
+
+    // Helper: Recompute piece priorities for the pieces overlapping one file.
+    void updatePiecePriorities(size_t file_index);
+
     // (Optional) Helper: Choose the best peer for downloading a given piece.
     std::shared_ptr<Peer> selectPeerForPiece(int piece_idx) ;
 };
@@ -0,0 +1,267 @@
+#include "control_server.h"
+#include "../utils/error.h"
+#include "../utils/logger.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <istream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace BitTorrent;
+namespace net = boost::asio;
+using local = net::local::stream_protocol;
+using json = nlohmann::json;
+
+namespace {
+
+// Creates `dir` mode 0700 if it is missing. Anyone else who can write to it
+// could swap the socket file for their own, so other owners and non-sticky
+// group or world write access are refused.
+void checkSocketDirectory(const std::string& dir) {
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0) {
+        if (errno != ENOENT || (::mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) ||
+            ::stat(dir.c_str(), &st) != 0) {
+            throw NetworkError("Cannot create " + dir + ": " + std::strerror(errno));
+        }
+    }
+    const bool foreign = st.st_uid != ::getuid() && st.st_uid != 0;
+    const bool shared = (st.st_mode & (S_IWGRP | S_IWOTH)) && !(st.st_mode & S_ISVTX);
+    if (!S_ISDIR(st.st_mode) || foreign || shared) {
+        throw NetworkError("Refusing to put the control socket in " + dir + ": other users can write to it");
+    }
+}
+
+// Binds the listener at `path`. A leftover socket file from a daemon that died
+// is replaced; one that still accepts connections means a daemon is running.
+local::acceptor bindSocket(net::io_context& io_context, const std::string& path) {
+    const auto parent = std::filesystem::path(path).parent_path();
+    checkSocketDirectory(parent.empty() ? "." : parent.string());
+    boost::system::error_code ec;
+    {
+        local::socket probe(io_context);
+        probe.connect(local::endpoint(path), ec);
+        if (!ec) {
+            throw NetworkError("A daemon is already listening on " + path);
+        }
+    }
+    ::unlink(path.c_str());
+    // The file gets its final mode as bind() creates it; a chmod afterwards
+    // would leave a window with the default permissions
+    const mode_t previous = ::umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    try {
+        local::acceptor acceptor(io_context, local::endpoint(path));
+        ::umask(previous);
+        return acceptor;
+    } catch (...) {
+        ::umask(previous);
+        throw;
+    }
+}
+
+} // namespace
+
+std::string ControlServer::defaultSocketPath() {
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        return std::string(runtime) + "/bittorrent.sock";
+    }
+    return "/tmp/bittorrent-" + std::to_string(::getuid()) + "/bittorrent.sock";
+}
+
+class ControlServer::Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(local::socket socket, std::shared_ptr<ControlServer> server)
+        : m_socket(std::move(socket)), m_server(std::move(server)), m_buffer(MAX_REQUEST_BYTES) {}
+
+    // Safe from any thread; pending reads and writes finish with an error.
+    void close() {
+        net::post(m_socket.get_executor(), [self = shared_from_this()] {
+            boost::system::error_code ec;
+            self->m_socket.close(ec);
+        });
+    }
+
+    void read() {
+        auto self = shared_from_this();
+        net::async_read_until(m_socket, m_buffer, '\n', [self](boost::system::error_code ec, size_t) {
+            if (ec == net::error::not_found) {
+                self->reply({{"ok", false}, {"error", "Request too long"}}, false);
+            } else if (!ec) {
+                self->respond();
+            }
+        });
+    }
+
+private:
+    void respond() {
+        std::istream in(&m_buffer);
+        std::string line;
+        std::getline(in, line);
+        json response;
+        try {
+            response = m_server->handle(json::parse(line));
+        } catch (const json::exception& e) {
+            response = {{"ok", false}, {"error", std::string("Malformed request: ") + e.what()}};
+        }
+        reply(response, true);
+    }
+
+    void reply(const json& response, bool keepReading) {
+        m_response = response.dump() + "\n";
+        auto self = shared_from_this();
+        net::async_write(m_socket, net::buffer(m_response), [self, keepReading](boost::system::error_code ec, size_t) {
+            if (!ec && keepReading) self->read();
+        });
+    }
+
+    local::socket m_socket;
+    std::shared_ptr<ControlServer> m_server;
+    net::streambuf m_buffer;
+    std::string m_response;
+};
+
+ControlServer::ControlServer(net::io_context& io_context, const std::string& path, Session& session,
+                             std::function<void()> onShutdown)
+    : m_io_context(io_context),
+      m_path(path),
+      m_acceptor(bindSocket(io_context, path)),
+      m_session(session),
+      m_onShutdown(std::move(onShutdown)) {}
+
+ControlServer::~ControlServer() {
+    ::unlink(m_path.c_str());
+}
+
+void ControlServer::start() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = true;
+    }
+    accept();
+}
+
+void ControlServer::stop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_running = false;
+    boost::system::error_code ec;
+    m_acceptor.close(ec);
+    for (auto& weak : m_connections) {
+        if (auto connection = weak.lock()) {
+            connection->close();
+        }
+    }
+    m_connections.clear();
+    m_idle.wait(lock, [&] { return m_handling == 0; });
+}
+
+void ControlServer::accept() {
+    auto self = shared_from_this();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        return;
+    }
+    m_acceptor.async_accept(net::make_strand(m_io_context), [self](boost::system::error_code ec, local::socket socket) {
+        if (ec) {
+            if (ec != net::error::operation_aborted) {
+                BT_LOG_WARN("Control socket error: " << ec.message());
+            }
+            return;
+        }
+        auto connection = std::make_shared<Connection>(std::move(socket), self);
+        {
+            std::lock_guard<std::mutex> lock(self->m_mutex);
+            if (!self->m_running) {
+                return;
+            }
+            std::erase_if(self->m_connections, [](const auto& weak) { return weak.expired(); });
+            self->m_connections.push_back(connection);
+        }
+        connection->read();
+        self->accept();
+    });
+}
+
+json ControlServer::handle(const json& request) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return {{"ok", false}, {"error", "Shutting down"}};
+        }
+        m_handling++;
+    }
+    json response = dispatch(request);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_handling--;
+    }
+    m_idle.notify_all();
+    return response;
+}
+
+json ControlServer::dispatch(const json& request) {
+    try {
+        if (!request.is_object() || !request.contains("cmd")) {
+            return {{"ok", false}, {"error", "Expected an object with a \"cmd\" field"}};
+        }
+        const std::string cmd = request.at("cmd").get<std::string>();
+        auto id = [&] { return request.at("id").get<std::string>(); };
+        auto result = [](bool ok) -> json {
+            return ok ? json{{"ok", true}} : json{{"ok", false}, {"error", "Unknown torrent, or not in a state for that"}};
+        };
+
+        if (cmd == "add") {
+            return {{"ok", true}, {"id", m_session.add(request.at("torrent").get<std::string>())}};
+        } else if (cmd == "remove") {
+            return result(m_session.remove(id()));
+        } else if (cmd == "pause") {
+            return result(m_session.pause(id()));
+        } else if (cmd == "resume") {
+            return result(m_session.resume(id()));
+        } else if (cmd == "status") {
+            json torrents = json::array();
+            if (request.contains("id")) {
+                auto status = m_session.status(id());
+                if (!status) {
+                    return result(false);
+                }
+                torrents.push_back(toJson(*status));
+            } else {
+                for (const auto& status : m_session.status()) {
+                    torrents.push_back(toJson(status));
+                }
+            }
+            return {{"ok", true}, {"torrents", torrents}};
+        } else if (cmd == "shutdown") {
+            BT_LOG_INFO("Shutdown requested over the control socket");
+            if (m_onShutdown) {
+                m_onShutdown();
+            }
+            return {{"ok", true}};
+        }
+        return {{"ok", false}, {"error", "Unknown command: " + cmd}};
+    } catch (const std::exception& e) {
+        return {{"ok", false}, {"error", e.what()}};
+    }
+}
+
+json ControlServer::toJson(const Session::TorrentStatus& status) {
+    json out = {{"id", status.id},
+                {"name", status.name},
+                {"state", Session::stateName(status.state)},
+                {"pieces_done", status.piecesDone},
+                {"pieces_wanted", status.piecesWanted},
+                {"bytes_done", status.bytesDone},
+                {"bytes_wanted", status.bytesWanted},
+                {"peers", status.peers}};
+    if (!status.outputPath.empty()) {
+        out["output_path"] = status.outputPath;
+    }
+    if (!status.error.empty()) {
+        out["error"] = status.error;
+    }
+    return out;
+}
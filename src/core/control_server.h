@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <boost/asio.hpp>
+#include "../lib/nlohmann/json.hpp"
+#include "session.h"
+
+// Local control API for a daemon Session over a Unix domain socket. Clients
+// send one JSON object per line and get one JSON object back per line:
+//
+//   {"cmd":"add","torrent":"/abs/path.torrent"}  -> {"ok":true,"id":"<info hash>"}
+//   {"cmd":"remove"|"pause"|"resume","id":"..."} -> {"ok":true}
+//   {"cmd":"status"[,"id":"..."]}                -> {"ok":true,"torrents":[{...}, ...]}
+//   {"cmd":"shutdown"}                           -> {"ok":true}
+//
+// Failures answer {"ok":false,"error":"..."}. The socket file is created
+// mode 0600 in a directory only the daemon's user (or root) can write to, so
+// nobody else can drive it or put their own socket in its place.
+//
+// Create with std::make_shared: pending accepts and connections keep the
+// server alive until stop() closes them.
+class ControlServer : public std::enable_shared_from_this<ControlServer> {
+public:
+    static constexpr size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+    // $XDG_RUNTIME_DIR/bittorrent.sock, or /tmp/bittorrent-<uid>/bittorrent.sock
+    // where there is no runtime directory.
+    static std::string defaultSocketPath();
+
+    // Binds right away, replacing a stale socket file and creating a missing
+    // parent directory mode 0700; throws BitTorrent::NetworkError if another
+    // daemon is listening on the path or the directory is open to other users.
+    ControlServer(boost::asio::io_context& io_context, const std::string& path, Session& session,
+                  std::function<void()> onShutdown);
+    ~ControlServer();
+
+    void start();
+    // Closes the listener and every client connection, then waits for requests
+    // already running; afterwards the Session is no longer touched.
+    void stop();
+
+    // Runs one request against the session; never throws. Refused after stop().
+    nlohmann::json handle(const nlohmann::json& request);
+
+    static nlohmann::json toJson(const Session::TorrentStatus& status);
+
+private:
+    class Connection;
+
+    void accept();
+    nlohmann::json dispatch(const nlohmann::json& request);
+
+    boost::asio::io_context& m_io_context;
+    std::string m_path;
+    boost::asio::local::stream_protocol::acceptor m_acceptor;
+    Session& m_session;
+    std::function<void()> m_onShutdown;
+    std::mutex m_mutex;
+    std::condition_variable m_idle;                   // Signalled as m_handling drops
+    std::vector<std::weak_ptr<Connection>> m_connections;
+    int m_handling = 0;                               // Requests inside handle()
+    bool m_running = false;
+};
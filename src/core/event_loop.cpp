@@ -0,0 +1,35 @@
+#include "event_loop.h"
+#include "../utils/logger.h"
+#include <iostream>
+
+EventLoop::EventLoop(size_t threads) {
+    m_work.emplace(boost::asio::make_work_guard(m_io_context));
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        m_threads.emplace_back([this] {
+            // A throwing handler must not take the loop thread down with it
+            for (;;) {
+                try {
+                    m_io_context.run();
+                    return;
+                } catch (const std::exception& e) {
+                    BT_LOG_ERROR("Event loop handler failed: " << e.what());
+                }
+            }
+        });
+    }
+}
+
+EventLoop::~EventLoop() {
+    stop();
+}
+
+void EventLoop::stop() {
+    m_work.reset();
+    m_io_context.stop();
+    for (auto& thread : m_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    m_threads.clear();
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <optional>
+#include <boost/asio.hpp>
+
+// Shared io_context run by a small pool of threads. Timers and background
+// networking for all components (tracker sessions, connectors, ...) are
+// scheduled here instead of each component spinning up its own context.
+class EventLoop {
+public:
+    explicit EventLoop(size_t threads = 2);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    boost::asio::io_context& context() { return m_io_context; }
+
+    // Stop accepting work and join the loop threads.
+    void stop();
+
+private:
+    boost::asio::io_context m_io_context;
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_work;
+    std::vector<std::thread> m_threads;
+};
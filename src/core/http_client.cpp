@@ -0,0 +1,163 @@
+#include "http_client.h"
+#include "../utils/error.h"
+#include <regex>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+using namespace std;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+namespace {
+
+// A pooled connection owns its io_context, so whichever thread borrows it can
+// drive its operations without touching anyone else's.
+struct Connection {
+    net::io_context ioc;
+    beast::tcp_stream stream{ioc};
+    beast::flat_buffer buffer;
+    std::chrono::steady_clock::time_point idle_since;
+};
+
+struct CachedAddress {
+    tcp::resolver::results_type results;
+    std::chrono::steady_clock::time_point expires;
+};
+
+std::mutex g_pool_mutex;
+std::unordered_map<std::string, std::vector<std::unique_ptr<Connection>>> g_idle;  // "host:port" -> idle connections
+std::unordered_map<std::string, CachedAddress> g_dns;                              // "host:port" -> resolved endpoints
+
+std::unique_ptr<Connection> takeIdle(const std::string& key) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    auto it = g_idle.find(key);
+    if (it == g_idle.end()) return nullptr;
+    auto& idle = it->second;
+    auto now = std::chrono::steady_clock::now();
+    while (!idle.empty()) {
+        auto conn = std::move(idle.back());
+        idle.pop_back();
+        if (now - conn->idle_since < HttpClient::IDLE_TIMEOUT) {
+            return conn;
+        }
+    }
+    return nullptr;
+}
+
+void release(const std::string& key, std::unique_ptr<Connection> conn) {
+    conn->idle_since = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    auto& idle = g_idle[key];
+    if (idle.size() < HttpClient::MAX_IDLE_PER_HOST) {
+        idle.push_back(std::move(conn));
+    }
+}
+
+tcp::resolver::results_type resolve(net::io_context& ioc, const std::string& key,
+                                     const std::string& host, const std::string& port) {
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        auto it = g_dns.find(key);
+        if (it != g_dns.end() && it->second.expires > std::chrono::steady_clock::now()) {
+            return it->second.results;
+        }
+    }
+    tcp::resolver resolver(ioc);
+    auto results = resolver.resolve(host, port);
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    g_dns[key] = {results, std::chrono::steady_clock::now() + HttpClient::DNS_TTL};
+    return results;
+}
+
+void forgetAddress(const std::string& key) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    g_dns.erase(key);
+}
+
+// Run the operation just started on `conn` to completion (or until the stream's deadline).
+beast::error_code run(Connection& conn, beast::error_code& result) {
+    conn.ioc.restart();
+    conn.ioc.run();
+    return result;
+}
+
+} // namespace
+
+void HttpClient::parseUrl(const std::string& url, std::string& protocol, std::string& host,
+                          std::string& port, std::string& target) {
+    // Matches http(s)://host[:port][target]
+    std::regex url_regex(R"(^(https?)://([^/:]+)(?::(\d+))?(/.*)?$)", std::regex::icase);
+    std::smatch match;
+    if (!std::regex_match(url, match, url_regex)) {
+        throw std::invalid_argument("Invalid URL: " + url);
+    }
+    protocol = match[1].str();
+    host = match[2].str();
+    port = match[3].matched && match[3].length() > 0 ? match[3].str() : (protocol == "http" ? "80" : "443");
+    target = match[4].matched && match[4].length() > 0 ? match[4].str() : "/";
+}
+
+HttpClient::Response HttpClient::get(const std::string& url, std::chrono::seconds timeout) {
+    std::string protocol, host, port, target;
+    parseUrl(url, protocol, host, port, target);
+    const std::string key = host + ":" + port;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    http::request<http::empty_body> req{http::verb::get, target, 11};
+    req.set(http::field::host, host);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.keep_alive(true);
+
+    bool allowReuse = true;
+    while (true) {
+        auto conn = allowReuse ? takeIdle(key) : nullptr;
+        const bool reused = conn != nullptr;
+        beast::error_code ec;
+        if (!conn) {
+            conn = std::make_unique<Connection>();
+            auto results = resolve(conn->ioc, key, host, port);
+            conn->stream.expires_at(deadline);
+            conn->stream.async_connect(results, [&](beast::error_code e, const tcp::endpoint&) { ec = e; });
+            if (run(*conn, ec)) {
+                forgetAddress(key);  // The tracker may have moved; resolve again next time
+                throw BitTorrent::NetworkError("connect: " + ec.message());
+            }
+        }
+
+        conn->stream.expires_at(deadline);
+        http::async_write(conn->stream, req, [&](beast::error_code e, size_t) { ec = e; });
+        http::response<http::string_body> res;
+        if (!run(*conn, ec)) {
+            http::async_read(conn->stream, conn->buffer, res, [&](beast::error_code e, size_t) { ec = e; });
+            run(*conn, ec);
+        }
+        if (ec) {
+            // The server may have closed an idle connection; retry once on a fresh one
+            if (reused && std::chrono::steady_clock::now() < deadline) {
+                allowReuse = false;
+                continue;
+            }
+            throw BitTorrent::NetworkError("HTTP request failed: " + ec.message());
+        }
+
+        Response response{res.result_int(), std::move(res.body())};
+        if (res.keep_alive()) {
+            release(key, std::move(conn));
+        }
+        return response;
+    }
+}
+
+void HttpClient::clear() {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    g_idle.clear();
+    g_dns.clear();
+}
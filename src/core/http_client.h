@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <chrono>
+
+// Minimal blocking HTTP/1.1 GET client for tracker announces and scrapes.
+// Connections are kept alive and pooled per host:port, and resolved addresses
+// are cached for DNS_TTL, so repeated requests to the same tracker (periodic
+// re-announces, or many torrents sharing one tracker) reuse an established
+// connection instead of paying for DNS and a TCP handshake every time.
+// Safe to call from several threads; each request borrows its own connection.
+class HttpClient {
+public:
+    struct Response {
+        unsigned status = 0;
+        std::string body;
+    };
+
+    static constexpr auto DNS_TTL = std::chrono::seconds(300);
+    static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(30);  // Pooled connections older than this are closed
+    static constexpr size_t MAX_IDLE_PER_HOST = 4;
+
+    // GET `url` (http://host[:port]/target). The whole request, including connect,
+    // must finish within `timeout`. Throws BitTorrent::NetworkError on failure.
+    static Response get(const std::string& url, std::chrono::seconds timeout);
+
+    // Close all pooled connections and forget cached DNS results.
+    static void clear();
+
+    // Split a URL into protocol, host, port (defaulted from the protocol) and target.
+    static void parseUrl(const std::string& url, std::string& protocol, std::string& host,
+                         std::string& port, std::string& target);
+};
@@ -0,0 +1,168 @@
+#include "metrics.h"
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Metrics {
+
+size_t Counter::shardIndex() {
+    // Threads take shards round-robin on first use and keep them
+    static std::atomic<size_t> next{0};
+    thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return index;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& shard : m_shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t Histogram::bucketIndex(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    int exponent = 63 - std::countl_zero(value);  // >= SUB_BITS
+    size_t sub = static_cast<size_t>(value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return static_cast<size_t>(exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t Histogram::bucketLowerBound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int exponent = static_cast<int>(index / SUB_BUCKETS) + SUB_BITS - 1;
+    uint64_t sub = index % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BITS);
+}
+
+uint64_t Histogram::bucketUpperBound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int exponent = static_cast<int>(index / SUB_BUCKETS) + SUB_BITS - 1;
+    return bucketLowerBound(index) + ((uint64_t(1) << (exponent - SUB_BITS)) - 1);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    // Buckets are read one by one while writers keep going, so count is
+    // recomputed from them to keep quantiles self-consistent
+    Snapshot snapshot;
+    snapshot.buckets.resize(BUCKETS);
+    for (size_t i = 0; i < BUCKETS; i++) {
+        snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.buckets[i];
+    }
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+double Histogram::Snapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return (bucketLowerBound(i) + bucketUpperBound(i)) / 2.0;
+        }
+    }
+    return static_cast<double>(bucketUpperBound(buckets.size() - 1));
+}
+
+uint64_t Histogram::Snapshot::countAtOrBelow(uint64_t bound) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < buckets.size() && bucketUpperBound(i) <= bound; i++) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+void ScopedTimer::stop() {
+    if (!m_histogram) {
+        return;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - m_start;
+    m_histogram->record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+    m_histogram = nullptr;
+}
+
+Registry& Registry::global() {
+    static Registry registry;
+    return registry;
+}
+
+Registry::Series& Registry::findOrCreate(const std::string& name, const std::string& help,
+                                         const Labels& labels, Type type) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto [it, inserted] = m_series.try_emplace({name, labels});
+    Series& series = it->second;
+    if (inserted) {
+        series.entry = Entry{name, help, type, labels};
+        switch (type) {
+        case Type::Counter:
+            series.counter = std::make_unique<Counter>();
+            series.entry.counter = series.counter.get();
+            break;
+        case Type::Gauge:
+            series.gauge = std::make_unique<Gauge>();
+            series.entry.gauge = series.gauge.get();
+            break;
+        case Type::Histogram:
+            series.histogram = std::make_unique<Histogram>();
+            series.entry.histogram = series.histogram.get();
+            break;
+        }
+    } else if (series.entry.type != type) {
+        throw std::logic_error("Metric " + name + " registered with two different types");
+    }
+    return series;
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help, const Labels& labels) {
+    return *findOrCreate(name, help, labels, Type::Counter).counter;
+}
+
+Gauge& Registry::gauge(const std::string& name, const std::string& help, const Labels& labels) {
+    return *findOrCreate(name, help, labels, Type::Gauge).gauge;
+}
+
+Histogram& Registry::histogram(const std::string& name, const std::string& help, const Labels& labels) {
+    return *findOrCreate(name, help, labels, Type::Histogram).histogram;
+}
+
+void Registry::callback(const std::string& name, const std::string& help, Type type, const Labels& labels,
+                        std::function<double()> sample) {
+    if (type == Type::Histogram) {
+        throw std::logic_error("Metric " + name + ": histograms cannot be sampled from a callback");
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series& series = m_series[{name, labels}];
+    if (!series.entry.name.empty() && !series.entry.callback) {
+        throw std::logic_error("Metric " + name + " is already registered as a stored value");
+    }
+    series.callback = std::move(sample);
+    series.entry = Entry{name, help, type, labels};
+    series.entry.callback = &series.callback;
+}
+
+void Registry::remove(const std::string& name, const Labels& labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_series.erase({name, labels});
+}
+
+void Registry::visit(const std::function<void(const Entry&)>& visitor) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& [key, series] : m_series) {
+        visitor(series.entry);
+    }
+}
+
+} // namespace Metrics
@@ -0,0 +1,158 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Process-wide runtime metrics. Recording is lock-free: counters are sharded per
+// thread so hot paths (bytes on the wire, blocks received) never bounce a cache
+// line between workers, and histograms bump one relaxed atomic per sample.
+// The registry mutex is only taken to create, remove or enumerate metrics, so
+// callers look a metric up once and keep the reference.
+namespace Metrics {
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        m_shards[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+private:
+    static constexpr size_t SHARDS = 16;
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    static size_t shardIndex();
+
+    std::array<Shard, SHARDS> m_shards;
+};
+
+class Gauge {
+public:
+    void set(int64_t v) { m_value.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_value{0};
+};
+
+// Log-linear histogram in the style of HdrHistogram: every power of two is split
+// into 2^SUB_BITS linear buckets, so any recorded value is known to within ~6%
+// regardless of magnitude, with a fixed footprint and no allocation per sample.
+// Values are unitless; the latency histograms in this client record microseconds.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        std::vector<uint64_t> buckets;  // BUCKETS entries
+
+        // Value at quantile q in [0, 1] (bucket midpoint); 0 when empty.
+        double quantile(double q) const;
+        // Number of samples <= bound (bucket-granular).
+        uint64_t countAtOrBelow(uint64_t bound) const;
+    };
+
+    void record(uint64_t value) {
+        m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+    }
+    Snapshot snapshot() const;
+
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t bucketLowerBound(size_t index);
+    static uint64_t bucketUpperBound(size_t index);  // Inclusive
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+};
+
+// Records the microseconds between construction and destruction (or stop()).
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : m_histogram(&histogram), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { stop(); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    void stop();
+    void cancel() { m_histogram = nullptr; }
+
+private:
+    Histogram* m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+class Registry {
+public:
+    enum class Type { Counter, Gauge, Histogram };
+
+    // One registered series, as handed to visit().
+    struct Entry {
+        std::string name;
+        std::string help;
+        Type type;
+        Labels labels;
+        const Counter* counter = nullptr;
+        const Gauge* gauge = nullptr;
+        const Histogram* histogram = nullptr;
+        const std::function<double()>* callback = nullptr;  // Sampled at visit() time
+    };
+
+    static Registry& global();
+
+    // Get or create the series for (name, labels). References stay valid until
+    // remove() is called for the same series; the first registration's help wins.
+    Counter& counter(const std::string& name, const std::string& help, const Labels& labels = {});
+    Gauge& gauge(const std::string& name, const std::string& help, const Labels& labels = {});
+    Histogram& histogram(const std::string& name, const std::string& help, const Labels& labels = {});
+
+    // A counter or gauge whose value is read from `sample` whenever the registry is
+    // visited, for state that already lives elsewhere (progress, queue lengths).
+    // `sample` runs under the registry lock; the owner must remove() it before
+    // anything it captures goes away. Re-registering replaces the callback.
+    void callback(const std::string& name, const std::string& help, Type type, const Labels& labels,
+                  std::function<double()> sample);
+
+    // Drop a labelled series whose owner (a torrent, a peer) has gone away.
+    void remove(const std::string& name, const Labels& labels);
+
+    // Every series, ordered by name then labels.
+    void visit(const std::function<void(const Entry&)>& visitor) const;
+
+private:
+    struct Series {
+        Entry entry;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<double()> callback;
+    };
+
+    Series& findOrCreate(const std::string& name, const std::string& help, const Labels& labels, Type type);
+
+    mutable std::mutex m_mutex;
+    std::map<std::pair<std::string, Labels>, Series> m_series;
+};
+
+} // namespace Metrics
@@ -0,0 +1,196 @@
+#include "metrics_server.h"
+#include "../utils/logger.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+using namespace std;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = net::ip::tcp;
+
+namespace {
+
+constexpr double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+std::string escapeLabelValue(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '"') out += "\\\"";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+std::string escapeHelp(const std::string& help) {
+    std::string out;
+    for (char c : help) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+// {a="1",b="2"} plus an optional extra label; empty when there are no labels at all.
+std::string formatLabels(const Metrics::Labels& labels, const std::string& extraName = "",
+                         const std::string& extraValue = "") {
+    if (labels.empty() && extraName.empty()) {
+        return "";
+    }
+    std::string out = "{";
+    bool first = true;
+    auto append = [&](const std::string& name, const std::string& value) {
+        if (!first) out += ",";
+        out += name + "=\"" + escapeLabelValue(value) + "\"";
+        first = false;
+    };
+    for (const auto& [name, value] : labels) {
+        append(name, value);
+    }
+    if (!extraName.empty()) {
+        append(extraName, extraValue);
+    }
+    return out + "}";
+}
+
+const char* typeName(Metrics::Registry::Type type) {
+    switch (type) {
+    case Metrics::Registry::Type::Counter: return "counter";
+    case Metrics::Registry::Type::Gauge: return "gauge";
+    case Metrics::Registry::Type::Histogram: return "summary";
+    }
+    return "untyped";
+}
+
+} // namespace
+
+class MetricsServer::Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(tcp::socket socket, const Metrics::Registry& registry)
+        : m_stream(std::move(socket)), m_registry(registry) {}
+
+    void read() {
+        auto self = shared_from_this();
+        m_request = {};
+        m_stream.expires_after(IDLE_TIMEOUT);
+        http::async_read(m_stream, m_buffer, m_request, [self](beast::error_code ec, size_t) {
+            if (!ec) self->respond();
+        });
+    }
+
+private:
+    void respond() {
+        m_response = {};
+        m_response.version(m_request.version());
+        m_response.keep_alive(m_request.keep_alive());
+        auto target = m_request.target();
+        if (m_request.method() != http::verb::get) {
+            m_response.result(http::status::method_not_allowed);
+            m_response.body() = "GET only\n";
+        } else if (target != "/metrics" && !target.starts_with("/metrics?")) {
+            m_response.result(http::status::not_found);
+            m_response.body() = "Metrics are served at /metrics\n";
+        } else {
+            m_response.result(http::status::ok);
+            m_response.set(http::field::content_type, "text/plain; version=0.0.4; charset=utf-8");
+            m_response.body() = MetricsServer::render(m_registry);
+        }
+        m_response.prepare_payload();
+        auto self = shared_from_this();
+        http::async_write(m_stream, m_response, [self](beast::error_code ec, size_t) {
+            if (!ec && self->m_response.keep_alive()) self->read();
+        });
+    }
+
+    beast::tcp_stream m_stream;
+    const Metrics::Registry& m_registry;
+    beast::flat_buffer m_buffer;
+    http::request<http::empty_body> m_request;
+    http::response<http::string_body> m_response;
+};
+
+MetricsServer::MetricsServer(net::io_context& io_context, const std::string& address, uint16_t port,
+                             const Metrics::Registry& registry)
+    : m_io_context(io_context),
+      m_acceptor(io_context, tcp::endpoint(net::ip::make_address(address), port)),
+      m_registry(registry),
+      m_port(m_acceptor.local_endpoint().port()) {}
+
+void MetricsServer::start() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = true;
+    }
+    accept();
+}
+
+void MetricsServer::stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    boost::system::error_code ec;
+    m_acceptor.close(ec);
+}
+
+void MetricsServer::accept() {
+    auto self = shared_from_this();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        return;
+    }
+    m_acceptor.async_accept(net::make_strand(m_io_context), [self](boost::system::error_code ec, tcp::socket socket) {
+        if (ec) {
+            if (ec != net::error::operation_aborted) {
+                BT_LOG_WARN("Metrics listener error: " << ec.message());
+            }
+            return;
+        }
+        std::make_shared<Connection>(std::move(socket), self->m_registry)->read();
+        self->accept();
+    });
+}
+
+std::string MetricsServer::render(const Metrics::Registry& registry) {
+    std::ostringstream out;
+    out << std::setprecision(17);
+    std::string family;  // HELP/TYPE are written once per metric name
+    registry.visit([&](const Metrics::Registry::Entry& entry) {
+        if (entry.name != family) {
+            family = entry.name;
+            out << "# HELP " << entry.name << " " << escapeHelp(entry.help) << "\n";
+            out << "# TYPE " << entry.name << " " << typeName(entry.type) << "\n";
+        }
+        if (entry.histogram) {
+            auto snapshot = entry.histogram->snapshot();
+            for (double q : QUANTILES) {
+                std::ostringstream label;
+                label << q;
+                out << entry.name << formatLabels(entry.labels, "quantile", label.str()) << " ";
+                if (snapshot.count == 0) {
+                    out << "NaN\n";  // What client libraries report for summaries without observations
+                } else {
+                    out << snapshot.quantile(q) << "\n";
+                }
+            }
+            out << entry.name << "_sum" << formatLabels(entry.labels) << " " << snapshot.sum << "\n";
+            out << entry.name << "_count" << formatLabels(entry.labels) << " " << snapshot.count << "\n";
+            return;
+        }
+        out << entry.name << formatLabels(entry.labels) << " ";
+        if (entry.counter) {
+            out << entry.counter->value();
+        } else if (entry.gauge) {
+            out << entry.gauge->value();
+        } else if (entry.callback) {
+            out << (*entry.callback)();
+        }
+        out << "\n";
+    });
+    return out.str();
+}
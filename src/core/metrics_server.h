@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <boost/asio.hpp>
+#include "metrics.h"
+
+// Serves the metrics registry over HTTP in the Prometheus text exposition
+// format (GET /metrics) on the shared event loop. Histograms are exported as
+// summaries: the HDR buckets give accurate per-node quantiles, which is what we
+// look at to find slow torrents and saturated hosts. Values of *_microseconds
+// histograms are reported as-is.
+//
+// Create with std::make_shared: pending accepts and connections keep the
+// server alive until stop() closes the listener.
+class MetricsServer : public std::enable_shared_from_this<MetricsServer> {
+public:
+    static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(30);  // Per request on a connection
+
+    // Binds right away; throws boost::system::system_error if the address is unusable.
+    MetricsServer(boost::asio::io_context& io_context, const std::string& address, uint16_t port,
+                  const Metrics::Registry& registry = Metrics::Registry::global());
+
+    void start();
+    void stop();
+
+    uint16_t port() const { return m_port; }
+
+    // The registry rendered in Prometheus text format 0.0.4.
+    static std::string render(const Metrics::Registry& registry);
+
+private:
+    class Connection;
+
+    void accept();
+
+    boost::asio::io_context& m_io_context;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    const Metrics::Registry& m_registry;
+    uint16_t m_port;
+    std::mutex m_mutex;
+    bool m_running = false;
+};
@@ -0,0 +1,205 @@
+#include "microbench.h"
+#include "peer.h"
+#include "../utils/bencode.h"
+#include "../utils/hash.h"
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr size_t KiB = 1024;
+constexpr size_t MiB = 1024 * KiB;
+constexpr int BITFIELD_PIECES = 4096;
+constexpr int FRAMING_BATCH = 64;
+
+// Results are folded into this so the compiler cannot drop the measured work.
+volatile size_t g_sink = 0;
+
+struct Case {
+    std::string name;
+    size_t bytes_per_iteration;    // 0 when throughput is meaningless
+    std::function<void()> body;
+};
+
+double threadCpuNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+Microbench::Result measure(const Case& c, std::chrono::milliseconds min_time) {
+    c.body();  // Warm caches and lazily built tables
+    for (uint64_t iterations = 1;; iterations *= 2) {
+        double cpuStart = threadCpuNs();
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            c.body();
+        }
+        auto elapsed = Clock::now() - start;
+        double cpu = threadCpuNs() - cpuStart;
+        if (elapsed >= min_time || iterations >= (1ULL << 40)) {
+            Microbench::Result result;
+            result.name = c.name;
+            result.iterations = iterations;
+            result.real_ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+            result.cpu_ns = cpu / iterations;
+            if (c.bytes_per_iteration > 0) {
+                result.bytes_per_second = c.bytes_per_iteration * 1e9 / result.real_ns;
+            }
+            return result;
+        }
+    }
+}
+
+std::string sizeLabel(size_t bytes) {
+    return bytes >= MiB ? std::to_string(bytes / MiB) + "MiB" : std::to_string(bytes / KiB) + "KiB";
+}
+
+// A torrent shaped like a real multi-file one: announce-list, 200 files and
+// 4096 piece hashes, which dominate the encoded size.
+json sampleTorrent() {
+    json files = json::array();
+    for (int i = 0; i < 200; i++) {
+        files.push_back({{"length", 1048576 + i}, {"path", {"dir" + std::to_string(i % 10), "file" + std::to_string(i) + ".dat"}}});
+    }
+    std::string pieces;
+    for (int i = 0; i < BITFIELD_PIECES; i++) {
+        pieces += HashUtils::computeSHA1(std::to_string(i));
+    }
+    json info = {{"name", "sample"}, {"piece length", 262144}, {"files", files}, {"pieces", pieces}};
+    json tiers = json::array({json::array({"http://tracker.example.org/announce", "udp://tracker.example.org:6969"}),
+                              json::array({"http://backup.example.net/announce"})});
+    return {{"announce", "http://tracker.example.org/announce"}, {"announce-list", tiers},
+            {"created by", "microbench"}, {"info", info}};
+}
+
+// Two Peers joined by a socketpair; the sender's writes are read back by the receiver.
+struct PeerPair {
+    std::unique_ptr<Peer> sender = std::make_unique<Peer>("127.0.0.1", 0, BITFIELD_PIECES);
+    std::unique_ptr<Peer> receiver = std::make_unique<Peer>("127.0.0.1", 0, BITFIELD_PIECES);
+
+    PeerPair() {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("socketpair failed");
+        }
+        sender->adopt(fds[0], false, "", {});
+        receiver->adopt(fds[1], false, "", {});
+    }
+};
+
+std::vector<Case> buildCases() {
+    std::vector<Case> cases;
+
+    auto torrent = std::make_shared<json>(sampleTorrent());
+    auto encoded = std::make_shared<std::string>(BencodeUtils::encode(*torrent));
+    cases.push_back({"bencode/decode_torrent", encoded->size(), [encoded] {
+        g_sink = g_sink + BencodeUtils::decode(*encoded).second;
+    }});
+    cases.push_back({"bencode/encode_torrent", encoded->size(), [torrent] {
+        g_sink = g_sink + BencodeUtils::encode(*torrent).size();
+    }});
+
+    for (size_t size = 16 * KiB; size <= 16 * MiB; size *= 4) {
+        auto data = std::make_shared<std::string>(size, '\x5a');
+        cases.push_back({"sha1/" + sizeLabel(size), size, [data] {
+            g_sink = g_sink + static_cast<unsigned char>(HashUtils::computeSHA1(*data)[0]);
+        }});
+    }
+
+    auto hash = std::make_shared<std::string>(HashUtils::computeSHA1("info"));
+    auto hex = std::make_shared<std::string>(HashUtils::hash_to_hex(*hash));
+    cases.push_back({"hash/hash_to_hex", 0, [hash] {
+        g_sink = g_sink + HashUtils::hash_to_hex(*hash).size();
+    }});
+    cases.push_back({"hash/url_encode", 0, [hex] {
+        g_sink = g_sink + HashUtils::urlEncode(*hex).size();
+    }});
+
+    // A full bitfield re-sent (nothing new) and alternating halves (every other bit new)
+    auto peer = std::make_shared<Peer>("127.0.0.1", 0, BITFIELD_PIECES);
+    auto full = std::make_shared<std::vector<uint8_t>>(BITFIELD_PIECES / 8, 0xFF);
+    cases.push_back({"peer/update_bitfield_same/" + std::to_string(BITFIELD_PIECES), 0, [peer, full] {
+        peer->updateBitfield(*full);
+    }});
+    auto flipping = std::make_shared<Peer>("127.0.0.1", 0, BITFIELD_PIECES);
+    flipping->setPieceAvailableHandler([](uint32_t index) { g_sink = g_sink + index; });
+    auto halves = std::make_shared<std::array<std::vector<uint8_t>, 2>>(std::array<std::vector<uint8_t>, 2>{
+        std::vector<uint8_t>(BITFIELD_PIECES / 8, 0xAA), std::vector<uint8_t>(BITFIELD_PIECES / 8, 0x55)});
+    auto flip = std::make_shared<int>(0);
+    cases.push_back({"peer/update_bitfield_new/" + std::to_string(BITFIELD_PIECES), 0, [flipping, halves, flip] {
+        *flip ^= 1;
+        flipping->updateBitfield((*halves)[*flip]);
+    }});
+
+    auto pair = std::make_shared<PeerPair>();
+    auto block = std::make_shared<Peer::Message>(Peer::Message{Peer::Message::PIECE, std::vector<uint8_t>(8 + 16 * KiB, 0x42)});
+    cases.push_back({"framing/piece_16KiB", block->payload.size() + 5, [pair, block] {
+        pair->sender->sendMessage(*block);
+        auto message = pair->receiver->receiveMessage(std::chrono::milliseconds(1000));
+        if (!message) throw std::runtime_error("framing: message lost");
+        g_sink = g_sink + message->payload.size();
+    }});
+    cases.push_back({"framing/request_batch" + std::to_string(FRAMING_BATCH), FRAMING_BATCH * 17, [pair] {
+        for (int i = 0; i < FRAMING_BATCH; i++) {
+            pair->sender->requestPiece(i, 0, 16 * KiB);
+        }
+        pair->sender->flush();
+        for (int i = 0; i < FRAMING_BATCH; i++) {
+            auto message = pair->receiver->receiveMessage(std::chrono::milliseconds(1000));
+            if (!message) throw std::runtime_error("framing: message lost");
+            g_sink = g_sink + message->payload.size();
+        }
+    }});
+    return cases;
+}
+
+} // namespace
+
+std::vector<Microbench::Result> Microbench::run(const Options& options) {
+    std::vector<Result> results;
+    for (const auto& c : buildCases()) {
+        if (!options.filter.empty() && c.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(measure(c, options.min_time));
+    }
+    return results;
+}
+
+json Microbench::toJson(const std::vector<Result>& results) {
+    json benchmarks = json::array();
+    for (const auto& r : results) {
+        json entry = {
+            {"name", r.name},
+            {"run_type", "iteration"},
+            {"iterations", r.iterations},
+            {"real_time", r.real_ns},
+            {"cpu_time", r.cpu_ns},
+            {"time_unit", "ns"}};
+        if (r.bytes_per_second > 0) {
+            entry["bytes_per_second"] = r.bytes_per_second;
+        }
+        benchmarks.push_back(entry);
+    }
+    std::time_t now = std::time(nullptr);
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    std::ostringstream date;
+    date << std::put_time(&utc, "%Y-%m-%dT%H:%M:%SZ");
+    json context = {
+        {"date", date.str()},
+        {"num_cpus", sysconf(_SC_NPROCESSORS_ONLN)},
+        {"compiler", __VERSION__}};
+    return {{"context", context}, {"benchmarks", benchmarks}};
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "../lib/nlohmann/json.hpp"
+
+// Self-contained microbenchmarks for the client's hot paths: bencode, SHA1 at
+// piece-sized inputs, info-hash encoding, bitfield updates and peer message
+// framing over a loopback connection. Each case is re-run with a doubling
+// iteration count until one batch takes at least `min_time`.
+//
+// toJson() emits the Google Benchmark JSON layout ("context" + "benchmarks"
+// with real_time/cpu_time in ns), so results can be diffed across commits with
+// the usual tooling.
+class Microbench {
+public:
+    struct Options {
+        std::chrono::milliseconds min_time{250};
+        std::string filter;  // Run only cases whose name contains this
+    };
+
+    struct Result {
+        std::string name;
+        uint64_t iterations = 0;
+        double real_ns = 0;        // Wall time per iteration
+        double cpu_ns = 0;         // Thread CPU time per iteration
+        double bytes_per_second = 0;  // 0 for cases without a byte count
+    };
+
+    static std::vector<Result> run(const Options& options);
+    static nlohmann::json toJson(const std::vector<Result>& results);
+};
@@ -1,6 +1,10 @@
 #include "peer.h"
+#include "metrics.h"
+#include "trace.h"
+#include "resource_limits.h"
 #include "../utils/hash.h"
 #include "../utils/error.h"
+#include "../utils/logger.h"
 #include <iostream>
 #include <algorithm>
 #include <array>
@@ -8,13 +12,27 @@
 using namespace std;
 using namespace std::chrono_literals;
 
-Peer::Peer(std::string ip, uint16_t port, int totalLength){
-        cout << "Peer constructor called" << endl;
+namespace {
+auto& g_registry = Metrics::Registry::global();
+Metrics::Counter& g_bytesReceived = g_registry.counter("bt_peer_bytes_received_total", "Bytes read from peers");
+Metrics::Counter& g_bytesSent = g_registry.counter("bt_peer_bytes_sent_total", "Bytes written to peers");
+Metrics::Counter& g_connectFailures = g_registry.counter(
+    "bt_peer_connect_failures_total", "Connection attempts that failed before the bitfield (each retry counts)");
+Metrics::Counter& g_chokes = g_registry.counter("bt_peer_choke_events_total", "Choke state changes received",
+                                                {{"event", "choke"}});
+Metrics::Counter& g_unchokes = g_registry.counter("bt_peer_choke_events_total", "Choke state changes received",
+                                                  {{"event", "unchoke"}});
+Metrics::Histogram& g_requestRtt = g_registry.histogram(
+    "bt_request_rtt_microseconds", "Time from sending a block request to receiving the block");
+}
+
+Peer::Peer(std::string ip, uint16_t port, int totalPieces){
+        BT_LOG_TRACE("Peer constructor called");
         m_ip = ip;
         m_port = port;
         m_socket = make_unique<boost::asio::ip::tcp::socket>(m_io_context);
         m_connected = false;
-        m_bitfield = vector<bool>(totalLength, true); 
+        m_bitfield = vector<bool>(totalPieces, true); 
         // this will not be true in real world and we will need to get its value , 
         //the tracker I am using has the peers which have all the piece so I am hard 
         //coding it 
@@ -29,37 +47,57 @@ Peer::~Peer() {
 
 bool Peer::connect(const std::string& info_hash, const std::string& peer_id) {
     try {
-        std::cout << "Connecting to " << m_ip << ":" << m_port << std::endl;
-        boost::asio::ip::tcp::resolver resolver(m_io_context);
-        boost::asio::ip::tcp::resolver::results_type endpoints = 
-            resolver.resolve(m_ip, std::to_string(m_port));
-        
+        BT_LOG_DEBUG("Connecting to " << m_ip << ":" << m_port);
         boost::system::error_code ec;
-        boost::asio::connect(*m_socket, endpoints, ec);
+        {
+            Trace::Span span("connect", "peer");
+            boost::asio::ip::tcp::resolver resolver(m_io_context);
+            boost::asio::ip::tcp::resolver::results_type endpoints = 
+                resolver.resolve(m_ip, std::to_string(m_port));
+            boost::asio::connect(*m_socket, endpoints, ec);
+        }
         
         if (ec) {
-            std::cerr << "Connection failed: " << ec.message() << std::endl;
+            BT_LOG_DEBUG("Connection failed: " << ec.message());
+            g_connectFailures.add();
             return false;
         }
-        cout << "Connection successful" <<  endl;
+        BT_LOG_DEBUG("Connection successful");
+        applyWritePolicy();
         m_connected = performHandshake(info_hash, peer_id);
         if(!m_connected) return false;
         auto response = receiveMessage();
         if (!response || response->type != Message::Type::BITFIELD) {
             return false;
         }
+        updateBitfield(response->payload);
         return true;
     } catch (const std::exception& e) {
-        std::cerr << "Connection failed: " << e.what() << std::endl;
+        BT_LOG_DEBUG("Connection failed: " << e.what());
         return false;
     }
 }
 
+void Peer::adopt(boost::asio::ip::tcp::socket::native_handle_type fd, bool v6,
+                 std::string remote_peer_id, const std::vector<uint8_t>& bitfield,
+                 const std::vector<uint8_t>& first_message) {
+    m_socket->assign(v6 ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(), fd);
+    applyWritePolicy();
+    m_peer_id = std::move(remote_peer_id);
+    updateBitfield(bitfield);
+    if (!first_message.empty()) {
+        handleMessage(Message{static_cast<Message::Type>(first_message[0]),
+                              std::vector<uint8_t>(first_message.begin() + 1, first_message.end())});
+    }
+    m_connected = true;
+}
+
 bool Peer::performHandshake(const std::string& info_hash, const std::string& peer_id) {
     if (info_hash.size() != 20) {
-        std::cerr << "Invalid info_hash length: " << info_hash.size() << ". Expected 20 bytes." << std::endl;
+        BT_LOG_WARN("Invalid info_hash length: " << info_hash.size() << ". Expected 20 bytes.");
         return false;
     }
+    Trace::Span span("handshake", "peer");
     try {
         static const std::string protocol = "BitTorrent protocol";
         std::array<unsigned char, 68> handshake_msg;
@@ -75,14 +113,16 @@ bool Peer::performHandshake(const std::string& info_hash, const std::string& pee
         boost::system::error_code ec;
         boost::asio::write(*m_socket, boost::asio::buffer(handshake_msg), ec);
         if (ec) {
-            std::cerr << "Failed to send handshake: " << ec.message() << std::endl;
+            BT_LOG_DEBUG("Failed to send handshake: " << ec.message());
             return false;
         }
         // Receive response
         std::array<unsigned char, 68> response;
-        size_t bytes_read = boost::asio::read(*m_socket, boost::asio::buffer(response.data(), response.size()), ec);
+        size_t bytes_read = 0;
+        readExact(response.data(), response.size(), std::chrono::steady_clock::now() + std::chrono::seconds(10),
+                  ec, bytes_read);
         if (ec || bytes_read != response.size()) {
-            std::cerr << "Handshake read failed: " << ec.message() << std::endl;
+            BT_LOG_DEBUG("Handshake read failed: " << ec.message());
             // Close the socket explicitly on error to avoid further operations on a dead socket.
             boost::system::error_code close_ec;
             m_socket->close(close_ec);
@@ -92,46 +132,88 @@ bool Peer::performHandshake(const std::string& info_hash, const std::string& pee
         m_peer_id = p.second;
         return p.first;
     } catch (const std::exception& e) {
-        std::cerr << "Handshake failed: " << e.what() << std::endl;
+        BT_LOG_DEBUG("Handshake failed: " << e.what());
         return false;
     }
 }
 
 bool Peer::sendMessage(const Message& msg) {
-    try {
-        // Message format: <length prefix><message ID><payload>
-        vector<uint8_t> data;
-        uint32_t length = 1 + msg.payload.size(); // message ID (1 byte) + payload
-        
-        // Add length prefix (4 bytes) (big endian format)
-        data.push_back((length >> 24) & 0xFF);
-        data.push_back((length >> 16) & 0xFF);
-        data.push_back((length >> 8) & 0xFF);
-        data.push_back(length & 0xFF);
-        // Add message ID
-        data.push_back(static_cast<uint8_t>(msg.type));
-        // Add payload
-        data.insert(data.end(), msg.payload.begin(), msg.payload.end());
-        boost::system::error_code ec;
-        boost::asio::write(*m_socket, boost::asio::buffer(data), ec);
-        if (ec) {
-            cerr << "SendMessage error: " << ec.message() << endl;
-            return false;
-        }
+    queueMessage(msg.type, msg.payload.data(), msg.payload.size());
+    return flush();
+}
+
+void Peer::queueMessage(Message::Type type, const uint8_t* payload, size_t length) {
+    // Message format: <length prefix><message ID><payload>, length is big endian
+    uint32_t messageLength = static_cast<uint32_t>(1 + length);
+    const uint8_t header[5] = {
+        static_cast<uint8_t>(messageLength >> 24), static_cast<uint8_t>(messageLength >> 16),
+        static_cast<uint8_t>(messageLength >> 8), static_cast<uint8_t>(messageLength),
+        static_cast<uint8_t>(type)
+    };
+    m_outgoing.append(header, sizeof(header));
+    if (length > 0) {
+        m_outgoing.append(payload, length);
+    }
+}
+
+bool Peer::flush() {
+    if (m_outgoing.empty()) {
         return true;
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to send message: " << e.what() << std::endl;
+    }
+    if (m_writePolicy == WritePolicy::Cork) setCork(true);
+    boost::system::error_code ec;
+    size_t written = boost::asio::write(*m_socket, m_outgoing.buffers(), ec);
+    m_outgoing.consume(written);
+    m_bytesSent.fetch_add(written, std::memory_order_relaxed);
+    g_bytesSent.add(written);
+    if (m_writePolicy == WritePolicy::Cork) setCork(false);
+    if (ec) {
+        BT_LOG_DEBUG("SendMessage error: " << ec.message());
         return false;
     }
+    m_lastSent = std::chrono::steady_clock::now();
+    return true;
 }
 
-std::optional<Peer::Message> Peer::receiveMessage(std::chrono::seconds timeout) {
+void Peer::setWritePolicy(WritePolicy policy) {
+    m_writePolicy = policy;
+    applyWritePolicy();
+}
+
+void Peer::applyWritePolicy() {
+    if (!m_socket->is_open()) {
+        return;
+    }
+    boost::system::error_code ec;
+    m_socket->set_option(boost::asio::ip::tcp::no_delay(m_writePolicy != WritePolicy::Default), ec);
+}
+
+void Peer::setCork(bool on) {
+#ifdef TCP_CORK
+    int value = on ? 1 : 0;
+    ::setsockopt(m_socket->native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#else
+    (void)on;
+#endif
+}
+
+std::optional<Peer::Message> Peer::receiveMessage(std::chrono::milliseconds timeout) {
     try {
+        // Anything queued must reach the peer before we wait for its reply
+        if (!flush()) {
+            m_connected = false;
+            return std::nullopt;
+        }
         // Read message length (4 bytes)
-        std::vector<uint8_t> length_buf(4);
+        std::array<uint8_t, 4> length_buf;
         boost::system::error_code ec;
-        
-        if (!readMessage(length_buf, 4, ec)) {
+        size_t transferred = 0;
+        if (!readExact(length_buf.data(), 4, std::chrono::steady_clock::now() + timeout, ec, transferred)) {
+            // Nothing consumed: the peer was just quiet and the stream is still in sync
+            if (ec != boost::asio::error::timed_out || transferred != 0) {
+                m_connected = false;
+                m_socket->close(ec);
+            }
             return std::nullopt;
         }
         
@@ -139,38 +221,66 @@ std::optional<Peer::Message> Peer::receiveMessage(std::chrono::seconds timeout)
         uint32_t length = (length_buf[0] << 24) | (length_buf[1] << 16) |
                          (length_buf[2] << 8) | length_buf[3];
         
+        m_bytesReceived.fetch_add(4, std::memory_order_relaxed);
+        g_bytesReceived.add(4);
         if (length == 0) { // Keep-alive message
-            return Message{Message::Type::CHOKE, {}}; // Return empty message
+            return Message{Message::Type::KEEP_ALIVE, {}};
+        }
+        // PIECE (id, index, begin, block) and BITFIELD (id, bits) are the longest legal messages
+        const size_t maxLength = std::max<size_t>(9 + MAX_BLOCK_SIZE, 1 + (m_bitfield.size() + 7) / 8);
+        if (length > maxLength) {
+            BT_LOG_DEBUG("Peer " << m_ip << ":" << m_port << " sent a " << length << "-byte message; disconnecting");
+            m_connected = false;
+            m_socket->close(ec);
+            return std::nullopt;
         }
         
-        // Read message ID and payload
+        // Read message ID and payload; once the header is in, the body gets its own deadline
         std::vector<uint8_t> message_data(length);
-        if (!readMessage(message_data, length, ec)) {
+        if (!readExact(message_data.data(), length, std::chrono::steady_clock::now() + MESSAGE_BODY_TIMEOUT,
+                       ec, transferred)) {
+            m_connected = false;
+            m_socket->close(ec);
             return std::nullopt;
         }
+        m_bytesReceived.fetch_add(length, std::memory_order_relaxed);
+        g_bytesReceived.add(length);
         
         Message msg;
         msg.type = static_cast<Message::Type>(message_data[0]);
         msg.payload.assign(message_data.begin() + 1, message_data.end());
         return msg;
     } catch (const std::exception& e) {
-        std::cerr << "Failed to receive message: " << e.what() << std::endl;
+        BT_LOG_DEBUG("Failed to receive message: " << e.what());
         return std::nullopt;
     }
 }
 
 bool Peer::readMessage(std::vector<uint8_t>& buffer, size_t length, boost::system::error_code& ec) {
-    size_t total_read = 0;
-    while (total_read < length) {
-        size_t bytes_read = m_socket->read_some(
-            boost::asio::buffer(buffer.data() + total_read, length - total_read), ec);
-        
-        if (ec) {
-            std::cerr << "Read error: " << ec.message() << std::endl;
-            return false;
-        }
-        
-        total_read += bytes_read;
+    size_t transferred = 0;
+    return readExact(buffer.data(), length, std::chrono::steady_clock::now() + MESSAGE_BODY_TIMEOUT, ec, transferred);
+}
+
+bool Peer::readExact(uint8_t* data, size_t length, std::chrono::steady_clock::time_point deadline,
+                     boost::system::error_code& ec, size_t& transferred) {
+    ec = boost::asio::error::would_block;
+    transferred = 0;
+    boost::asio::async_read(*m_socket, boost::asio::buffer(data, length),
+        [&](const boost::system::error_code& result, size_t n) { ec = result; transferred = n; });
+
+    m_io_context.restart();
+    m_io_context.run_until(deadline);
+    if (ec == boost::asio::error::would_block) {
+        // Deadline passed: cancel and let the aborted handler run before `data` goes away
+        m_socket->cancel();
+        m_io_context.restart();
+        m_io_context.run();
+        ec = boost::asio::error::timed_out;
+        return false;
+    }
+    if (ec) {
+        BT_LOG_DEBUG("Read error: " << ec.message());
+        return false;
     }
     return true;
 }
@@ -181,84 +291,266 @@ bool Peer::hasPiece(uint32_t index) const {
 
 
 void Peer::updateBitfield(const std::vector<uint8_t>& bitfield) {
-    m_bitfield.clear();
-    m_bitfield.reserve(bitfield.size() * 8);
-    
-    for (uint8_t byte : bitfield) {
-        for (int i = 7; i >= 0; i--) {
-            m_bitfield.push_back((byte >> i) & 1);
+    // Keep one entry per piece; spare bits in the last byte are ignored
+    const size_t totalPieces = m_bitfield.size();
+    std::vector<bool> previous = std::move(m_bitfield);
+    m_bitfield.assign(totalPieces, false);
+    for (size_t i = 0; i < totalPieces && i / 8 < bitfield.size(); i++) {
+        m_bitfield[i] = (bitfield[i / 8] >> (7 - i % 8)) & 1;
+        if (m_bitfield[i] && !previous[i] && m_onPieceAvailable) {
+            m_onPieceAvailable(static_cast<uint32_t>(i));
         }
     }
 }
 
+void Peer::handleMessage(const Message& msg) {
+    auto readU32 = [&](size_t pos) {
+        return (uint32_t(msg.payload[pos]) << 24) | (uint32_t(msg.payload[pos + 1]) << 16) |
+               (uint32_t(msg.payload[pos + 2]) << 8) | uint32_t(msg.payload[pos + 3]);
+    };
+    switch (msg.type) {
+        case Message::Type::CHOKE:
+            m_choked = true;  // Outstanding requests are dropped by the peer
+            g_chokes.add();
+            break;
+        case Message::Type::UNCHOKE:
+            m_choked = false;
+            g_unchokes.add();
+            break;
+        case Message::Type::INTERESTED:
+            m_peerInterested = true;
+            break;
+        case Message::Type::NOT_INTERESTED:
+            m_peerInterested = false;
+            break;
+        case Message::Type::HAVE:
+            if (msg.payload.size() >= 4) {
+                uint32_t index = readU32(0);
+                if (index < m_bitfield.size() && !m_bitfield[index]) {
+                    m_bitfield[index] = true;
+                    if (m_onPieceAvailable) m_onPieceAvailable(index);
+                }
+            }
+            break;
+        case Message::Type::BITFIELD:
+            updateBitfield(msg.payload);
+            break;
+        case Message::Type::REQUEST:
+        case Message::Type::CANCEL:
+            // We do not upload yet and keep the peer choked, so requests are ignored
+            break;
+        default:
+            // KEEP_ALIVE, PORT, PIECE (left to the caller) and unknown extension messages
+            break;
+    }
+}
 
-bool Peer::requestPiece(uint32_t index, uint32_t begin, uint32_t length) {
+bool Peer::sendKeepAlive() {
+    static const uint8_t keepAlive[4] = {0, 0, 0, 0};
+    m_outgoing.append(keepAlive, sizeof(keepAlive));
+    return flush();
+}
 
-    cout << "requesting Piece " << endl;
+std::optional<Peer::Message> Peer::receivePiece(std::chrono::steady_clock::time_point deadline) {
+    while (m_connected) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - m_lastSent >= KEEPALIVE_INTERVAL && !sendKeepAlive()) {
+            return std::nullopt;
+        }
+        if (now >= deadline) {
+            return std::nullopt;
+        }
+        // Wake up in time for the next keep-alive even if the deadline is further out
+        auto until = std::min(deadline, m_lastSent + KEEPALIVE_INTERVAL);
+        auto msg = receiveMessage(std::chrono::duration_cast<std::chrono::milliseconds>(until - now));
+        if (!msg) {
+            continue;  // Timed out (loop re-checks deadline) or disconnected (loop exits)
+        }
+        handleMessage(*msg);
+        if (msg->type == Message::Type::PIECE) {
+            return msg;
+        }
+        if (m_choked) {
+            return std::nullopt;  // Nothing more will arrive until the next unchoke
+        }
+    }
+    return std::nullopt;
+}
 
-    Message msg;
-    msg.type = Message::Type::REQUEST;
-    
-    // Construct request payload: <index><begin><length>
-    std::vector<uint8_t> payload(12);
+bool Peer::waitForUnchoke(std::chrono::steady_clock::time_point deadline) {
+    while (m_choked && m_connected) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - m_lastSent >= KEEPALIVE_INTERVAL && !sendKeepAlive()) {
+            return false;
+        }
+        if (now >= deadline) {
+            return false;
+        }
+        auto until = std::min(deadline, m_lastSent + KEEPALIVE_INTERVAL);
+        auto msg = receiveMessage(std::chrono::duration_cast<std::chrono::milliseconds>(until - now));
+        if (msg) {
+            handleMessage(*msg);  // A stray PIECE from an earlier request is simply dropped
+        }
+    }
+    return !m_choked && m_connected;
+}
+
+void Peer::poll() {
+    if (!m_connected) return;
+    if (std::chrono::steady_clock::now() - m_lastSent >= KEEPALIVE_INTERVAL && !sendKeepAlive()) {
+        return;
+    }
+    boost::system::error_code ec;
+    while (m_connected && m_socket->available(ec) >= 4 && !ec) {
+        auto msg = receiveMessage(MESSAGE_BODY_TIMEOUT);
+        if (!msg) break;
+        handleMessage(*msg);
+    }
+}
+
+
+bool Peer::requestPiece(uint32_t index, uint32_t begin, uint32_t length) {
+    // Payload: <index><begin><length>
+    uint8_t payload[12];
     for (int i = 0; i < 4; i++) {
         payload[i] = (index >> (24 - i * 8)) & 0xFF;
         payload[i + 4] = (begin >> (24 - i * 8)) & 0xFF;
         payload[i + 8] = (length >> (24 - i * 8)) & 0xFF;
     }
-    msg.payload = std::move(payload);
-    
-    return sendMessage(msg);
+    queueMessage(Message::Type::REQUEST, payload, sizeof(payload));
+    return true;
+}
+
+bool Peer::cancelBlock(uint32_t index, uint32_t begin, uint32_t length) {
+    uint8_t payload[12];
+    for (int i = 0; i < 4; i++) {
+        payload[i] = (index >> (24 - i * 8)) & 0xFF;
+        payload[i + 4] = (begin >> (24 - i * 8)) & 0xFF;
+        payload[i + 8] = (length >> (24 - i * 8)) & 0xFF;
+    }
+    queueMessage(Message::Type::CANCEL, payload, sizeof(payload));
+    return true;
 }
 
 std::optional<std::vector<uint8_t>> Peer::downloadPiece(uint32_t index, int piece_length, int BLOCK_SIZE){
+    PartialPiece partial;
+    if (!downloadBlocks(index, piece_length, partial, BLOCK_SIZE)) {
+        return std::nullopt;
+    }
+    return std::move(partial.data);
+}
+
+bool Peer::downloadBlocks(uint32_t index, int piece_length, PartialPiece& partial, int BLOCK_SIZE){
     
-    cout << "In peer download" << endl;
-    // if (!m_connected || m_choked || !hasPiece(index)) {
-    //     return std::nullopt;
-    // }
+    BT_LOG_TRACE("In peer download");
     // Send interested message if not already interested
     if (!m_interested) {
-        Message msg{Message::Type::INTERESTED, {}};
-        if (!sendMessage(msg)) {
-            return std::nullopt;
-        }
+        // Goes out with the first flush, ahead of our requests
+        queueMessage(Message::Type::INTERESTED, nullptr, 0);
         m_interested = true;
     }
-    // Wait for unchoke
-    if (m_choked) {
-        auto response = receiveMessage();
-        if (!response || response->type != Message::Type::UNCHOKE) {
-            return std::nullopt;
-        }
-        m_choked = false;
+    const int blockCount = (piece_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (partial.received.size() != static_cast<size_t>(blockCount)) {
+        partial.data.assign(piece_length, 0);
+        partial.received.assign(blockCount, false);
     }
-    
-    std::vector<uint8_t> pieceData(piece_length,0);
-    cout << "starting download ..." << endl;
-    // Request blocks
-    for (int offset = 0; offset < piece_length; offset += BLOCK_SIZE) {
-        int length = min(BLOCK_SIZE, piece_length - offset);
-        cout << " sending request .." << endl; 
-        if (!requestPiece(index, offset, length)) {
-            return std::nullopt;
+    auto blockLength = [&](int block) { return min(BLOCK_SIZE, piece_length - block * BLOCK_SIZE); };
+    // Request spans are matched on (peer, piece, block)
+    auto traceId = [&](int block) {
+        return (reinterpret_cast<uintptr_t>(this) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(index) << 20) ^ uint64_t(block);
+    };
+
+    // Keep a few requests in flight; each one carries its own deadline, counted
+    // (like its round trip) from when it actually went out
+    struct Request {
+        int block;
+        std::chrono::steady_clock::time_point sent;  // Unset while only queued
+    };
+    std::vector<Request> outstanding;
+    int nextBlock = 0;
+    while (true) {
+        if (m_choked) {
+            // Choking discards our pending requests; ask again for everything still missing
+            for (const auto& request : outstanding) {
+                Trace::asyncEnd("request", "peer", traceId(request.block));
+            }
+            outstanding.clear();
+            nextBlock = 0;
+            if (!waitForUnchoke(std::chrono::steady_clock::now() + REQUEST_TIMEOUT)) {
+                return false;
+            }
+        }
+        while (outstanding.size() < static_cast<size_t>(MAX_PIPELINE) && nextBlock < blockCount) {
+            int block = nextBlock++;
+            if (partial.received[block]) {
+                continue;
+            }
+            if (m_rateLimiter) {
+                m_rateLimiter->acquire(static_cast<size_t>(blockLength(block)));
+            }
+            if (!requestPiece(index, block * BLOCK_SIZE, blockLength(block))) {
+                return false;
+            }
+            outstanding.push_back({block, {}});
+            Trace::asyncBegin("request", "peer", traceId(block));
+        }
+        if (outstanding.empty()) {
+            break;
+        }
+        // Rate limiting may have held the batch back; the clock starts once it is sent
+        if (outstanding.back().sent == std::chrono::steady_clock::time_point{}) {
+            if (!flush()) {
+                m_connected = false;
+                return false;
+            }
+            const auto sent = std::chrono::steady_clock::now();
+            for (auto& request : outstanding) {
+                if (request.sent == std::chrono::steady_clock::time_point{}) {
+                    request.sent = sent;
+                }
+            }
         }
-        auto block_response = receiveMessage();
-        cout << " response received .." << endl; 
 
-        if (!block_response || block_response->type != Message::Type::PIECE) {
-            return std::nullopt;
+        auto deadline = std::min_element(outstanding.begin(), outstanding.end(),
+            [](const auto& a, const auto& b) { return a.sent < b.sent; })->sent + REQUEST_TIMEOUT;
+        auto block_response = receivePiece(deadline);
+        if (!block_response) {
+            if (m_connected && m_choked) {
+                continue;  // Choked mid-piece: the loop waits for the next unchoke
+            }
+            if (m_connected) {
+                // Stalled request: withdraw everything so the blocks can go to another peer
+                BT_LOG_DEBUG("Block request timed out for piece " << index);
+                for (const auto& request : outstanding) {
+                    cancelBlock(index, request.block * BLOCK_SIZE, blockLength(request.block));
+                    Trace::asyncEnd("request", "peer", traceId(request.block));
+                }
+                flush();
+            }
+            return false;
         }
         if (block_response->payload.size() < 8) {
-            cerr << "PIECE message payload too short." << endl;
-            return nullopt;
+            BT_LOG_WARN("PIECE message payload too short.");
+            return false;
         }
-        
-        std::copy(block_response->payload.begin() + 8, 
-          block_response->payload.end(), 
-          pieceData.begin() + offset);
+        const auto& payload = block_response->payload;
+        uint32_t pieceIndex = (payload[0] << 24) | (payload[1] << 16) | (payload[2] << 8) | payload[3];
+        uint32_t begin = (payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+        auto it = std::find_if(outstanding.begin(), outstanding.end(), [&](const auto& request) {
+            return static_cast<uint32_t>(request.block * BLOCK_SIZE) == begin;
+        });
+        // Late answers to requests cancelled earlier are harmless; drop them
+        if (pieceIndex != index || it == outstanding.end() ||
+            payload.size() - 8 != static_cast<size_t>(blockLength(it->block))) {
+            continue;
+        }
+        g_requestRtt.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - it->sent).count()));
+        Trace::asyncEnd("request", "peer", traceId(it->block));
+        std::copy(payload.begin() + 8, payload.end(), partial.data.begin() + begin);
+        partial.received[it->block] = true;
+        outstanding.erase(it);
     }
-    cout << "Piece data has been acquired";
-    cout << endl;
-    return pieceData;
-}
\ No newline at end of file
+    BT_LOG_TRACE("Piece data has been acquired");
+    return true;
+}
@@ -6,7 +6,14 @@
 #include <bitset>
 #include <boost/asio.hpp>
 #include <optional>
+#include <functional>
+#include <chrono>
+#include <algorithm>
 #include <iostream>
+#include <atomic>
+#include "send_ring.h"
+
+class RateLimiter;
 
 class Peer {
 public:
@@ -20,7 +27,9 @@ public:
             BITFIELD = 5,
             REQUEST = 6,
             PIECE = 7,
-            CANCEL = 8
+            CANCEL = 8,
+            PORT = 9,          // DHT port (BEP 5); we have no DHT, so it is ignored
+            KEEP_ALIVE = -1    // Zero-length message; never sent as an id on the wire
         };
         
         Type type;
@@ -28,20 +37,86 @@ public:
     };
 
 
-    Peer(std::string ip, uint16_t port, int totalLength);
+    // A piece being assembled block by block. It outlives a stalled or failed
+    // download so that another peer only has to fetch the blocks still missing.
+    struct PartialPiece {
+        std::vector<uint8_t> data;
+        std::vector<bool> received;  // One entry per block
+        size_t receivedCount() const { return std::count(received.begin(), received.end(), true); }
+    };
+
+    static constexpr int MAX_PIPELINE = 5;                          // Outstanding block requests
+    static constexpr auto REQUEST_TIMEOUT = std::chrono::seconds(20);  // Per requested block
+    static constexpr auto MESSAGE_BODY_TIMEOUT = std::chrono::seconds(30);
+    static constexpr auto KEEPALIVE_INTERVAL = std::chrono::seconds(90);  // Peers drop us after ~2 minutes of silence
+    static constexpr uint32_t MAX_BLOCK_SIZE = 16 * 1024;               // Largest block we request
+
+    Peer(std::string ip, uint16_t port, int totalPieces);
     ~Peer();
 
     bool connect(const std::string& info_hash, const std::string& peer_id);
+    // Take over a socket that has already completed the handshake and delivered
+    // the peer's bitfield (see PeerConnector). A peer that opened with some other
+    // message has an empty bitfield; that message (id + payload) is handled here.
+    void adopt(boost::asio::ip::tcp::socket::native_handle_type fd, bool v6,
+               std::string remote_peer_id, const std::vector<uint8_t>& bitfield,
+               const std::vector<uint8_t>& first_message = {});
     bool performHandshake(const std::string& info_hash, const std::string& peer_id);
-    bool sendMessage(const Message& msg);
-    std::optional<Message> receiveMessage(std::chrono::seconds timeout = std::chrono::seconds(10));
+    bool sendMessage(const Message& msg);  // Queue the message and flush right away
+
+    // How the socket coalesces our writes. Messages are already batched per flush,
+    // so NoDelay (the default) puts each batch on the wire at once; Cork also holds
+    // back partial segments until the whole batch has been written.
+    enum class WritePolicy { Default, NoDelay, Cork };
+    void setWritePolicy(WritePolicy policy);
+    // Serialize a message into the outgoing queue; nothing is sent until flush().
+    void queueMessage(Message::Type type, const uint8_t* payload, size_t length);
+    // Write everything queued with one gather write. receiveMessage flushes first,
+    // so queued messages always go out before we wait for an answer.
+    bool flush();
+    // Next message, or nullopt if none arrives within `timeout` or the connection
+    // fails. A timeout with nothing read leaves the connection usable; a message
+    // cut off half-way cannot be resynchronized, so the connection is closed. So
+    // is one longer than a PIECE of MAX_BLOCK_SIZE or a full BITFIELD, before
+    // anything is allocated for it.
+    std::optional<Message> receiveMessage(std::chrono::milliseconds timeout = std::chrono::seconds(10));
     bool isConnected() const { return m_connected; }
     bool readMessage(std::vector<uint8_t>& buffer, size_t length, boost::system::error_code& ec);
+    // Read exactly `length` bytes or fail with error::timed_out at `deadline`.
+    // `transferred` reports how much was consumed either way.
+    bool readExact(uint8_t* data, size_t length, std::chrono::steady_clock::time_point deadline,
+                   boost::system::error_code& ec, size_t& transferred);
     
     // New methods for piece download
 
-    bool requestPiece(uint32_t index, uint32_t begin, uint32_t length);
+    bool requestPiece(uint32_t index, uint32_t begin, uint32_t length);  // Queued, see flush()
     std::optional<std::vector<uint8_t>> downloadPiece(uint32_t index, int pieceLength, int BLOCK_SIZE = 16 * 1024);
+    // Fetch the blocks still missing from `partial` (initialized here if empty), with up
+    // to MAX_PIPELINE requests in flight. If a block is not answered within
+    // REQUEST_TIMEOUT the outstanding requests are cancelled and false is returned;
+    // blocks that did arrive stay recorded in `partial`.
+    bool downloadBlocks(uint32_t index, int pieceLength, PartialPiece& partial, int BLOCK_SIZE = 16 * 1024);
+    bool cancelBlock(uint32_t index, uint32_t begin, uint32_t length);   // Queued, see flush()
+
+    // Peer state machine. Every received message goes through handleMessage, which
+    // updates choke/interest state and the peer's bitfield; only PIECE payloads are
+    // left to the caller. Nothing but a broken connection aborts a download.
+    void handleMessage(const Message& msg);
+    // Receive the next PIECE message, handling everything else along the way and
+    // sending keep-alives while we wait. nullopt on timeout or a broken connection.
+    std::optional<Message> receivePiece(std::chrono::steady_clock::time_point deadline);
+    // Block until the peer unchokes us (true) or the deadline passes.
+    bool waitForUnchoke(std::chrono::steady_clock::time_point deadline);
+    // For idle connections: send a keep-alive if one is due and process any
+    // messages that have already arrived, without blocking.
+    void poll();
+    bool sendKeepAlive();
+
+    // Called with a piece index whenever the peer announces a piece it did not
+    // have before (HAVE, or a late BITFIELD). Runs on the thread reading the peer.
+    void setPieceAvailableHandler(std::function<void(uint32_t)> handler) { m_onPieceAvailable = std::move(handler); }
+    // Pace block requests through a (shared) rate limiter; nullptr for no limit.
+    void setRateLimiter(RateLimiter* limiter) { m_rateLimiter = limiter; }
     bool hasPiece(uint32_t index) const;
     void updateBitfield(const std::vector<uint8_t>& bitfield);
     bool verifyPiece(uint32_t index);
@@ -55,6 +130,20 @@ public:
     bool m_choked{true};
     std::string m_peer_id;
     bool m_interested{false};
+    bool m_peerInterested{false};  // The peer wants data from us
+    std::chrono::steady_clock::time_point m_lastSent = std::chrono::steady_clock::now();
+    std::function<void(uint32_t)> m_onPieceAvailable;
+    RateLimiter* m_rateLimiter = nullptr;
+    SendRing m_outgoing;
+    WritePolicy m_writePolicy = WritePolicy::NoDelay;
+    // Wire bytes in each direction, framing included; also summed into the
+    // process-wide bt_peer_bytes_*_total counters.
+    std::atomic<uint64_t> m_bytesReceived{0};
+    std::atomic<uint64_t> m_bytesSent{0};
+
+private:
+    void applyWritePolicy();
+    void setCork(bool on);
     
     
 
@@ -0,0 +1,237 @@
+#include "peer_connector.h"
+#include "metrics.h"
+#include "trace.h"
+#include "../utils/hash.h"
+#include "../utils/logger.h"
+#include <iostream>
+#include <array>
+#include <unistd.h>
+using namespace std;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+namespace {
+constexpr uint32_t MAX_BITFIELD_MESSAGE = 1 << 20;  // Far above any real torrent's bitfield
+constexpr uint8_t BITFIELD_ID = 5;
+Metrics::Counter& g_connectFailures = Metrics::Registry::global().counter(
+    "bt_peer_connect_failures_total", "Connection attempts that failed before the bitfield (each retry counts)");
+}
+
+struct PeerConnector::Attempt {
+    Attempt(net::io_context& io_context, Tracker::PeerInfo peer, int attempts_so_far)
+        : info(std::move(peer)), attempts(attempts_so_far), socket(io_context), timer(io_context) {}
+
+    Tracker::PeerInfo info;
+    int attempts;
+    tcp::socket socket;
+    net::steady_timer timer;
+    std::array<unsigned char, 68> handshake{};
+    std::array<uint8_t, 4> length{};
+    std::vector<uint8_t> message;
+    bool done = false;
+};
+
+PeerConnector::PeerConnector(net::io_context& io_context,
+                             std::string info_hash,
+                             std::string peer_id,
+                             Options options,
+                             ConnectedHandler onConnected)
+    : m_io_context(io_context),
+      m_strand(net::make_strand(io_context)),
+      m_info_hash(std::move(info_hash)),
+      m_peer_id(std::move(peer_id)),
+      m_options(options),
+      m_onConnected(std::move(onConnected)) {}
+
+void PeerConnector::enqueue(const Tracker::PeerInfo& info) {
+    m_pending++;
+    auto self = shared_from_this();
+    net::post(m_strand, [self, info] {
+        self->m_queue.emplace_back(info, 0);
+        self->pump();
+    });
+}
+
+void PeerConnector::stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+}
+
+size_t PeerConnector::pending() const {
+    return m_pending;
+}
+
+void PeerConnector::pump() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+    }
+    while (m_in_flight < m_options.max_half_open && !m_queue.empty()) {
+        auto [info, attempts] = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_in_flight++;
+        begin(std::make_shared<Attempt>(m_io_context, std::move(info), attempts + 1));
+    }
+}
+
+void PeerConnector::begin(std::shared_ptr<Attempt> attempt) {
+    auto self = shared_from_this();
+    boost::system::error_code ec;
+    auto address = net::ip::make_address(attempt->info.ip(), ec);
+    if (ec) {
+        finish(attempt, false, "bad address");
+        return;
+    }
+
+    // One deadline covers the whole establishment; closing the socket aborts whichever step is pending
+    attempt->timer.expires_after(m_options.attempt_timeout);
+    attempt->timer.async_wait(net::bind_executor(m_strand, [attempt](const boost::system::error_code& ec) {
+        if (!ec) {
+            boost::system::error_code ignored;
+            attempt->socket.close(ignored);
+        }
+    }));
+
+    tcp::endpoint endpoint(address, attempt->info.port());
+    const uint64_t traceId = reinterpret_cast<uintptr_t>(attempt.get());
+    Trace::asyncBegin("connect", "peer", traceId);
+    attempt->socket.async_connect(endpoint, net::bind_executor(m_strand,
+        [self, attempt, traceId](const boost::system::error_code& ec) {
+            Trace::asyncEnd("connect", "peer", traceId);
+            if (ec) {
+                self->finish(attempt, false, "connect: " + ec.message());
+                return;
+            }
+            auto& hs = attempt->handshake;
+            static const std::string protocol = "BitTorrent protocol";
+            hs[0] = static_cast<unsigned char>(protocol.size());
+            std::copy(protocol.begin(), protocol.end(), hs.begin() + 1);
+            std::fill(hs.begin() + 20, hs.begin() + 28, 0);  // Reserved bytes
+            std::copy(self->m_info_hash.begin(), self->m_info_hash.end(), hs.begin() + 28);
+            std::copy(self->m_peer_id.begin(), self->m_peer_id.end(), hs.begin() + 48);
+
+            Trace::asyncBegin("handshake", "peer", traceId);
+            net::async_write(attempt->socket, net::buffer(hs), net::bind_executor(self->m_strand,
+                [self, attempt, traceId](const boost::system::error_code& ec, size_t) {
+                    if (ec) {
+                        Trace::asyncEnd("handshake", "peer", traceId);
+                        self->finish(attempt, false, "handshake write: " + ec.message());
+                        return;
+                    }
+                    net::async_read(attempt->socket, net::buffer(attempt->handshake), net::bind_executor(self->m_strand,
+                        [self, attempt, traceId](const boost::system::error_code& ec, size_t) {
+                            Trace::asyncEnd("handshake", "peer", traceId);
+                            if (ec) {
+                                self->finish(attempt, false, "handshake read: " + ec.message());
+                                return;
+                            }
+                            auto [ok, remote_id] = HashUtils::verifyHandshakeResponse(attempt->handshake, self->m_info_hash);
+                            if (!ok) {
+                                self->finish(attempt, false, "handshake mismatch");
+                                return;
+                            }
+                            attempt->info.peer_id = remote_id;
+                            self->readBitfieldMessage(attempt);
+                        }));
+                }));
+        }));
+}
+
+void PeerConnector::readBitfieldMessage(std::shared_ptr<Attempt> attempt) {
+    auto self = shared_from_this();
+    net::async_read(attempt->socket, net::buffer(attempt->length), net::bind_executor(m_strand,
+        [self, attempt](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                self->finish(attempt, false, "bitfield read: " + ec.message());
+                return;
+            }
+            const auto& len = attempt->length;
+            uint32_t length = (uint32_t(len[0]) << 24) | (uint32_t(len[1]) << 16) | (uint32_t(len[2]) << 8) | len[3];
+            if (length == 0) {
+                self->readBitfieldMessage(attempt);  // Keep-alive
+                return;
+            }
+            if (length > MAX_BITFIELD_MESSAGE) {
+                self->finish(attempt, false, "oversized first message");
+                return;
+            }
+            attempt->message.resize(length);
+            net::async_read(attempt->socket, net::buffer(attempt->message), net::bind_executor(self->m_strand,
+                [self, attempt](const boost::system::error_code& ec, size_t) {
+                    if (ec) {
+                        self->finish(attempt, false, "bitfield read: " + ec.message());
+                        return;
+                    }
+                    // BITFIELD is optional for peers with no pieces; whatever came first is kept
+                    self->finish(attempt, true, "");
+                }));
+        }));
+}
+
+// Runs on m_strand.
+void PeerConnector::finish(std::shared_ptr<Attempt> attempt, bool ok, std::string reason) {
+    if (attempt->done) return;
+    // The timeout may close the socket after the last read completed but before its
+    // handler ran; such an attempt fails like any other
+    bool v6 = false;
+    tcp::socket::native_handle_type fd = -1;
+    if (ok) {
+        boost::system::error_code ec;
+        if (!attempt->socket.is_open()) {
+            ec = net::error::bad_descriptor;
+        } else {
+            v6 = attempt->socket.local_endpoint(ec).address().is_v6();
+            if (!ec) {
+                fd = attempt->socket.release(ec);
+            }
+        }
+        if (ec) {
+            ok = false;
+            reason = "socket lost before hand-over: " + ec.message();
+        }
+    }
+    attempt->done = true;
+    attempt->timer.cancel();
+    m_in_flight--;
+    if (!ok) {
+        g_connectFailures.add();
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        if (ok) {
+            ::close(fd);
+        }
+        return;
+    }
+    if (ok) {
+        Connection connection;
+        connection.info = attempt->info;
+        connection.v6 = v6;
+        connection.remote_peer_id = attempt->info.peer_id;
+        if (attempt->message[0] == BITFIELD_ID) {
+            connection.bitfield.assign(attempt->message.begin() + 1, attempt->message.end());
+        } else {
+            connection.first_message = std::move(attempt->message);
+        }
+        connection.fd = fd;
+        m_pending--;
+        m_onConnected(std::move(connection));
+    } else if (attempt->attempts < m_options.max_attempts) {
+        // Back off before trying this endpoint again; its slot goes to the next one now
+        auto delay = m_options.retry_backoff * (1 << (attempt->attempts - 1));
+        auto retry = std::make_shared<net::steady_timer>(m_io_context, delay);
+        auto self = shared_from_this();
+        retry->async_wait(net::bind_executor(m_strand,
+            [self, retry, info = attempt->info, attempts = attempt->attempts](const boost::system::error_code& ec) {
+                if (ec) return;
+                self->m_queue.emplace_back(info, attempts);
+                self->pump();
+            }));
+    } else {
+        BT_LOG_DEBUG("Giving up on peer " << attempt->info.endpoint.toString() << " (" << reason << ")");
+        m_pending--;
+    }
+    lock.unlock();
+    pump();
+}
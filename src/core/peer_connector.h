@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <boost/asio.hpp>
+#include "tracker.h"
+
+// Establishes peer connections asynchronously: TCP connect, handshake and the
+// peer's first message (normally its bitfield), all under one per-attempt timeout. At most `max_half_open`
+// attempts are in flight; the rest wait in a FIFO queue, so one unreachable
+// address costs a queue slot for `attempt_timeout` instead of blocking every
+// other peer behind an OS-level connect timeout. Failed endpoints are retried
+// with exponential backoff up to `max_attempts` times.
+//
+// Create with std::make_shared: queued handlers keep the connector alive, and
+// after stop() they no longer call the connected handler.
+class PeerConnector : public std::enable_shared_from_this<PeerConnector> {
+public:
+    struct Options {
+        size_t max_half_open = 32;
+        std::chrono::milliseconds attempt_timeout{5000};  // Connect + handshake + bitfield
+        int max_attempts = 3;
+        std::chrono::milliseconds retry_backoff{2000};    // Doubles after every failed attempt
+    };
+
+    // A fully established connection, ready to be adopted by a Peer.
+    struct Connection {
+        Tracker::PeerInfo info;
+        boost::asio::ip::tcp::socket::native_handle_type fd;  // Owned by the receiver
+        bool v6 = false;
+        std::string remote_peer_id;
+        std::vector<uint8_t> bitfield;       // Empty if the peer opened with another message
+        std::vector<uint8_t> first_message;  // That message (id + payload), for the Peer to handle
+    };
+    using ConnectedHandler = std::function<void(Connection&&)>;
+
+    PeerConnector(boost::asio::io_context& io_context,
+                  std::string info_hash,
+                  std::string peer_id,
+                  Options options,
+                  ConnectedHandler onConnected);
+
+    // Queue an endpoint for connection. Returns immediately.
+    void enqueue(const Tracker::PeerInfo& info);
+
+    // Stop connecting; once this returns the connected handler is not running and will not run.
+    void stop();
+
+    // Endpoints queued or in flight (including those waiting for a retry).
+    size_t pending() const;
+
+private:
+    struct Attempt;
+
+    void pump();
+    void begin(std::shared_ptr<Attempt> attempt);
+    void readBitfieldMessage(std::shared_ptr<Attempt> attempt);
+    void finish(std::shared_ptr<Attempt> attempt, bool ok, std::string reason);
+
+    boost::asio::io_context& m_io_context;
+    boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+    std::string m_info_hash;
+    std::string m_peer_id;
+    Options m_options;
+    ConnectedHandler m_onConnected;
+
+    // Queue and counters are only touched on m_strand; m_mutex guards m_running
+    // and is held while calling m_onConnected.
+    std::deque<std::pair<Tracker::PeerInfo, int>> m_queue;  // (endpoint, attempts so far)
+    size_t m_in_flight = 0;
+    std::atomic<size_t> m_pending{0};
+    mutable std::mutex m_mutex;
+    bool m_running = true;
+};
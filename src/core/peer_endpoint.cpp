@@ -0,0 +1,112 @@
+#include "peer_endpoint.h"
+#include <cstring>
+#include <arpa/inet.h>
+using namespace std;
+
+PeerEndpoint PeerEndpoint::fromCompact(const uint8_t* data, size_t length) {
+    PeerEndpoint endpoint;
+    std::memcpy(endpoint.m_bytes.data(), data, length);
+    endpoint.m_size = static_cast<uint8_t>(length);
+    return endpoint;
+}
+
+std::optional<PeerEndpoint> PeerEndpoint::fromString(const std::string& ip, uint16_t port) {
+    PeerEndpoint endpoint;
+    uint8_t address[16];
+    if (::inet_pton(AF_INET, ip.c_str(), address) == 1) {
+        std::memcpy(endpoint.m_bytes.data(), address, 4);
+        endpoint.m_size = V4_SIZE;
+    } else if (::inet_pton(AF_INET6, ip.c_str(), address) == 1) {
+        static const uint8_t v4_mapped_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+        if (std::memcmp(address, v4_mapped_prefix, 12) == 0) {
+            std::memcpy(endpoint.m_bytes.data(), address + 12, 4);
+            endpoint.m_size = V4_SIZE;
+        } else {
+            std::memcpy(endpoint.m_bytes.data(), address, 16);
+            endpoint.m_size = V6_SIZE;
+        }
+    } else {
+        return std::nullopt;
+    }
+    endpoint.m_bytes[endpoint.m_size - 2] = static_cast<uint8_t>(port >> 8);
+    endpoint.m_bytes[endpoint.m_size - 1] = static_cast<uint8_t>(port & 0xFF);
+    return endpoint;
+}
+
+uint16_t PeerEndpoint::port() const {
+    if (m_size == 0) return 0;
+    return static_cast<uint16_t>((m_bytes[m_size - 2] << 8) | m_bytes[m_size - 1]);
+}
+
+std::string PeerEndpoint::ip() const {
+    char buffer[INET6_ADDRSTRLEN];
+    if (m_size == 0 || !::inet_ntop(isV6() ? AF_INET6 : AF_INET, m_bytes.data(), buffer, sizeof(buffer))) {
+        return "";
+    }
+    return buffer;
+}
+
+std::string PeerEndpoint::toString() const {
+    std::string port_str = std::to_string(port());
+    return isV6() ? "[" + ip() + "]:" + port_str : ip() + ":" + port_str;
+}
+
+size_t PeerEndpoint::hash() const {
+    // FNV-1a over the packed bytes, then a final mix so linear probing sees
+    // well-spread low bits even for peers in the same subnet
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < m_size; i++) {
+        h = (h ^ m_bytes[i]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+bool PeerEndpoint::operator==(const PeerEndpoint& other) const {
+    return m_size == other.m_size && std::memcmp(m_bytes.data(), other.m_bytes.data(), m_size) == 0;
+}
+
+size_t PeerEndpointSet::findSlot(const PeerEndpoint& endpoint) const {
+    size_t mask = m_slots.size() - 1;
+    size_t idx = endpoint.hash() & mask;
+    while (!m_slots[idx].bytes().empty() && !(m_slots[idx] == endpoint)) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+bool PeerEndpointSet::insert(const PeerEndpoint& endpoint) {
+    if (endpoint.bytes().empty()) {
+        return false;
+    }
+    // Keep the load factor at or below 1/2 so probe sequences stay short
+    if ((m_count + 1) * 2 > m_slots.size()) {
+        grow();
+    }
+    size_t idx = findSlot(endpoint);
+    if (!m_slots[idx].bytes().empty()) {
+        return false;
+    }
+    m_slots[idx] = endpoint;
+    m_count++;
+    return true;
+}
+
+bool PeerEndpointSet::contains(const PeerEndpoint& endpoint) const {
+    if (m_slots.empty() || endpoint.bytes().empty()) {
+        return false;
+    }
+    return !m_slots[findSlot(endpoint)].bytes().empty();
+}
+
+void PeerEndpointSet::grow() {
+    std::vector<PeerEndpoint> old = std::move(m_slots);
+    m_slots.assign(old.empty() ? INITIAL_CAPACITY : old.size() * 2, PeerEndpoint{});
+    for (const auto& endpoint : old) {
+        if (!endpoint.bytes().empty()) {
+            m_slots[findSlot(endpoint)] = endpoint;
+        }
+    }
+}
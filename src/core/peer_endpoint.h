@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// A peer's address and port in the compact wire encoding trackers use:
+// 4 address bytes + 2 port bytes for IPv4 (BEP 23), 16 + 2 for IPv6 (BEP 7),
+// all in network byte order. Fixed-size and allocation-free, so large peer
+// lists can be parsed, compared and hashed without building strings.
+class PeerEndpoint {
+public:
+    static constexpr size_t V4_SIZE = 6;
+    static constexpr size_t V6_SIZE = 18;
+
+    PeerEndpoint() = default;
+
+    // From one compact entry; `length` must be V4_SIZE or V6_SIZE.
+    static PeerEndpoint fromCompact(const uint8_t* data, size_t length);
+
+    // From a textual IP literal. IPv4-mapped IPv6 addresses are stored as IPv4 so
+    // they deduplicate against the plain form. Returns nullopt for host names.
+    static std::optional<PeerEndpoint> fromString(const std::string& ip, uint16_t port);
+
+    bool isV6() const { return m_size == V6_SIZE; }
+    uint16_t port() const;
+    std::string ip() const;        // Formatted on demand, e.g. for connecting or display
+    std::string toString() const;  // "1.2.3.4:6881" or "[::1]:6881"
+
+    std::span<const uint8_t> bytes() const { return {m_bytes.data(), m_size}; }
+    size_t hash() const;
+
+    bool operator==(const PeerEndpoint& other) const;
+
+private:
+    std::array<uint8_t, V6_SIZE> m_bytes{};
+    uint8_t m_size = 0;  // 0 only for a default-constructed (empty) endpoint
+};
+
+// Insert-only set of endpoints with open addressing and linear probing.
+// Slots are stored inline in one vector, so membership checks touch a single
+// cache line in the common case and inserting never allocates per element.
+class PeerEndpointSet {
+public:
+    // Returns true if the endpoint was not in the set yet.
+    bool insert(const PeerEndpoint& endpoint);
+    bool contains(const PeerEndpoint& endpoint) const;
+    size_t size() const { return m_count; }
+
+private:
+    static constexpr size_t INITIAL_CAPACITY = 64;  // Power of two
+
+    std::vector<PeerEndpoint> m_slots;  // Empty endpoints mark free slots
+    size_t m_count = 0;
+
+    size_t findSlot(const PeerEndpoint& endpoint) const;  // Slot holding it, or the free slot where it goes
+    void grow();
+};
@@ -0,0 +1,239 @@
+#include "progress_renderer.h"
+#include "../utils/terminal_ui.h"
+#include "../utils/logger.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+namespace Colors = TerminalUI::Colors;
+
+namespace {
+
+constexpr double RATE_TIME_CONSTANT = 2.0;  // Seconds; smooths rates over roughly this window
+constexpr int BAR_WIDTH = 40;
+
+std::string formatRate(double bytesPerSecond) {
+    return TerminalUI::formatFileSize(static_cast<long long>(bytesPerSecond)) + "/s";
+}
+
+std::string formatEta(int64_t left, double rate) {
+    if (left <= 0) {
+        return "0:00";
+    }
+    if (rate < 1) {
+        return "--:--";
+    }
+    auto seconds = static_cast<int64_t>(std::ceil(left / rate));
+    std::ostringstream out;
+    if (seconds >= 3600) {
+        out << seconds / 3600 << ":" << std::setw(2) << std::setfill('0') << (seconds / 60) % 60 << ":";
+    } else {
+        out << seconds / 60 << ":";
+    }
+    out << std::setw(2) << std::setfill('0') << seconds % 60;
+    return out.str();
+}
+
+} // namespace
+
+ProgressRenderer::ProgressRenderer(const DownloadManager::Progress& progress, std::string label)
+    : m_progress(progress), m_label(std::move(label)), m_interactive(isatty(STDOUT_FILENO) != 0) {}
+
+ProgressRenderer::~ProgressRenderer() {
+    stop();
+}
+
+void ProgressRenderer::start() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) {
+            return;
+        }
+        m_running = true;
+        m_lastSample = std::chrono::steady_clock::now();
+    }
+    // The writer thread takes m_mutex inside the hooks, so install them unlocked
+    if (m_interactive) {
+        // Terminal output from here on goes through the logger, which clears our
+        // block before each batch and puts it back after
+        Logger::flush();
+        Logger::setConsoleHooks(
+            [this] {
+                m_mutex.lock();
+                erase();
+            },
+            [this] {
+                draw();
+                m_mutex.unlock();
+            });
+    }
+    m_thread = std::thread(&ProgressRenderer::run, this);
+}
+
+void ProgressRenderer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+    if (!m_interactive) {
+        return;
+    }
+    Logger::flush();
+    Logger::setConsoleHooks(nullptr, nullptr);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    sample();
+    erase();
+    m_frame = renderFrame();
+    draw();
+    std::cout << std::endl;
+    m_frameLines = 0;
+}
+
+void ProgressRenderer::run() {
+    auto lastPlain = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        sample();
+        if (m_interactive) {
+            m_frame = renderFrame();
+            erase();
+            draw();
+        } else if (std::chrono::steady_clock::now() - lastPlain >= PLAIN_INTERVAL) {
+            lastPlain = std::chrono::steady_clock::now();
+            TerminalUI::logDownload(renderPlain());
+        }
+        m_cv.wait_for(lock, FRAME_INTERVAL, [this] { return !m_running; });
+    }
+}
+
+void ProgressRenderer::sample() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - m_lastSample).count();
+    if (elapsed <= 0) {
+        return;
+    }
+    m_lastSample = now;
+    const double alpha = 1 - std::exp(-elapsed / RATE_TIME_CONSTANT);
+
+    auto peers = m_progress.peers.load();
+    uint64_t total = 0;
+    for (const auto& peer : *peers) {
+        uint64_t bytes = peer->m_bytesReceived.load(std::memory_order_relaxed);
+        auto [it, inserted] = m_peerRates.try_emplace(peer.get(), PeerRate{bytes, 0});
+        PeerRate& rate = it->second;
+        uint64_t delta = bytes - rate.lastBytes;
+        rate.lastBytes = bytes;
+        rate.rate += alpha * (delta / elapsed - rate.rate);
+        total += delta;
+    }
+    m_rate += alpha * (total / elapsed - m_rate);
+}
+
+std::string ProgressRenderer::renderFrame() const {
+    const int wanted = m_progress.piecesWanted.load(std::memory_order_relaxed);
+    const int done = m_progress.piecesDone.load(std::memory_order_relaxed);
+    const int64_t bytesDone = m_progress.bytesDone.load(std::memory_order_relaxed);
+    const int64_t bytesWanted = m_progress.bytesWanted.load(std::memory_order_relaxed);
+    const double fraction = wanted == 0 ? 1.0 : static_cast<double>(done) / wanted;
+
+    std::ostringstream out;
+    int filled = static_cast<int>(fraction * BAR_WIDTH);
+    out << Colors::BRIGHT_BLUE << m_label << Colors::RESET << " [" << Colors::BRIGHT_GREEN;
+    for (int i = 0; i < BAR_WIDTH; i++) {
+        out << (i < filled ? "█" : i == filled ? "▓" : "░");
+    }
+    out << Colors::RESET << "] " << Colors::BRIGHT_WHITE << std::setw(3) << static_cast<int>(fraction * 100) << "%"
+        << Colors::RESET << Colors::DIM << " (" << done << "/" << wanted << ")" << Colors::RESET << "\n"
+        << Colors::DIM << "  data   " << Colors::RESET << TerminalUI::formatFileSize(bytesDone) << " / "
+        << TerminalUI::formatFileSize(bytesWanted) << "  "
+        << Colors::BRIGHT_CYAN << formatRate(m_rate) << Colors::RESET
+        << "  ETA " << Colors::BRIGHT_WHITE << formatEta(bytesWanted - bytesDone, m_rate) << Colors::RESET << "\n";
+
+    // Piece map: each cell stands for a run of pieces
+    const size_t total = static_cast<size_t>(m_progress.totalPieces);
+    const size_t cells = std::min(MAP_WIDTH, total);
+    out << Colors::DIM << "  pieces " << Colors::RESET << "[";
+    for (size_t c = 0; c < cells; c++) {
+        size_t first = c * total / cells, last = (c + 1) * total / cells;
+        size_t skipped = 0, finished = 0, inFlight = 0;
+        for (size_t i = first; i < last; i++) {
+            switch (m_progress.pieces[i].load(std::memory_order_relaxed)) {
+            case DownloadManager::Progress::Skipped: skipped++; break;
+            case DownloadManager::Progress::Done: finished++; break;
+            case DownloadManager::Progress::InFlight: inFlight++; break;
+            default: break;
+            }
+        }
+        size_t count = last - first;
+        if (skipped == count) out << " ";
+        else if (finished + skipped == count) out << Colors::BRIGHT_GREEN << "█" << Colors::RESET;
+        else if (inFlight > 0) out << Colors::BRIGHT_YELLOW << "▓" << Colors::RESET;
+        else if (finished > 0) out << Colors::GREEN << "▒" << Colors::RESET;
+        else out << Colors::DIM << "░" << Colors::RESET;
+    }
+    out << "]";
+
+    // Fastest peers first; idle and departed peers drop out as their rate decays
+    auto peers = m_progress.peers.load();
+    std::vector<std::pair<double, const Peer*>> active;
+    for (const auto& peer : *peers) {
+        auto it = m_peerRates.find(peer.get());
+        if (it != m_peerRates.end() && it->second.rate >= 1) {
+            active.emplace_back(it->second.rate, peer.get());
+        }
+    }
+    std::sort(active.begin(), active.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    out << "\n" << Colors::DIM << "  peers  " << Colors::RESET << active.size() << " sending, "
+        << peers->size() << " connected so far";
+    for (size_t i = 0; i < active.size() && i < MAX_PEER_ROWS; i++) {
+        const Peer* peer = active[i].second;
+        std::string endpoint = peer->m_ip + ":" + std::to_string(peer->m_port);
+        out << "\n    " << Colors::CYAN << std::left << std::setw(40) << std::setfill(' ') << endpoint
+            << Colors::RESET << std::right << std::setw(12) << formatRate(active[i].first) << Colors::DIM
+            << "  " << TerminalUI::formatFileSize(static_cast<long long>(
+                           peer->m_bytesReceived.load(std::memory_order_relaxed)))
+            << Colors::RESET;
+    }
+    return out.str();
+}
+
+std::string ProgressRenderer::renderPlain() const {
+    const int wanted = m_progress.piecesWanted.load(std::memory_order_relaxed);
+    const int done = m_progress.piecesDone.load(std::memory_order_relaxed);
+    const int64_t left = m_progress.bytesWanted.load(std::memory_order_relaxed) -
+                         m_progress.bytesDone.load(std::memory_order_relaxed);
+    std::ostringstream out;
+    out << m_label << ": " << (wanted == 0 ? 100 : done * 100 / wanted) << "% (" << done << "/" << wanted
+        << " pieces), " << formatRate(m_rate) << ", ETA " << formatEta(left, m_rate) << ", "
+        << m_progress.peers.load()->size() << " peers";
+    return out.str();
+}
+
+void ProgressRenderer::erase() {
+    if (m_frameLines == 0) {
+        return;
+    }
+    // The cursor sits at the end of the block's last line
+    std::cout << "\r";
+    if (m_frameLines > 1) {
+        std::cout << "\033[" << (m_frameLines - 1) << "A";
+    }
+    std::cout << "\033[J" << std::flush;
+    m_frameLines = 0;
+}
+
+void ProgressRenderer::draw() {
+    if (m_frame.empty()) {
+        return;
+    }
+    std::cout << m_frame << std::flush;
+    m_frameLines = static_cast<size_t>(std::count(m_frame.begin(), m_frame.end(), '\n')) + 1;
+}
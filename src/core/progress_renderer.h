@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "DownloadManager.h"
+
+// Draws download progress from its own thread at a fixed rate. Each frame samples
+// DownloadManager::progress() and the peers' byte counters, all plain atomics, so
+// the workers never wait on the terminal and a slow terminal never slows a worker.
+//
+// On a terminal the frame is a live block at the bottom of the screen: overall
+// bar, aggregate rate and ETA, a piece map and the fastest peers. Log lines are
+// printed above it (the logger erases and redraws the block around each batch).
+// When stdout is not a terminal a one-line summary is printed every few seconds
+// instead.
+class ProgressRenderer {
+public:
+    static constexpr auto FRAME_INTERVAL = std::chrono::milliseconds(100);
+    static constexpr auto PLAIN_INTERVAL = std::chrono::seconds(5);  // Non-terminal output
+    static constexpr size_t MAP_WIDTH = 64;       // Piece map cells
+    static constexpr size_t MAX_PEER_ROWS = 5;
+
+    ProgressRenderer(const DownloadManager::Progress& progress, std::string label);
+    ~ProgressRenderer();
+
+    void start();
+    // Draws a final frame and joins the thread; the last frame stays on screen.
+    void stop();
+
+private:
+    struct PeerRate {
+        uint64_t lastBytes = 0;
+        double rate = 0;  // Bytes/sec, smoothed
+    };
+
+    void run();
+    void sample();
+    std::string renderFrame() const;
+    std::string renderPlain() const;
+
+    // Caller holds m_mutex.
+    void erase();
+    void draw();
+
+    const DownloadManager::Progress& m_progress;
+    std::string m_label;
+    bool m_interactive;
+
+    std::thread m_thread;
+    std::mutex m_mutex;  // Guards everything below; never taken by workers
+    std::condition_variable m_cv;
+    bool m_running = false;
+
+    std::chrono::steady_clock::time_point m_lastSample;
+    std::unordered_map<const Peer*, PeerRate> m_peerRates;
+    double m_rate = 0;  // Aggregate wire rate, bytes/sec, smoothed
+    std::string m_frame;  // Last frame drawn
+    size_t m_frameLines = 0;  // Lines of m_frame currently on screen
+};
@@ -0,0 +1,64 @@
+#include "resource_limits.h"
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+ResourceBudget::ResourceBudget(uint64_t limit) : m_limit(limit) {}
+
+bool ResourceBudget::tryAcquire(uint64_t amount) {
+    if (m_limit == 0) {
+        m_used.fetch_add(amount, std::memory_order_relaxed);
+        return true;
+    }
+    uint64_t used = m_used.load(std::memory_order_relaxed);
+    do {
+        if (used + amount > m_limit) {
+            return false;
+        }
+    } while (!m_used.compare_exchange_weak(used, used + amount, std::memory_order_relaxed));
+    return true;
+}
+
+void ResourceBudget::forceAcquire(uint64_t amount) {
+    m_used.fetch_add(amount, std::memory_order_relaxed);
+}
+
+void ResourceBudget::release(uint64_t amount) {
+    m_used.fetch_sub(amount, std::memory_order_relaxed);
+}
+
+RateLimiter::RateLimiter(int64_t bytesPerSecond) : m_rate(bytesPerSecond) {}
+
+void RateLimiter::setRate(int64_t bytesPerSecond) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rate.store(bytesPerSecond, std::memory_order_relaxed);
+    m_tokens = 0;
+    m_lastRefill = std::chrono::steady_clock::now();
+}
+
+void RateLimiter::acquire(size_t bytes) {
+    if (rate() <= 0) {
+        return;
+    }
+    std::chrono::duration<double> wait{0};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const double rate = static_cast<double>(m_rate.load(std::memory_order_relaxed));
+        if (rate <= 0) {
+            return;
+        }
+        // Up to a quarter second of unused rate may be saved up
+        const double burst = std::max<double>(rate / 4, MIN_BURST);
+        auto now = std::chrono::steady_clock::now();
+        m_tokens = std::min(burst, m_tokens + rate * std::chrono::duration<double>(now - m_lastRefill).count());
+        m_lastRefill = now;
+        m_tokens -= static_cast<double>(bytes);
+        if (m_tokens < 0) {
+            wait = std::chrono::duration<double>(-m_tokens / rate);
+        }
+    }
+    if (wait.count() > 0) {
+        std::this_thread::sleep_for(wait);
+    }
+}
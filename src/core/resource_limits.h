@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// A process-wide allowance of some countable resource (peer connections, bytes
+// of piece memory) shared by every torrent of a session. Acquisition never
+// blocks: callers that get nothing decide whether to drop, queue or retry.
+class ResourceBudget {
+public:
+    explicit ResourceBudget(uint64_t limit = 0);  // 0 means unlimited
+
+    bool tryAcquire(uint64_t amount = 1);
+    // Takes the amount even if it overshoots the limit (for work that must proceed).
+    void forceAcquire(uint64_t amount);
+    void release(uint64_t amount = 1);
+
+    uint64_t used() const { return m_used.load(std::memory_order_relaxed); }
+    uint64_t limit() const { return m_limit; }
+
+private:
+    uint64_t m_limit;
+    std::atomic<uint64_t> m_used{0};
+};
+
+// Token bucket that paces block requests so all peers together stay under a
+// byte rate. Requests past the budget sleep the calling peer worker; nothing
+// else waits on it. A rate of 0 disables the limit.
+class RateLimiter {
+public:
+    explicit RateLimiter(int64_t bytesPerSecond = 0);
+
+    void setRate(int64_t bytesPerSecond);
+    int64_t rate() const { return m_rate.load(std::memory_order_relaxed); }
+
+    // Account for `bytes` about to be requested, sleeping until they fit the rate.
+    void acquire(size_t bytes);
+
+private:
+    static constexpr int64_t MIN_BURST = 64 * 1024;
+
+    std::atomic<int64_t> m_rate;
+    std::mutex m_mutex;
+    double m_tokens = 0;  // May go negative: later callers wait off the debt
+    std::chrono::steady_clock::time_point m_lastRefill = std::chrono::steady_clock::now();
+};
@@ -0,0 +1,45 @@
+#include "send_ring.h"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+SendRing::SendRing(size_t capacity) : m_data(std::max<size_t>(capacity, 64)) {}
+
+void SendRing::append(const uint8_t* data, size_t length) {
+    if (m_size + length > m_data.size()) {
+        grow(m_size + length);
+    }
+    size_t tail = (m_head + m_size) % m_data.size();
+    size_t first = std::min(length, m_data.size() - tail);
+    std::memcpy(m_data.data() + tail, data, first);
+    std::memcpy(m_data.data(), data + first, length - first);
+    m_size += length;
+}
+
+std::array<boost::asio::const_buffer, 2> SendRing::buffers() const {
+    size_t first = std::min(m_size, m_data.size() - m_head);
+    return {boost::asio::const_buffer(m_data.data() + m_head, first),
+            boost::asio::const_buffer(m_data.data(), m_size - first)};
+}
+
+void SendRing::consume(size_t n) {
+    n = std::min(n, m_size);
+    m_head = (m_head + n) % m_data.size();
+    m_size -= n;
+    if (m_size == 0) {
+        m_head = 0;  // Keep the next batch contiguous
+    }
+}
+
+void SendRing::grow(size_t minCapacity) {
+    size_t capacity = m_data.size();
+    while (capacity < minCapacity) {
+        capacity *= 2;
+    }
+    std::vector<uint8_t> data(capacity);
+    size_t first = std::min(m_size, m_data.size() - m_head);
+    std::memcpy(data.data(), m_data.data() + m_head, first);
+    std::memcpy(data.data() + first, m_data.data(), m_size - first);
+    m_data = std::move(data);
+    m_head = 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+
+// Byte ring for a peer's outgoing messages. Messages are serialized straight
+// into it and drained with one gather write, so a burst of small messages (a
+// pipeline of REQUESTs) costs a single syscall and no per-message allocation.
+// The storage is reused across flushes and only grows, in powers of two.
+class SendRing {
+public:
+    explicit SendRing(size_t capacity = 16 * 1024);
+
+    void append(const uint8_t* data, size_t length);
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Queued bytes as at most two spans; the second is non-empty when the data wraps.
+    std::array<boost::asio::const_buffer, 2> buffers() const;
+
+    // Drop `n` bytes from the front after they were written.
+    void consume(size_t n);
+
+private:
+    std::vector<uint8_t> m_data;
+    size_t m_head = 0;  // Index of the oldest queued byte
+    size_t m_size = 0;
+
+    void grow(size_t minCapacity);
+};
@@ -0,0 +1,385 @@
+#include "session.h"
+#include "../utils/error.h"
+#include "../utils/hash.h"
+#include "../utils/logger.h"
+#include <algorithm>
+
+using namespace std;
+using namespace BitTorrent;
+
+namespace {
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(200);
+}
+
+struct Session::Torrent {
+    std::string id;
+    std::unique_ptr<TorrentMetadata> metadata;
+    State state = State::Queued;
+
+    // Created on first activation and kept while paused, so a resumed torrent
+    // picks up with the pieces and peers it already has.
+    std::unique_ptr<DownloadManager> dm;
+    std::shared_ptr<TrackerSession> tracker;
+
+    std::thread supervisor;
+    bool supervisorDone = true;  // The supervisor no longer touches this torrent
+    bool stopRequested = false;  // pause() or remove() wants the supervisor to wind down
+    bool removed = false;
+    bool holdsSlot = false;
+    uint64_t reservedMemory = 0;
+
+    TorrentStatus final;  // Figures kept once the download manager is gone
+};
+
+Session::Session(Options options, std::string peerId)
+    : m_options(std::move(options)),
+      m_peerId(std::move(peerId)),
+      m_loop(m_options.loop_threads),
+      m_announcePool(m_options.announce_threads),
+      m_hashPool(m_options.hash_threads ? m_options.hash_threads
+                                        : std::max(1u, std::thread::hardware_concurrency())),
+      m_diskPool(m_options.disk_threads),
+      m_connections(m_options.max_connections),
+      m_memory(m_options.max_memory),
+      m_rateLimiter(m_options.download_rate) {}
+
+Session::~Session() {
+    std::vector<std::shared_ptr<Torrent>> torrents;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shuttingDown = true;
+        m_queue.clear();
+        for (auto& [id, torrent] : m_torrents) {
+            torrent->stopRequested = true;
+            torrents.push_back(torrent);
+        }
+        torrents.insert(torrents.end(), m_removed.begin(), m_removed.end());
+    }
+    m_cv.notify_all();
+    for (auto& torrent : torrents) {
+        if (torrent->supervisor.joinable()) {
+            torrent->supervisor.join();
+        }
+    }
+    // Managers and trackers go before the loop and pools they use
+    m_torrents.clear();
+    m_removed.clear();
+}
+
+std::string Session::add(const std::string& torrentPath) {
+    return add(std::make_unique<TorrentMetadata>(TorrentMetadata::fromFile(torrentPath)));
+}
+
+std::string Session::add(std::unique_ptr<TorrentMetadata> metadata) {
+    auto torrent = std::make_shared<Torrent>();
+    torrent->id = HashUtils::bytesToHex(metadata->getInfoHash());
+    torrent->metadata = std::move(metadata);
+    torrent->final.id = torrent->id;
+    torrent->final.name = torrent->metadata->getName();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_shuttingDown) {
+        throw TorrentError("Session is shutting down");
+    }
+    reapRemoved();
+    if (!m_torrents.emplace(torrent->id, torrent).second) {
+        throw TorrentError("Torrent already added: " + torrent->id);
+    }
+    m_queue.push_back(torrent->id);
+    BT_LOG_INFO("Queued " << torrent->final.name << " (" << torrent->id << ")");
+    schedule();
+    return torrent->id;
+}
+
+bool Session::remove(const std::string& id) {
+    std::unique_ptr<DownloadManager> paused;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_torrents.find(id);
+        if (it == m_torrents.end()) {
+            return false;
+        }
+        auto torrent = it->second;
+        m_torrents.erase(it);
+        m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), id), m_queue.end());
+        torrent->removed = true;
+        torrent->stopRequested = true;
+        reapRemoved();
+        if (!torrent->supervisorDone) {
+            // The supervisor drops the manager and its memory once the peers are gone
+            m_removed.push_back(torrent);
+            m_cv.notify_all();
+        } else {
+            if (torrent->supervisor.joinable()) {
+                torrent->supervisor.join();  // Returns at once: supervisorDone is its last act
+            }
+            paused = std::move(torrent->dm);
+            m_memory.release(torrent->reservedMemory);
+            torrent->reservedMemory = 0;
+            schedule();
+        }
+        BT_LOG_INFO("Removed " << torrent->final.name);
+    }
+    return true;  // A paused torrent's manager is torn down here, outside the lock
+}
+
+bool Session::pause(const std::string& id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_torrents.find(id);
+    if (it == m_torrents.end()) {
+        return false;
+    }
+    Torrent& torrent = *it->second;
+    if (torrent.state == State::Queued) {
+        m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), id), m_queue.end());
+    } else if (torrent.state == State::Downloading) {
+        torrent.stopRequested = true;  // The supervisor frees the slot as it exits
+        m_cv.notify_all();
+    } else {
+        return false;
+    }
+    torrent.state = State::Paused;
+    return true;
+}
+
+bool Session::resume(const std::string& id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_torrents.find(id);
+    if (it == m_torrents.end() || it->second->state != State::Paused) {
+        return false;
+    }
+    it->second->state = State::Queued;
+    m_queue.push_back(id);
+    schedule();
+    return true;
+}
+
+void Session::schedule() {
+    while (!m_shuttingDown && !m_queue.empty() && m_active < m_options.active_downloads) {
+        auto torrent = m_torrents.at(m_queue.front());
+        if (!torrent->supervisorDone) {
+            break;  // Still winding down from a pause; its supervisor reschedules on exit
+        }
+        if (torrent->reservedMemory == 0) {
+            // Pieces are held in the write-back cache, or in memory until assembly without one
+            uint64_t need = static_cast<uint64_t>(torrent->metadata->getTotalLength());
+            if (m_options.write_cache > 0) {
+                need = std::min<uint64_t>(need, m_options.write_cache);
+            }
+            if (!m_memory.tryAcquire(need)) {
+                if (m_active > 0) {
+                    break;  // Strict FIFO: wait for memory rather than let smaller torrents jump ahead
+                }
+                m_memory.forceAcquire(need);
+            }
+            torrent->reservedMemory = need;
+        }
+        m_queue.pop_front();
+        activate(torrent);
+    }
+}
+
+void Session::activate(const std::shared_ptr<Torrent>& torrent) {
+    if (torrent->supervisor.joinable()) {
+        torrent->supervisor.join();  // Finished: supervisorDone was set as its last act
+    }
+    m_active++;
+    torrent->holdsSlot = true;
+    torrent->state = State::Downloading;
+    torrent->stopRequested = false;
+    torrent->supervisorDone = false;
+
+    if (!torrent->dm) {
+        torrent->dm = std::make_unique<DownloadManager>(torrent->metadata.get(), std::vector<Tracker::PeerInfo>{},
+                                                        m_peerId);
+        torrent->dm->setSharedResources({&m_loop.context(), &m_hashPool, &m_connections, &m_rateLimiter});
+        if (m_options.write_cache > 0) {
+            WriteCache::Options cacheOptions;
+            cacheOptions.capacity = m_options.write_cache;
+            torrent->dm->enableWriteBack(m_options.download_dir, cacheOptions);
+        }
+        if (m_options.export_metrics) {
+            torrent->dm->exportMetrics();
+        }
+    }
+    DownloadManager* dm = torrent->dm.get();
+    torrent->tracker = std::make_shared<TrackerSession>(
+        m_loop.context(), m_announcePool, *torrent->metadata, m_peerId, m_options.listen_port,
+        [dm] { return TrackerSession::Stats{dm->getBytesUploaded(), dm->getBytesDownloaded(), dm->getBytesLeft()}; },
+        [dm](const std::vector<Tracker::PeerInfo>& peers) { dm->addPeers(peers); });
+    torrent->tracker->start();
+    torrent->supervisor = std::thread(&Session::runTorrent, this, torrent);
+    BT_LOG_INFO("Started " << torrent->final.name);
+}
+
+void Session::runTorrent(std::shared_ptr<Torrent> torrent) {
+    DownloadManager& dm = *torrent->dm;
+    auto stopRequested = [&] {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return torrent->stopRequested;
+    };
+    // Sleeps up to one poll interval, waking early for pause/remove
+    auto idle = [&] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait_for(lock, POLL_INTERVAL, [&] { return torrent->stopRequested; });
+    };
+
+    // Workers exit when their peer goes away or none of them has had anything to
+    // fetch for a while; re-announces may bring new ones, so the torrent only
+    // fails after a full peer_timeout without any worker
+    dm.start();
+    auto lastWork = std::chrono::steady_clock::now();
+    bool timedOut = false;
+    while (!dm.isComplete() && !stopRequested() && !dm.writeFailed()) {
+        if (dm.waitForProgress(POLL_INTERVAL)) {
+            lastWork = std::chrono::steady_clock::now();
+        } else if (std::chrono::steady_clock::now() - lastWork > m_options.peer_timeout) {
+            timedOut = true;
+            break;
+        } else {
+            idle();
+        }
+    }
+    dm.stop();
+    dm.wait();
+
+    const bool stopped = stopRequested();
+    std::string outputPath = m_options.download_dir;
+    std::string error;
+    bool complete = false;
+    if (!stopped) {
+        if (dm.isComplete()) {
+            torrent->tracker->completed();
+            // Assembly is disk-bound; the disk pool bounds how many run at once
+            complete = m_diskPool.submit([&] { return dm.assembleFile(outputPath); }).get();
+            if (!complete) {
+                error = "Failed to write the downloaded data under " + m_options.download_dir;
+            }
+        } else if (dm.writeFailed()) {
+            error = "Failed to write the downloaded data under " + m_options.download_dir;
+        } else if (timedOut) {
+            error = "No peer delivered anything for " + std::to_string(m_options.peer_timeout.count()) + "s";
+        }
+    }
+    torrent->tracker->stop();
+    if (stopped) {
+        // A paused torrent gives its connections back; removed ones are torn down below
+        dm.disconnect();
+    }
+
+    std::unique_ptr<DownloadManager> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        torrent->final = describe(*torrent);
+        torrent->tracker.reset();
+        if (!stopped) {
+            torrent->state = complete ? State::Complete : State::Failed;
+            torrent->final.state = torrent->state;
+            torrent->final.outputPath = complete ? outputPath : "";
+            torrent->final.error = error;
+            torrent->final.peers = 0;
+        }
+        if (!stopped || torrent->removed) {
+            // Done with the pieces: free the memory for the next torrent
+            finished = std::move(torrent->dm);
+        } else if (m_options.write_cache > 0) {
+            // Paused with its write-back cache flushed: the pieces are all on disk,
+            // and resuming reserves the cache again
+            m_memory.release(torrent->reservedMemory);
+            torrent->reservedMemory = 0;
+        }
+        releaseSlot(*torrent);
+    }
+    if (finished) {
+        finished.reset();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_memory.release(torrent->reservedMemory);
+        torrent->reservedMemory = 0;
+    }
+    if (complete) {
+        BT_LOG_INFO("Completed " << torrent->final.name << ": " << outputPath);
+    } else if (!error.empty()) {
+        BT_LOG_WARN("Failed " << torrent->final.name << ": " << error);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    torrent->supervisorDone = true;
+    schedule();
+    m_cv.notify_all();
+}
+
+void Session::reapRemoved() {
+    auto finished = std::stable_partition(m_removed.begin(), m_removed.end(),
+                                          [](const auto& torrent) { return !torrent->supervisorDone; });
+    for (auto it = finished; it != m_removed.end(); ++it) {
+        if ((*it)->supervisor.joinable()) {
+            (*it)->supervisor.join();  // Returns at once: supervisorDone is its last act
+        }
+    }
+    m_removed.erase(finished, m_removed.end());
+}
+
+void Session::releaseSlot(Torrent& torrent) {
+    if (torrent.holdsSlot) {
+        torrent.holdsSlot = false;
+        m_active--;
+    }
+}
+
+Session::TorrentStatus Session::describe(const Torrent& torrent) const {
+    if (!torrent.dm) {
+        TorrentStatus status = torrent.final;
+        status.state = torrent.state;
+        return status;
+    }
+    const auto& progress = torrent.dm->progress();
+    TorrentStatus status;
+    status.id = torrent.id;
+    status.name = torrent.final.name;
+    status.state = torrent.state;
+    status.piecesDone = progress.piecesDone.load(std::memory_order_relaxed);
+    status.piecesWanted = progress.piecesWanted.load(std::memory_order_relaxed);
+    status.bytesDone = progress.bytesDone.load(std::memory_order_relaxed);
+    status.bytesWanted = progress.bytesWanted.load(std::memory_order_relaxed);
+    status.peers = static_cast<int>(progress.peers.load()->size());
+    return status;
+}
+
+std::vector<Session::TorrentStatus> Session::status() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<TorrentStatus> result;
+    for (const auto& [id, torrent] : m_torrents) {
+        result.push_back(describe(*torrent));
+    }
+    return result;
+}
+
+std::optional<Session::TorrentStatus> Session::status(const std::string& id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_torrents.find(id);
+    if (it == m_torrents.end()) {
+        return std::nullopt;
+    }
+    return describe(*it->second);
+}
+
+bool Session::waitIdle(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_cv.wait_for(lock, timeout, [this] {
+        return std::all_of(m_torrents.begin(), m_torrents.end(), [](const auto& entry) {
+            const Torrent& torrent = *entry.second;
+            return torrent.supervisorDone && torrent.state != State::Queued && torrent.state != State::Downloading;
+        });
+    });
+}
+
+const char* Session::stateName(State state) {
+    switch (state) {
+    case State::Queued: return "queued";
+    case State::Downloading: return "downloading";
+    case State::Paused: return "paused";
+    case State::Complete: return "complete";
+    case State::Failed: return "failed";
+    }
+    return "unknown";
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DownloadManager.h"
+#include "event_loop.h"
+#include "resource_limits.h"
+#include "thread_pool.h"
+#include "torrent.h"
+#include "tracker_session.h"
+
+// Runs many torrents in one process. The session owns everything that should
+// exist once per host rather than once per torrent: the event loop (announce
+// schedules and peer connects), the announce, hash and disk thread pools and the global
+// limits on connections, piece memory and download rate. Torrents beyond
+// `active_downloads` wait in a FIFO queue and start as slots free up.
+//
+// Each torrent writes its verified pieces through a write-back cache of
+// `write_cache` bytes, so a torrent is only started once that cache (or the
+// torrent, if smaller) fits the memory budget, or when nothing else is running.
+// With `write_cache` at 0 pieces stay in memory until assembly and the whole
+// torrent must fit instead. Finished torrents are not seeded.
+class Session {
+public:
+    struct Options {
+        size_t active_downloads = 4;
+        size_t max_connections = 500;     // Connected peers over all torrents; 0 = unlimited
+        uint64_t max_memory = 1ull << 30;  // Bytes of piece data held in memory; 0 = unlimited
+        size_t write_cache = 64 << 20;    // Per-torrent write-back cache; 0 = hold pieces until assembly
+        int64_t download_rate = 0;        // Bytes/sec over all torrents; 0 = unlimited
+        size_t loop_threads = 4;
+        size_t hash_threads = 0;          // 0 = one per hardware thread
+        size_t disk_threads = 2;
+        size_t announce_threads = 8;      // Blocking tracker exchanges in flight at once, over all torrents
+        std::string download_dir = "./downloads/";
+        uint16_t listen_port = 6881;      // Reported to trackers
+        bool export_metrics = false;      // Per-torrent series in the global metrics registry
+        std::chrono::seconds peer_timeout{60};  // Fail a torrent that finds no peer in this time
+    };
+
+    enum class State { Queued, Downloading, Paused, Complete, Failed };
+
+    struct TorrentStatus {
+        std::string id;  // Hex info hash
+        std::string name;
+        State state = State::Queued;
+        int piecesDone = 0;
+        int piecesWanted = 0;
+        int64_t bytesDone = 0;
+        int64_t bytesWanted = 0;
+        int peers = 0;  // Peers connected so far (0 once the torrent is no longer running)
+        std::string outputPath;  // Set once complete
+        std::string error;       // Set once failed
+    };
+
+    // peerId is our 20-byte id, shared by every torrent of the session.
+    Session(Options options, std::string peerId);
+    ~Session();
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // Queue a torrent; returns its id. Throws BitTorrent::TorrentError for an
+    // unreadable torrent or one that is already in the session.
+    std::string add(const std::string& torrentPath);
+    std::string add(std::unique_ptr<TorrentMetadata> metadata);
+
+    // Each returns false if the id is unknown (or, for pause/resume, if the
+    // torrent is not in a state where that makes sense). None of them block:
+    // a removed or paused torrent's peers wind down in the background. A paused
+    // torrent closes its connections; it keeps its memory reservation only when
+    // there is no write-back cache, since its pieces are then held in memory.
+    bool remove(const std::string& id);
+    bool pause(const std::string& id);
+    bool resume(const std::string& id);
+
+    std::vector<TorrentStatus> status() const;
+    std::optional<TorrentStatus> status(const std::string& id) const;
+
+    // Blocks until no torrent is queued or downloading, or the timeout expires.
+    bool waitIdle(std::chrono::milliseconds timeout);
+
+    EventLoop& eventLoop() { return m_loop; }
+    const Options& options() const { return m_options; }
+
+    static const char* stateName(State state);
+
+private:
+    struct Torrent;
+
+    // Start queued torrents while slots and memory allow (caller holds m_mutex).
+    void schedule();
+    void activate(const std::shared_ptr<Torrent>& torrent);
+    // Supervises one active torrent on its own thread until it completes, fails or is stopped.
+    void runTorrent(std::shared_ptr<Torrent> torrent);
+    // Returns the torrent's active slot, if it holds one (caller holds m_mutex).
+    void releaseSlot(Torrent& torrent);
+    // Joins the supervisors of removed torrents that have finished (caller holds m_mutex).
+    void reapRemoved();
+    TorrentStatus describe(const Torrent& torrent) const;
+
+    Options m_options;
+    std::string m_peerId;
+
+    // Declared before the torrents' managers and trackers so they are destroyed after them
+    EventLoop m_loop;
+    ThreadPool m_announcePool;  // After m_loop: joined before the loop its trackers' timers use
+    ThreadPool m_hashPool;
+    ThreadPool m_diskPool;
+    ResourceBudget m_connections;
+    ResourceBudget m_memory;
+    RateLimiter m_rateLimiter;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<std::string, std::shared_ptr<Torrent>> m_torrents;  // By id
+    std::deque<std::string> m_queue;  // Ids waiting for a slot, oldest first
+    std::vector<std::shared_ptr<Torrent>> m_removed;  // Removed while their supervisor still ran
+    size_t m_active = 0;
+    bool m_shuttingDown = false;
+};
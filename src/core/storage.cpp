@@ -0,0 +1,237 @@
+#include "storage.h"
+#include "metrics.h"
+#include "trace.h"
+#include "../utils/logger.h"
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+using namespace std;
+
+namespace {
+Metrics::Histogram& g_writeLatency = Metrics::Registry::global().histogram(
+    "bt_disk_write_microseconds", "Time to write one block or piece to its file(s)");
+Metrics::Histogram& g_writeRunBytes = Metrics::Registry::global().histogram(
+    "bt_disk_write_run_bytes", "Bytes per batched write of adjacent pieces");
+}
+
+Storage::Storage(const TorrentMetadata* metadata, std::string rootDir)
+    : m_metadata(metadata), m_root_dir(std::move(rootDir)) {
+    if (!m_root_dir.empty() && m_root_dir.back() != '/') {
+        m_root_dir += '/';
+    }
+    m_fds.assign(metadata->getFiles().size(), -1);
+    m_skipped.assign(metadata->getFiles().size(), false);
+}
+
+void Storage::setFileSkipped(size_t file_index, bool skipped) {
+    m_skipped[file_index] = skipped;
+}
+
+Storage::~Storage() {
+    close();
+}
+
+std::string Storage::getOutputPath() const {
+    return m_root_dir + m_metadata->getName();
+}
+
+std::string Storage::getFilePath(size_t file_index) const {
+    if (!m_metadata->isMultiFile()) {
+        return getOutputPath();
+    }
+    return getOutputPath() + "/" + m_metadata->getFiles()[file_index].path;
+}
+
+int Storage::openFile(size_t file_index) {
+    if (m_fds[file_index] >= 0) {
+        return m_fds[file_index];
+    }
+
+    // Torrents with thousands of files would exhaust descriptors; recycle the oldest
+    if (m_open_order.size() >= MAX_OPEN_FILES) {
+        size_t oldest = m_open_order.front();
+        m_open_order.pop_front();
+        ::close(m_fds[oldest]);
+        m_fds[oldest] = -1;
+    }
+
+    std::string path = getFilePath(file_index);
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    if (ec) {
+        BT_LOG_ERROR("Failed to create directory for " << path << ": " << ec.message());
+        return -1;
+    }
+
+    // Read access too: streaming reads are served from disk once pieces are written back
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        BT_LOG_ERROR("Failed to open " << path << ": " << strerror(errno));
+        return -1;
+    }
+    // Size the file up front (sparse) so out-of-order pieces land at the right offsets
+    if (::ftruncate(fd, static_cast<off_t>(m_metadata->getFiles()[file_index].length)) != 0) {
+        BT_LOG_ERROR("Failed to size " << path << ": " << strerror(errno));
+    }
+    m_fds[file_index] = fd;
+    m_open_order.push_back(file_index);
+    return fd;
+}
+
+bool Storage::writeBlock(int piece_idx, size_t begin, const uint8_t* data, size_t length) {
+    Metrics::ScopedTimer timer(g_writeLatency);
+    Trace::Span span("write", "disk", "piece", static_cast<uint64_t>(piece_idx));
+    for (const auto& slice : m_metadata->mapBlock(piece_idx, begin, length)) {
+        if (m_skipped[slice.file_index]) {
+            data += slice.length;
+            continue;
+        }
+        int fd = openFile(slice.file_index);
+        if (fd < 0) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < slice.length) {
+            ssize_t n = ::pwrite(fd, data + written, slice.length - written,
+                                 static_cast<off_t>(slice.file_offset + written));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                BT_LOG_ERROR("Write failed for " << getFilePath(slice.file_index) << ": " << strerror(errno));
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        data += slice.length;
+    }
+    return true;
+}
+
+bool Storage::writePiece(int piece_idx, const std::vector<uint8_t>& data) {
+    return writeBlock(piece_idx, 0, data.data(), data.size());
+}
+
+bool Storage::writePieces(int first_piece, std::span<const std::span<const uint8_t>> pieces) {
+    size_t total = 0;
+    for (const auto& piece : pieces) {
+        total += piece.size();
+    }
+    Metrics::ScopedTimer timer(g_writeLatency);
+    Trace::Span span("write_run", "disk", "pieces", static_cast<uint64_t>(pieces.size()));
+    g_writeRunBytes.record(total);
+
+    // Walk the run's file slices and the piece buffers side by side
+    size_t piece = 0;
+    size_t pieceOffset = 0;
+    std::vector<iovec> iov;
+    for (const auto& slice : m_metadata->mapBlock(first_piece, 0, total)) {
+        if (m_skipped[slice.file_index]) {
+            for (size_t left = slice.length; left > 0;) {
+                size_t n = std::min(left, pieces[piece].size() - pieceOffset);
+                left -= n;
+                pieceOffset += n;
+                if (pieceOffset == pieces[piece].size()) {
+                    piece++;
+                    pieceOffset = 0;
+                }
+            }
+            continue;
+        }
+        int fd = openFile(slice.file_index);
+        if (fd < 0) {
+            return false;
+        }
+        size_t done = 0;
+        while (done < slice.length) {
+            iov.clear();
+            size_t batch = 0;
+            while (done + batch < slice.length && iov.size() < IOV_MAX) {
+                size_t n = std::min(slice.length - done - batch, pieces[piece].size() - pieceOffset);
+                iov.push_back({const_cast<uint8_t*>(pieces[piece].data() + pieceOffset), n});
+                batch += n;
+                pieceOffset += n;
+                if (pieceOffset == pieces[piece].size()) {
+                    piece++;
+                    pieceOffset = 0;
+                }
+            }
+            // Short writes leave the tail of the batch; finish it with plain pwrites
+            size_t written = 0;
+            size_t first = 0;
+            while (written < batch) {
+                ssize_t n = ::pwritev(fd, iov.data() + first, static_cast<int>(iov.size() - first),
+                                      static_cast<off_t>(slice.file_offset + done + written));
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    BT_LOG_ERROR("Write failed for " << getFilePath(slice.file_index) << ": " << strerror(errno));
+                    return false;
+                }
+                written += static_cast<size_t>(n);
+                for (size_t left = static_cast<size_t>(n); left > 0;) {
+                    size_t m = std::min(left, iov[first].iov_len);
+                    iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + m;
+                    iov[first].iov_len -= m;
+                    left -= m;
+                    if (iov[first].iov_len == 0) {
+                        first++;
+                    }
+                }
+            }
+            done += batch;
+        }
+    }
+    return true;
+}
+
+bool Storage::readBlock(int piece_idx, size_t begin, uint8_t* data, size_t length) {
+    for (const auto& slice : m_metadata->mapBlock(piece_idx, begin, length)) {
+        if (m_skipped[slice.file_index]) {
+            BT_LOG_WARN("Cannot read back " << getFilePath(slice.file_index) << ": the file is skipped");
+            return false;
+        }
+        int fd = openFile(slice.file_index);
+        if (fd < 0) {
+            return false;
+        }
+        size_t done = 0;
+        while (done < slice.length) {
+            ssize_t n = ::pread(fd, data + done, slice.length - done, static_cast<off_t>(slice.file_offset + done));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                BT_LOG_ERROR("Read failed for " << getFilePath(slice.file_index) << ": " << strerror(errno));
+                return false;
+            }
+            if (n == 0) {
+                BT_LOG_ERROR("Unexpected end of " << getFilePath(slice.file_index));
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        data += slice.length;
+    }
+    return true;
+}
+
+bool Storage::finalize() {
+    const auto& files = m_metadata->getFiles();
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i].length == 0 && !m_skipped[i] && openFile(i) < 0) {
+            return false;
+        }
+    }
+    close();
+    return true;
+}
+
+void Storage::close() {
+    for (size_t idx : m_open_order) {
+        ::close(m_fds[idx]);
+        m_fds[idx] = -1;
+    }
+    m_open_order.clear();
+}
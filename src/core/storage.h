@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <span>
+#include "torrent.h"
+
+// Writes verified piece data to the torrent's files on disk.
+// Pieces are mapped onto files with TorrentMetadata::mapBlock, so a block that
+// straddles file boundaries becomes one positional write per file it touches.
+class Storage {
+public:
+    // rootDir is the download directory; files land in rootDir/<name> (single-file)
+    // or rootDir/<name>/<path> (multi-file).
+    Storage(const TorrentMetadata* metadata, std::string rootDir);
+    ~Storage();
+
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+
+    // Skipped files are never created; writes that map onto them are discarded.
+    void setFileSkipped(size_t file_index, bool skipped);
+
+    // Write `length` bytes at offset `begin` within piece `piece_idx`.
+    bool writeBlock(int piece_idx, size_t begin, const uint8_t* data, size_t length);
+    bool writePiece(int piece_idx, const std::vector<uint8_t>& data);
+    // Write consecutive whole pieces starting at `first_piece` with one pwritev
+    // per file (per IOV_MAX pieces) instead of one pwrite per piece.
+    bool writePieces(int first_piece, std::span<const std::span<const uint8_t>> pieces);
+
+    // Read back `length` bytes at offset `begin` within piece `piece_idx`. Fails
+    // for ranges that touch a skipped file, whose bytes were never written.
+    bool readBlock(int piece_idx, size_t begin, uint8_t* data, size_t length);
+
+    // Full on-disk path of a file from the metadata's file table.
+    std::string getFilePath(size_t file_index) const;
+
+    // Path of the downloaded torrent: the single file, or the multi-file root directory.
+    std::string getOutputPath() const;
+
+    // Create any zero-length files (they never receive a write), then close everything.
+    bool finalize();
+    void close();
+
+private:
+    static constexpr size_t MAX_OPEN_FILES = 128;
+
+    const TorrentMetadata* m_metadata;
+    std::string m_root_dir;
+    std::vector<int> m_fds;         // -1 when not open, indexed like getFiles()
+    std::deque<size_t> m_open_order; // Open files, oldest first, for fd eviction
+    std::vector<bool> m_skipped;
+
+    int openFile(size_t file_index);
+};
@@ -0,0 +1,520 @@
+#include "swarm_sim.h"
+#include "torrent.h"
+#include "peer.h"
+#include "DownloadManager.h"
+#include "event_loop.h"
+#include "tracker_session.h"
+#include "../utils/bencode.h"
+#include "../utils/hash.h"
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <optional>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <filesystem>
+#include <unistd.h>
+#include <pthread.h>
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+using namespace std;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = net::ip::tcp;
+using udp = net::ip::udp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr size_t MAX_MESSAGE = 1 << 20;
+constexpr size_t MAX_BLOCK = 128 * 1024;
+constexpr uint32_t TRACKER_INTERVAL = 1800;
+constexpr uint64_t UDP_PROTOCOL_ID = 0x41727101980ULL;
+constexpr uint64_t UDP_CONNECTION_ID = 0x5157A2D0C0FFEEULL;
+
+void putU32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+void putU64(std::vector<uint8_t>& out, uint64_t v) {
+    for (int shift = 56; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+uint32_t getU32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t getU64(const uint8_t* p) {
+    return (uint64_t(getU32(p)) << 32) | getU32(p + 4);
+}
+
+double clockSeconds(clockid_t clock) {
+    timespec ts{};
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// State shared by every connection of one seed: the payload it serves, the greeting
+// (handshake + full bitfield) and the upload pacing that all its connections share.
+struct Seed {
+    Seed(net::io_context& io_context, const std::vector<uint8_t>& data, const SwarmSimulator::Options& opts)
+        : acceptor(io_context, tcp::endpoint(net::ip::address_v4::loopback(), 0)),
+          payload(data), options(opts), rng(std::random_device{}()) {}
+
+    tcp::acceptor acceptor;
+    const std::vector<uint8_t>& payload;
+    const SwarmSimulator::Options& options;
+    std::string info_hash;
+    std::vector<uint8_t> greeting;
+
+    std::mutex mutex;  // Guards the pacing state and rng
+    Clock::time_point next_free{};
+    std::mt19937 rng;
+
+    // When a reply of `bytes` queued now reaches the client: after the uplink is
+    // free and the bytes are serialized at `bandwidth`, plus latency, plus an RTO if lost.
+    Clock::time_point arrival(size_t bytes, bool may_lose) {
+        auto now = Clock::now();
+        auto sent = now;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (options.bandwidth > 0) {
+            next_free = std::max(next_free, now) +
+                        std::chrono::nanoseconds(static_cast<int64_t>(bytes * 1e9 / options.bandwidth));
+            sent = next_free;
+        }
+        auto at = sent + options.latency;
+        if (may_lose && options.loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < options.loss) {
+            at += SwarmSimulator::LOSS_PENALTY;
+        }
+        return at;
+    }
+};
+
+// One client connection to a seed. Reads requests and answers them in order,
+// each reply held back until Seed::arrival() says it would have arrived.
+class SeedConnection : public std::enable_shared_from_this<SeedConnection> {
+public:
+    SeedConnection(tcp::socket socket, Seed& seed)
+        : m_socket(std::move(socket)), m_timer(m_socket.get_executor()), m_seed(seed) {}
+
+    void start() {
+        auto self = shared_from_this();
+        net::async_read(m_socket, net::buffer(m_handshake), [self](boost::system::error_code ec, size_t) {
+            if (ec || std::memcmp(self->m_handshake.data() + 28, self->m_seed.info_hash.data(), 20) != 0) {
+                return;
+            }
+            net::async_write(self->m_socket, net::buffer(self->m_seed.greeting),
+                [self](boost::system::error_code ec, size_t) {
+                    if (!ec) self->readHeader();
+                });
+        });
+    }
+
+private:
+    struct Reply {
+        Clock::time_point at;
+        std::vector<uint8_t> data;
+    };
+
+    void readHeader() {
+        auto self = shared_from_this();
+        net::async_read(m_socket, net::buffer(m_header), [self](boost::system::error_code ec, size_t) {
+            if (ec) return;
+            uint32_t length = getU32(self->m_header.data());
+            if (length == 0) {
+                self->readHeader();  // Keep-alive
+                return;
+            }
+            if (length > MAX_MESSAGE) return;
+            self->m_body.resize(length);
+            net::async_read(self->m_socket, net::buffer(self->m_body), [self](boost::system::error_code ec, size_t) {
+                if (ec) return;
+                self->onMessage();
+                self->readHeader();
+            });
+        });
+    }
+
+    void onMessage() {
+        switch (m_body[0]) {
+        case Peer::Message::INTERESTED:
+            schedule({0, 0, 0, 1, static_cast<uint8_t>(Peer::Message::UNCHOKE)}, false);
+            break;
+        case Peer::Message::REQUEST:
+            if (m_body.size() == 13) {
+                serve(getU32(&m_body[1]), getU32(&m_body[5]), getU32(&m_body[9]));
+            }
+            break;
+        default:
+            break;  // Cancels arrive too late to matter on loopback; everything else needs no answer
+        }
+    }
+
+    void serve(uint32_t index, uint32_t begin, uint32_t length) {
+        size_t offset = size_t(index) * m_seed.options.piece_length + begin;
+        if (length == 0 || length > MAX_BLOCK || begin + length > m_seed.options.piece_length ||
+            offset + length > m_seed.payload.size()) {
+            return;
+        }
+        std::vector<uint8_t> message;
+        message.reserve(13 + length);
+        putU32(message, 9 + length);
+        message.push_back(static_cast<uint8_t>(Peer::Message::PIECE));
+        putU32(message, index);
+        putU32(message, begin);
+        message.insert(message.end(), m_seed.payload.begin() + offset, m_seed.payload.begin() + offset + length);
+        schedule(std::move(message), true);
+    }
+
+    // TCP delivers in order, so a delayed (lost) reply also holds back everything behind it.
+    void schedule(std::vector<uint8_t> message, bool may_lose) {
+        auto at = std::max(m_seed.arrival(message.size(), may_lose), m_last_arrival);
+        m_last_arrival = at;
+        m_outbox.push_back({at, std::move(message)});
+        if (m_outbox.size() == 1) {
+            writeNext();
+        }
+    }
+
+    void writeNext() {
+        if (m_outbox.empty()) return;
+        auto self = shared_from_this();
+        m_timer.expires_at(m_outbox.front().at);
+        m_timer.async_wait([self](boost::system::error_code ec) {
+            if (ec) return;
+            net::async_write(self->m_socket, net::buffer(self->m_outbox.front().data),
+                [self](boost::system::error_code ec, size_t) {
+                    if (ec) return;
+                    self->m_outbox.pop_front();
+                    self->writeNext();
+                });
+        });
+    }
+
+    tcp::socket m_socket;
+    net::steady_timer m_timer;
+    Seed& m_seed;
+    std::array<uint8_t, 68> m_handshake{};
+    std::array<uint8_t, 4> m_header{};
+    std::vector<uint8_t> m_body;
+    std::deque<Reply> m_outbox;
+    Clock::time_point m_last_arrival{};
+};
+
+// Minimal HTTP tracker: every announce gets all seeds, every scrape the seed count.
+class TrackerConnection : public std::enable_shared_from_this<TrackerConnection> {
+public:
+    TrackerConnection(tcp::socket socket, const std::string& announce_body, const std::string& scrape_body)
+        : m_socket(std::move(socket)), m_announce_body(announce_body), m_scrape_body(scrape_body) {}
+
+    void read() {
+        auto self = shared_from_this();
+        m_request = {};
+        http::async_read(m_socket, m_buffer, m_request, [self](beast::error_code ec, size_t) {
+            if (!ec) self->respond();
+        });
+    }
+
+private:
+    void respond() {
+        bool scrape = m_request.target().starts_with("/scrape");
+        m_response = {http::status::ok, m_request.version()};
+        m_response.set(http::field::content_type, "text/plain");
+        m_response.keep_alive(m_request.keep_alive());
+        m_response.body() = scrape ? m_scrape_body : m_announce_body;
+        m_response.prepare_payload();
+        auto self = shared_from_this();
+        http::async_write(m_socket, m_response, [self](beast::error_code ec, size_t) {
+            if (!ec && self->m_response.keep_alive()) self->read();
+        });
+    }
+
+    tcp::socket m_socket;
+    const std::string& m_announce_body;
+    const std::string& m_scrape_body;
+    beast::flat_buffer m_buffer;
+    http::request<http::string_body> m_request;
+    http::response<http::string_body> m_response;
+};
+
+} // namespace
+
+// Everything on the server side of the swarm, run by threads of its own.
+struct SwarmSimulator::Stubs {
+    net::io_context io_context;
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Seed>> seeds;
+    std::optional<tcp::acceptor> http_tracker;
+    std::optional<udp::socket> udp_tracker;
+    std::array<uint8_t, 2048> datagram{};
+    udp::endpoint sender;
+    std::string info_hash;
+    std::vector<uint8_t> compact_peers;
+    std::string announce_body;
+    std::string scrape_body;
+
+    Stubs(const SwarmSimulator::Options& options, const std::vector<uint8_t>& payload) {
+        for (int i = 0; i < options.seeds; i++) {
+            seeds.push_back(std::make_unique<Seed>(io_context, payload, options));
+            uint16_t port = seeds.back()->acceptor.local_endpoint().port();
+            compact_peers.insert(compact_peers.end(), {127, 0, 0, 1});
+            compact_peers.push_back(static_cast<uint8_t>(port >> 8));
+            compact_peers.push_back(static_cast<uint8_t>(port & 0xFF));
+        }
+        if (options.udp_tracker) {
+            udp_tracker.emplace(io_context, udp::endpoint(net::ip::address_v4::loopback(), 0));
+        } else {
+            http_tracker.emplace(io_context, tcp::endpoint(net::ip::address_v4::loopback(), 0));
+        }
+    }
+
+    std::string announceUrl() const {
+        if (udp_tracker) {
+            return "udp://127.0.0.1:" + std::to_string(udp_tracker->local_endpoint().port()) + "/announce";
+        }
+        return "http://127.0.0.1:" + std::to_string(http_tracker->local_endpoint().port()) + "/announce";
+    }
+
+    void start(const TorrentMetadata& metadata, size_t threadCount) {
+        info_hash = metadata.getInfoHash();
+        std::vector<uint8_t> greeting;
+        greeting.push_back(19);
+        const std::string protocol = "BitTorrent protocol";
+        greeting.insert(greeting.end(), protocol.begin(), protocol.end());
+        greeting.insert(greeting.end(), 8, 0);
+        greeting.insert(greeting.end(), info_hash.begin(), info_hash.end());
+        const std::string seed_id = "-SM0001-000000000000";
+        greeting.insert(greeting.end(), seed_id.begin(), seed_id.end());
+
+        size_t pieces = static_cast<size_t>(metadata.getTotalPieces());
+        std::vector<uint8_t> bitfield((pieces + 7) / 8, 0xFF);
+        if (pieces % 8) bitfield.back() = static_cast<uint8_t>(0xFF << (8 - pieces % 8));
+        putU32(greeting, static_cast<uint32_t>(1 + bitfield.size()));
+        greeting.push_back(static_cast<uint8_t>(Peer::Message::BITFIELD));
+        greeting.insert(greeting.end(), bitfield.begin(), bitfield.end());
+
+        for (auto& seed : seeds) {
+            seed->info_hash = info_hash;
+            seed->greeting = greeting;
+            acceptSeed(*seed);
+        }
+
+        nlohmann::json announce = {
+            {"interval", TRACKER_INTERVAL},
+            {"complete", seeds.size()},
+            {"incomplete", 0},
+            {"peers", std::string(compact_peers.begin(), compact_peers.end())}};
+        announce_body = BencodeUtils::encode(announce);
+        nlohmann::json files = nlohmann::json::object();
+        files[info_hash] = {{"complete", seeds.size()}, {"downloaded", 0}, {"incomplete", 0}};
+        scrape_body = BencodeUtils::encode(nlohmann::json{{"files", files}});
+
+        if (http_tracker) acceptTracker();
+        if (udp_tracker) receiveDatagram();
+
+        for (size_t i = 0; i < threadCount; i++) {
+            threads.emplace_back([this] { io_context.run(); });
+        }
+    }
+
+    void stop() {
+        io_context.stop();
+        for (auto& thread : threads) {
+            if (thread.joinable()) thread.join();
+        }
+    }
+
+    // CPU consumed by the stub threads so far; nullopt where per-thread clocks are unavailable.
+    std::optional<double> cpuSeconds() {
+#if defined(__linux__)
+        double total = 0;
+        for (auto& thread : threads) {
+            clockid_t clock;
+            if (pthread_getcpuclockid(thread.native_handle(), &clock) != 0) return std::nullopt;
+            total += clockSeconds(clock);
+        }
+        return total;
+#else
+        return std::nullopt;
+#endif
+    }
+
+    void acceptSeed(Seed& seed) {
+        seed.acceptor.async_accept(net::make_strand(io_context),
+            [this, &seed](boost::system::error_code ec, tcp::socket socket) {
+                if (ec) return;
+                std::make_shared<SeedConnection>(std::move(socket), seed)->start();
+                acceptSeed(seed);
+            });
+    }
+
+    void acceptTracker() {
+        http_tracker->async_accept(net::make_strand(io_context),
+            [this](boost::system::error_code ec, tcp::socket socket) {
+                if (ec) return;
+                std::make_shared<TrackerConnection>(std::move(socket), announce_body, scrape_body)->read();
+                acceptTracker();
+            });
+    }
+
+    // BEP 15 tracker: one receive outstanding at a time, so handlers never overlap.
+    void receiveDatagram() {
+        udp_tracker->async_receive_from(net::buffer(datagram), sender,
+            [this](boost::system::error_code ec, size_t length) {
+                if (ec) return;
+                answerDatagram(length);
+                receiveDatagram();
+            });
+    }
+
+    void answerDatagram(size_t length) {
+        if (length < 16) return;
+        uint32_t action = getU32(&datagram[8]);
+        uint32_t transaction_id = getU32(&datagram[12]);
+        std::vector<uint8_t> reply;
+        putU32(reply, action);
+        putU32(reply, transaction_id);
+        if (action == 0 && getU64(&datagram[0]) == UDP_PROTOCOL_ID) {
+            putU64(reply, UDP_CONNECTION_ID);
+        } else if (action == 1 && length >= 98 && getU64(&datagram[0]) == UDP_CONNECTION_ID) {
+            putU32(reply, TRACKER_INTERVAL);
+            putU32(reply, 0);
+            putU32(reply, static_cast<uint32_t>(seeds.size()));
+            reply.insert(reply.end(), compact_peers.begin(), compact_peers.end());
+        } else if (action == 2 && getU64(&datagram[0]) == UDP_CONNECTION_ID) {
+            for (size_t pos = 16; pos + 20 <= length; pos += 20) {
+                bool ours = std::memcmp(&datagram[pos], info_hash.data(), 20) == 0;
+                putU32(reply, ours ? static_cast<uint32_t>(seeds.size()) : 0);
+                putU32(reply, 0);
+                putU32(reply, 0);
+            }
+        } else {
+            return;
+        }
+        boost::system::error_code ec;
+        udp_tracker->send_to(net::buffer(reply), sender, 0, ec);
+    }
+};
+
+SwarmSimulator::SwarmSimulator(Options options) : m_options(options) {
+    if (m_options.seeds < 1 || m_options.payload_bytes == 0 || m_options.piece_length == 0 ||
+        m_options.loss < 0 || m_options.loss >= 1) {
+        throw std::invalid_argument("Invalid swarm simulation options");
+    }
+}
+
+SwarmSimulator::~SwarmSimulator() {
+    if (m_stubs) m_stubs->stop();
+    if (!m_torrent_path.empty()) {
+        std::error_code ec;
+        std::filesystem::remove(m_torrent_path, ec);
+    }
+}
+
+void SwarmSimulator::writeTorrent(const std::string& announce_url) {
+    std::string pieces;
+    for (size_t offset = 0; offset < m_payload.size(); offset += m_options.piece_length) {
+        size_t length = std::min(m_options.piece_length, m_payload.size() - offset);
+        pieces += HashUtils::computeSHA1(std::string(m_payload.begin() + offset, m_payload.begin() + offset + length));
+    }
+    nlohmann::json info = {
+        {"length", m_payload.size()},
+        {"name", "swarm-sim.bin"},
+        {"piece length", m_options.piece_length},
+        {"pieces", pieces}};
+    nlohmann::json root = {{"announce", announce_url}, {"info", info}};
+
+    m_torrent_path = (std::filesystem::temp_directory_path() /
+                      ("swarm-sim-" + std::to_string(::getpid()) + ".torrent")).string();
+    std::ofstream out(m_torrent_path, std::ios::binary | std::ios::trunc);
+    out << BencodeUtils::encode(root);
+}
+
+SwarmSimulator::Result SwarmSimulator::run() {
+    m_payload.resize(m_options.payload_bytes);
+    std::mt19937_64 gen{std::random_device{}()};
+    for (size_t i = 0; i < m_payload.size(); i += 8) {
+        uint64_t word = gen();
+        std::memcpy(&m_payload[i], &word, std::min<size_t>(8, m_payload.size() - i));
+    }
+
+    m_stubs = std::make_unique<Stubs>(m_options, m_payload);
+    writeTorrent(m_stubs->announceUrl());
+    auto metadata = TorrentMetadata::fromFile(m_torrent_path);
+    m_stubs->start(metadata, std::clamp<size_t>(m_options.seeds, 1, 4));
+
+    Result result;
+    result.bytes = m_payload.size();
+    result.pieces = metadata.getTotalPieces();
+
+    const std::string peerId = "-BT0200-" + std::to_string(100000000000ULL + gen() % 900000000000ULL);
+    DownloadManager dm(&metadata, {}, peerId);
+    if (!m_options.disk_dir.empty()) {
+        dm.enableWriteBack(m_options.disk_dir);
+    }
+    EventLoop eventLoop(2);
+    ThreadPool announcePool(1);
+    auto tracker = make_shared<TrackerSession>(
+        eventLoop.context(), announcePool, metadata, peerId, 6881,
+        [&dm] {
+            return TrackerSession::Stats{dm.getBytesUploaded(), dm.getBytesDownloaded(), dm.getBytesLeft()};
+        },
+        [&dm](const vector<Tracker::PeerInfo>& peers) { dm.addPeers(peers); });
+
+    auto stubCpuStart = m_stubs->cpuSeconds();
+    double cpuStart = clockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    auto start = Clock::now();
+    auto deadline = start + m_options.timeout;
+    optional<Clock::time_point> firstPiece;
+
+    tracker->start();
+    if (dm.waitForPeers(m_options.timeout)) {
+        dm.start();
+        while (!dm.isComplete() && Clock::now() < deadline &&
+               dm.waitForProgress(std::chrono::milliseconds(5))) {
+            if (!firstPiece && dm.getDownloadedWantedCount() > 0) {
+                firstPiece = Clock::now();
+            }
+        }
+    }
+    auto end = Clock::now();
+    double cpuEnd = clockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    auto stubCpuEnd = m_stubs->cpuSeconds();
+
+    result.complete = dm.isComplete();
+    if (result.complete && !m_options.disk_dir.empty()) {
+        std::string outputPath = m_options.disk_dir;
+        result.complete = dm.assembleFile(outputPath);
+        end = Clock::now();  // Flushing the cache is part of the download
+    }
+    if (result.complete) {
+        auto data = dm.read(0, m_payload.size());
+        result.verified = data && *data == m_payload;
+    }
+    dm.stop();
+    dm.wait();
+    tracker->stop();
+    m_stubs->stop();
+
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    if (firstPiece) {
+        result.time_to_first_piece_ms = std::chrono::duration<double, std::milli>(*firstPiece - start).count();
+    }
+    if (result.complete && result.seconds > 0) {
+        result.mb_per_sec = result.bytes / (1024.0 * 1024.0) / result.seconds;
+    }
+    result.cpu_seconds = cpuEnd - cpuStart;
+    if (stubCpuStart && stubCpuEnd) {
+        result.cpu_seconds -= *stubCpuEnd - *stubCpuStart;
+    } else {
+        result.cpu_includes_stubs = true;
+    }
+    result.cpu_seconds_per_gb = result.cpu_seconds / (result.bytes / (1024.0 * 1024.0 * 1024.0));
+    return result;
+}
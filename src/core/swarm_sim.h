@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+// Loopback swarm for end-to-end benchmarks. Generates a random payload and a
+// matching torrent, serves it from `seeds` in-process seeders on 127.0.0.1 behind
+// an in-process HTTP or UDP tracker stub, and downloads it with the real
+// TrackerSession + DownloadManager. Seeds can add per-message latency, cap their
+// upload rate and simulate packet loss, so the client can be measured under
+// WAN-like conditions without leaving the machine.
+//
+// The stubs run on their own threads so their CPU time can be subtracted from the
+// process total; cpu_seconds_per_gb therefore reflects the client alone.
+class SwarmSimulator {
+public:
+    struct Options {
+        int seeds = 4;
+        size_t payload_bytes = 64 * 1024 * 1024;
+        size_t piece_length = 256 * 1024;
+        std::chrono::milliseconds latency{0};  // One-way delay before every reply a seed sends
+        int64_t bandwidth = 0;                 // Upload cap per seed in bytes/sec; 0 = unlimited
+        double loss = 0;                       // Probability that a block reply is lost once
+        bool udp_tracker = false;              // Announce over BEP 15 instead of HTTP
+        std::chrono::seconds timeout{300};     // Give up on the download after this long
+        std::string disk_dir;                  // Write pieces back under this directory; empty = keep them in memory
+    };
+
+    struct Result {
+        bool complete = false;
+        bool verified = false;          // Downloaded bytes match the generated payload
+        size_t bytes = 0;
+        int pieces = 0;
+        double seconds = 0;             // From tracker start to the last verified piece
+        double time_to_first_piece_ms = 0;
+        double mb_per_sec = 0;
+        double cpu_seconds = 0;         // Client CPU over the download (stubs excluded)
+        double cpu_seconds_per_gb = 0;
+        bool cpu_includes_stubs = false; // Per-thread CPU clocks unavailable on this platform
+    };
+
+    // A lost segment is only repaired after the sender's retransmission timeout;
+    // replies that "lose" a packet are held back by this much (Linux's minimum RTO).
+    static constexpr std::chrono::milliseconds LOSS_PENALTY{200};
+
+    explicit SwarmSimulator(Options options);
+    ~SwarmSimulator();
+
+    SwarmSimulator(const SwarmSimulator&) = delete;
+    SwarmSimulator& operator=(const SwarmSimulator&) = delete;
+
+    // Start the stubs, run one complete download and tear everything down again.
+    Result run();
+
+private:
+    struct Stubs;
+
+    Options m_options;
+    std::vector<uint8_t> m_payload;
+    std::string m_torrent_path;
+    std::unique_ptr<Stubs> m_stubs;
+
+    void writeTorrent(const std::string& announce_url);
+};
@@ -0,0 +1,55 @@
+#include "thread_pool.h"
+#include "../utils/logger.h"
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        m_threads.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::post(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_cv.notify_one();
+}
+
+size_t ThreadPool::queued() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+void ThreadPool::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cv.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+        if (m_jobs.empty()) {
+            return;  // Stopping and drained
+        }
+        auto job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+        // submit() jobs carry their exceptions in the future; a bare post() job must not kill the pool
+        try {
+            job();
+        } catch (const std::exception& e) {
+            BT_LOG_ERROR("Thread pool job failed: " << e.what());
+        }
+        lock.lock();
+    }
+}
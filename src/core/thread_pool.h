@@ -0,0 +1,47 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of threads draining a FIFO of jobs. The session runs one for piece
+// hashing and one for disk writes, so the CPU and I/O spent on those is bounded
+// per process however many torrents are active.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queue a job; its result (or exception) is delivered through the future.
+    template <typename F>
+    auto submit(F&& job) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+        auto future = task->get_future();
+        post([task] { (*task)(); });
+        return future;
+    }
+
+    // Queue a job without a result. Jobs still queued at destruction are run first.
+    void post(std::function<void()> job);
+
+    size_t threads() const { return m_threads.size(); }
+    size_t queued() const;
+
+private:
+    void run();
+
+    std::vector<std::thread> m_threads;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_stopping = false;
+};
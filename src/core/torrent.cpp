@@ -4,6 +4,31 @@
 #include "../utils/error.h"
 #include <fstream>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+
+// A single file or directory name: nothing that could leave the download directory.
+static bool isSafePathComponent(const std::string& part) {
+    return !part.empty() && part != "." && part != ".." && part.find('/') == std::string::npos &&
+           part.find('\\') == std::string::npos && part.find('\0') == std::string::npos;
+}
+
+// Joins a bencoded path list, rejecting components that could escape the download directory.
+static std::string joinFilePath(const nlohmann::json& components) {
+    std::string joined;
+    for (const auto& component : components) {
+        const auto& part = component.get_ref<const std::string&>();
+        if (!isSafePathComponent(part)) {
+            throw BitTorrent::TorrentError("Invalid path component in torrent file list: " + part);
+        }
+        if (!joined.empty()) joined += '/';
+        joined += part;
+    }
+    if (joined.empty()) {
+        throw BitTorrent::TorrentError("Empty path in torrent file list");
+    }
+    return joined;
+}
 
 TorrentMetadata TorrentMetadata::fromFile(const std::string& path) {
     std::ifstream file(path, std::ios::binary);
@@ -20,29 +45,70 @@ TorrentMetadata TorrentMetadata::fromFile(const std::string& path) {
     }
 
     TorrentMetadata metadata;
-    metadata.m_data = decoded.value();
+    const auto& root = decoded.value();
     
-    // Extract and store required fields
-    if (!metadata.m_data.contains("announce")) {
+    // Extract and store required fields; the decoded tree is dropped on return
+    if (root.contains("announce-list") && root["announce-list"].is_array()) {
+        for (const auto& tier : root["announce-list"]) {
+            std::vector<std::string> urls;
+            for (const auto& url : tier) {
+                if (url.is_string() && !url.get_ref<const std::string&>().empty()) {
+                    urls.push_back(url.get<std::string>());
+                }
+            }
+            if (!urls.empty()) {
+                metadata.m_announce_tiers.push_back(std::move(urls));
+            }
+        }
+    }
+    if (root.contains("announce")) {
+        metadata.m_announce_url = root["announce"].get<std::string>();
+    } else if (!metadata.m_announce_tiers.empty()) {
+        metadata.m_announce_url = metadata.m_announce_tiers.front().front();
+    } else {
         throw BitTorrent::TorrentError("Missing announce URL in torrent file");
     }
-    metadata.m_announce_url = metadata.m_data["announce"].get<std::string>();
+    if (metadata.m_announce_tiers.empty()) {
+        metadata.m_announce_tiers.push_back({metadata.m_announce_url});
+    }
 
-    auto info = metadata.m_data["info"];
+    const auto& info = root["info"];
     metadata.m_piece_length = info["piece length"].get<size_t>();
-    metadata.m_pieces = info["pieces"].get<std::string>();
     metadata.m_name = info["name"].get<std::string>();
+    // The name is the output file (single-file) or directory (multi-file) under the download directory
+    if (!isSafePathComponent(metadata.m_name)) {
+        throw BitTorrent::TorrentError("Invalid torrent name: " + metadata.m_name);
+    }
+
+    // Pack the concatenated piece hashes into a contiguous 20-byte table
+    const auto& pieces = info["pieces"].get_ref<const std::string&>();
+    if (pieces.size() % 20 != 0) {
+        throw BitTorrent::TorrentError("Invalid pieces field length: " + std::to_string(pieces.size()));
+    }
+    metadata.m_piece_hashes.resize(pieces.size() / 20);
+    std::memcpy(metadata.m_piece_hashes.data(), pieces.data(), pieces.size());
     
-    // Calculate total length
+    // Build the file table and calculate total length
     if (info.contains("length")) {
         metadata.m_total_length = info["length"].get<size_t>();
-    } 
-    // else if (info.contains("files")) {
-        // metadata.m_total_length = 0;
-        // for (const auto& file : info["files"]) {
-        //     metadata.m_total_length += file["length"].get<size_t>();
-        // }
-    // }
+        metadata.m_files.push_back({metadata.m_name, metadata.m_total_length, 0});
+    } else if (info.contains("files")) {
+        metadata.m_multi_file = true;
+        metadata.m_total_length = 0;
+        for (const auto& file : info["files"]) {
+            FileEntry entry{joinFilePath(file["path"]), file["length"].get<size_t>(), metadata.m_total_length};
+            metadata.m_total_length += entry.length;
+            metadata.m_files.push_back(std::move(entry));
+        }
+    } else {
+        throw BitTorrent::TorrentError("Torrent info has neither length nor files");
+    }
+
+    if (metadata.m_piece_length == 0 ||
+        static_cast<size_t>(metadata.getTotalPieces()) != metadata.m_piece_hashes.size()) {
+        throw BitTorrent::TorrentError("Piece count does not match total length");
+    }
+    metadata.buildPieceFileIndex();
 
     // Calculate info hash
     std::string bencoded_info = BencodeUtils::encode(info);
@@ -51,18 +117,69 @@ TorrentMetadata TorrentMetadata::fromFile(const std::string& path) {
     return metadata;
 }
 
+// Index of the file containing payload_offset: the last file starting at or before it.
+// Zero-length files share their successor's offset, so upper_bound skips past them.
+size_t TorrentMetadata::findFile(size_t payload_offset) const {
+    auto it = std::upper_bound(m_files.begin(), m_files.end(), payload_offset,
+        [](size_t offset, const FileEntry& file) { return offset < file.offset; });
+    return static_cast<size_t>(std::distance(m_files.begin(), it)) - 1;
+}
+
+void TorrentMetadata::buildPieceFileIndex() {
+    int totalPieces = getTotalPieces();
+    m_piece_spans.resize(totalPieces);
+    for (int i = 0; i < totalPieces; i++) {
+        size_t start = static_cast<size_t>(i) * m_piece_length;
+        size_t end = start + getActualPieceLength(i) - 1;
+        m_piece_spans[i] = {static_cast<uint32_t>(findFile(start)), static_cast<uint32_t>(findFile(end))};
+    }
+}
+
+std::vector<TorrentMetadata::FileSlice> TorrentMetadata::mapBlock(int piece_idx, size_t begin, size_t length) const {
+    std::vector<FileSlice> slices;
+    size_t offset = static_cast<size_t>(piece_idx) * m_piece_length + begin;
+    size_t remaining = std::min(length, m_total_length - std::min(offset, m_total_length));
+    size_t file_idx = remaining ? findFile(offset) : m_files.size();
+
+    while (remaining > 0 && file_idx < m_files.size()) {
+        const FileEntry& file = m_files[file_idx];
+        size_t file_offset = offset - file.offset;
+        size_t n = std::min(remaining, file.length - file_offset);
+        if (n > 0) {
+            slices.push_back({file_idx, file_offset, n});
+        }
+        offset += n;
+        remaining -= n;
+        file_idx++;
+    }
+    return slices;
+}
+
 void TorrentMetadata::printInfo() const {
     std::cout << "Tracker URL: " << m_announce_url << "\n"
               << "Length: " << m_total_length << "\n"
               << "Info Hash: " << HashUtils::bytesToHex(m_info_hash) << "\n"
               << "Piece Length: " << m_piece_length << "\n"
-              << "Piece Count: " << m_pieces.length() / 20 << std::endl;
+              << "Piece Count: " << m_piece_hashes.size() << "\n"
+              << "Files: " << m_files.size() << std::endl;
 } 
 
-std::string TorrentMetadata::getInfoHash() const { return m_info_hash; }
-std::string TorrentMetadata::getAnnounceUrl() const { return m_announce_url; }
+const std::string& TorrentMetadata::getInfoHash() const { return m_info_hash; }
+const std::string& TorrentMetadata::getAnnounceUrl() const { return m_announce_url; }
+const std::vector<std::vector<std::string>>& TorrentMetadata::getAnnounceTiers() const { return m_announce_tiers; }
 size_t TorrentMetadata::getTotalLength() const { return m_total_length; }
 size_t TorrentMetadata::getPieceLength() const { return m_piece_length; }
-std::string TorrentMetadata::getPieces() const { return m_pieces; }
+std::span<const TorrentMetadata::PieceHash> TorrentMetadata::getPieceHashes() const { return m_piece_hashes; }
+const TorrentMetadata::PieceHash& TorrentMetadata::getPieceHash(int piece_idx) const { return m_piece_hashes[piece_idx]; }
 int TorrentMetadata::getTotalPieces() const { return (getTotalLength() + getPieceLength() - 1) / getPieceLength();}
-std::string TorrentMetadata::getName() const {return m_name;}
\ No newline at end of file
+const std::string& TorrentMetadata::getName() const {return m_name;}
+bool TorrentMetadata::isMultiFile() const { return m_multi_file; }
+const std::vector<TorrentMetadata::FileEntry>& TorrentMetadata::getFiles() const { return m_files; }
+const TorrentMetadata::PieceFileSpan& TorrentMetadata::getPieceFileSpan(int piece_idx) const { return m_piece_spans[piece_idx]; }
+
+size_t TorrentMetadata::getActualPieceLength(int piece_idx) const {
+    if (piece_idx == getTotalPieces() - 1) {
+        return m_total_length - static_cast<size_t>(piece_idx) * m_piece_length;
+    }
+    return m_piece_length;
+}
\ No newline at end of file
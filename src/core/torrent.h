@@ -1,28 +1,72 @@
 #pragma once
+#include <array>
+#include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
-#include "../lib/nlohmann/json.hpp"
 
 class TorrentMetadata {
 public:
+    // Raw SHA1 digest of a single piece, as stored in info["pieces"].
+    using PieceHash = std::array<uint8_t, 20>;
+
+    // One entry of the file table. Single-file torrents have exactly one entry.
+    struct FileEntry {
+        std::string path;  // Relative path ('/'-joined), under getName() for multi-file torrents
+        size_t length;
+        size_t offset;     // Cumulative byte offset of the file within the torrent payload
+    };
+
+    // A contiguous run of bytes inside one file, produced by mapBlock().
+    struct FileSlice {
+        size_t file_index;
+        size_t file_offset;
+        size_t length;
+    };
+
+    // Inclusive range of file indices a piece overlaps.
+    struct PieceFileSpan {
+        uint32_t first_file;
+        uint32_t last_file;
+    };
+
     static TorrentMetadata fromFile(const std::string& path);
-    
+
     // Getters used in main.cpp and other files
-    std::string getInfoHash() const;
-    std::string getAnnounceUrl() const;
+    const std::string& getInfoHash() const;
+    const std::string& getAnnounceUrl() const;
+    // Tracker tiers from announce-list (BEP 12); a single tier holding the
+    // announce URL when the torrent has no announce-list.
+    const std::vector<std::vector<std::string>>& getAnnounceTiers() const;
     size_t getPieceLength() const;
     size_t getTotalLength() const;
-    std::string getPieces() const;  // Returns concatenated SHA1 hashes of pieces
+    std::span<const PieceHash> getPieceHashes() const;  // One SHA1 per piece, no copies
+    const PieceHash& getPieceHash(int piece_idx) const;
     int getTotalPieces() const;
     void printInfo() const;  // Used by the info command
-    std::string getName() const;
+    const std::string& getName() const;
+
+    // Multi-file layout
+    bool isMultiFile() const;
+    const std::vector<FileEntry>& getFiles() const;
+    const PieceFileSpan& getPieceFileSpan(int piece_idx) const;
+    size_t getActualPieceLength(int piece_idx) const;
+
+    // Maps (piece, begin, length) to the file writes it covers, in payload order.
+    std::vector<FileSlice> mapBlock(int piece_idx, size_t begin, size_t length) const;
 
 private:
-    nlohmann::json m_data;
     std::string m_info_hash;
     std::string m_announce_url;
-    size_t m_total_length;
-    size_t m_piece_length;
-    std::string m_pieces;
+    std::vector<std::vector<std::string>> m_announce_tiers;
+    size_t m_total_length = 0;
+    size_t m_piece_length = 0;
+    std::vector<PieceHash> m_piece_hashes;  // Contiguous 20 bytes per piece
     std::string m_name;
-}; 
\ No newline at end of file
+    bool m_multi_file = false;
+    std::vector<FileEntry> m_files;
+    std::vector<PieceFileSpan> m_piece_spans;  // Built once in fromFile()
+
+    size_t findFile(size_t payload_offset) const;
+    void buildPieceFileIndex();
+};
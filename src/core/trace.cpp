@@ -0,0 +1,232 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Trace {
+
+namespace detail {
+std::atomic<bool> g_enabled{false};
+}
+
+namespace {
+
+enum class Phase : char { Complete = 'X', AsyncBegin = 'b', AsyncEnd = 'e' };
+
+// Fields are relaxed atomics so dump() may read a ring while its owner writes;
+// on x86 these are plain loads and stores.
+struct Slot {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<const char*> category{nullptr};
+    std::atomic<const char*> argName{nullptr};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> end{0};  // Complete events only
+    std::atomic<uint64_t> value{0};  // Argument, or the id of an async event
+    std::atomic<Phase> phase{Phase::Complete};
+};
+
+struct Event {
+    const char* name;
+    const char* category;
+    const char* argName;
+    uint64_t start;
+    uint64_t end;
+    uint64_t value;
+    Phase phase;
+};
+
+class ThreadBuffer {
+public:
+    explicit ThreadBuffer(uint32_t tid) : m_tid(tid), m_slots(std::make_unique<Slot[]>(EVENTS_PER_THREAD)) {}
+
+    // Owner thread only.
+    void record(const Event& event) {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[head % EVENTS_PER_THREAD];
+        slot.name.store(event.name, std::memory_order_relaxed);
+        slot.category.store(event.category, std::memory_order_relaxed);
+        slot.argName.store(event.argName, std::memory_order_relaxed);
+        slot.start.store(event.start, std::memory_order_relaxed);
+        slot.end.store(event.end, std::memory_order_relaxed);
+        slot.value.store(event.value, std::memory_order_relaxed);
+        slot.phase.store(event.phase, std::memory_order_relaxed);
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    std::vector<Event> snapshot() const {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+        std::vector<Event> events;
+        events.reserve(head - first);
+        for (uint64_t i = first; i < head; i++) {
+            const Slot& slot = m_slots[i % EVENTS_PER_THREAD];
+            events.push_back({slot.name.load(std::memory_order_relaxed), slot.category.load(std::memory_order_relaxed),
+                              slot.argName.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed),
+                              slot.end.load(std::memory_order_relaxed), slot.value.load(std::memory_order_relaxed),
+                              slot.phase.load(std::memory_order_relaxed)});
+        }
+        // The owner may have lapped us while we copied: drop every slot it could
+        // have rewritten, including the one it may be writing right now
+        uint64_t after = m_head.load(std::memory_order_acquire);
+        uint64_t valid = after + 1 > EVENTS_PER_THREAD ? after + 1 - EVENTS_PER_THREAD : 0;
+        if (valid > first) {
+            events.erase(events.begin(), events.begin() + static_cast<ptrdiff_t>(std::min(valid - first, head - first)));
+        }
+        return events;
+    }
+
+    uint32_t tid() const { return m_tid; }
+
+private:
+    uint32_t m_tid;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<uint64_t> m_head{0};
+};
+
+// Buffers outlive their threads so short-lived workers still show up in a dump,
+// but only the RETAINED_EXITED_THREADS most recent ones.
+std::mutex g_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+std::deque<std::shared_ptr<ThreadBuffer>> g_exited;  // Oldest first
+uint32_t g_nextTid = 1;
+uint64_t g_startTick = 0;
+std::chrono::steady_clock::time_point g_startTime;
+
+// Registers the calling thread's ring and retires it when the thread exits.
+struct ThreadBufferOwner {
+    std::shared_ptr<ThreadBuffer> buffer;
+
+    ThreadBufferOwner() {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        buffer = std::make_shared<ThreadBuffer>(g_nextTid++);
+        g_buffers.push_back(buffer);
+    }
+
+    ~ThreadBufferOwner() {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_exited.push_back(std::move(buffer));
+        if (g_exited.size() > RETAINED_EXITED_THREADS) {
+            // A dump holding its own reference keeps the ring until it is done
+            g_buffers.erase(std::find(g_buffers.begin(), g_buffers.end(), g_exited.front()));
+            g_exited.pop_front();
+        }
+    }
+};
+
+ThreadBuffer& threadBuffer() {
+    thread_local ThreadBufferOwner owner;
+    return *owner.buffer;
+}
+
+std::string hexId(uint64_t id) {
+    std::ostringstream out;
+    out << "0x" << std::hex << id;
+    return out.str();
+}
+
+} // namespace
+
+void enable() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_startTick == 0) {
+        g_startTime = std::chrono::steady_clock::now();
+        g_startTick = now();
+    }
+    detail::g_enabled.store(true, std::memory_order_relaxed);
+}
+
+void disable() {
+    detail::g_enabled.store(false, std::memory_order_relaxed);
+}
+
+void complete(const char* name, const char* category, uint64_t start, uint64_t end,
+              const char* argName, uint64_t arg) {
+    if (!enabled()) return;
+    threadBuffer().record({name, category, argName, start, end, arg, Phase::Complete});
+}
+
+void asyncBegin(const char* name, const char* category, uint64_t id) {
+    if (!enabled()) return;
+    threadBuffer().record({name, category, nullptr, now(), 0, id, Phase::AsyncBegin});
+}
+
+void asyncEnd(const char* name, const char* category, uint64_t id) {
+    if (!enabled()) return;
+    threadBuffer().record({name, category, nullptr, now(), 0, id, Phase::AsyncEnd});
+}
+
+nlohmann::json dump() {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint64_t startTick;
+    std::chrono::steady_clock::time_point startTime;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        buffers = g_buffers;
+        startTick = g_startTick;
+        startTime = g_startTime;
+    }
+
+    // Ticks per microsecond, measured over the whole recording
+    double ticksPerMicro = 1000.0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (startTick != 0) {
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        if (elapsed < std::chrono::milliseconds(10)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+        }
+        uint64_t endTick = now();
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+        ticksPerMicro = static_cast<double>(endTick - startTick) / micros;
+    }
+#endif
+    auto toMicros = [&](uint64_t tick) {
+        return (static_cast<double>(tick) - static_cast<double>(startTick)) / ticksPerMicro;
+    };
+
+    const int pid = static_cast<int>(getpid());
+    nlohmann::json events = nlohmann::json::array();
+    events.push_back({{"name", "process_name"}, {"ph", "M"}, {"pid", pid}, {"args", {{"name", "bittorrent"}}}});
+    for (const auto& buffer : buffers) {
+        events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", pid}, {"tid", buffer->tid()},
+                          {"args", {{"name", "thread " + std::to_string(buffer->tid())}}}});
+        for (const auto& event : buffer->snapshot()) {
+            nlohmann::json out = {{"name", event.name}, {"cat", event.category},
+                                  {"ph", std::string(1, static_cast<char>(event.phase))},
+                                  {"ts", toMicros(event.start)}, {"pid", pid}, {"tid", buffer->tid()}};
+            if (event.phase == Phase::Complete) {
+                out["dur"] = static_cast<double>(event.end - event.start) / ticksPerMicro;
+                if (event.argName && event.value != NO_ARG) {
+                    out["args"] = {{event.argName, event.value}};
+                }
+            } else {
+                out["id"] = hexId(event.value);
+            }
+            events.push_back(std::move(out));
+        }
+    }
+    return {{"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}};
+}
+
+void writeJson(const std::string& path) {
+    auto trace = dump();
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot write trace to " + path);
+    }
+    out << trace.dump();
+    if (!out) {
+        throw std::runtime_error("Failed writing trace to " + path);
+    }
+}
+
+} // namespace Trace
@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "../lib/nlohmann/json.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Timeline tracing of the download pipeline, exported in the Chrome trace event
+// format (load the file in chrome://tracing or ui.perfetto.dev). Each thread
+// records into its own fixed-size ring, so a span costs two timestamp reads and
+// a handful of relaxed stores with no locks or allocation; when a ring wraps the
+// oldest events are overwritten. Timestamps are raw TSC ticks, converted to
+// microseconds only when the trace is dumped.
+//
+// Tracing is off until enable() is called; disabled spans cost one relaxed load.
+// Names, categories and argument names must be string literals (only the
+// pointer is stored).
+namespace Trace {
+
+constexpr size_t EVENTS_PER_THREAD = 16384;
+// Rings of exited threads kept for dumps; older ones are freed, so peer workers
+// coming and going cannot grow the trace without bound.
+constexpr size_t RETAINED_EXITED_THREADS = 32;
+constexpr uint64_t NO_ARG = ~uint64_t(0);
+
+namespace detail {
+extern std::atomic<bool> g_enabled;
+}
+
+inline bool enabled() {
+    return detail::g_enabled.load(std::memory_order_relaxed);
+}
+
+// Ticks of the invariant TSC where available, otherwise steady_clock nanoseconds.
+inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Start recording. Calling it again keeps the events recorded so far.
+void enable();
+void disable();
+
+// A finished span [start, end) on the calling thread.
+void complete(const char* name, const char* category, uint64_t start, uint64_t end,
+              const char* argName = nullptr, uint64_t arg = NO_ARG);
+
+// Spans that begin and end on different threads or overlap on one thread (a
+// request in flight, an async connect). Begin and end match on category, name and id.
+void asyncBegin(const char* name, const char* category, uint64_t id);
+void asyncEnd(const char* name, const char* category, uint64_t id);
+
+// Records the enclosing scope as one complete event.
+class Span {
+public:
+    Span(const char* name, const char* category, const char* argName = nullptr, uint64_t arg = NO_ARG)
+        : m_name(name), m_category(category), m_argName(argName), m_arg(arg),
+          m_start(enabled() ? now() : 0) {}
+    ~Span() {
+        if (m_start != 0) {
+            complete(m_name, m_category, m_start, now(), m_argName, m_arg);
+        }
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* m_name;
+    const char* m_category;
+    const char* m_argName;
+    uint64_t m_arg;
+    uint64_t m_start;
+};
+
+// Everything currently in the rings as a Chrome trace ({"traceEvents": [...]}).
+// Safe to call while other threads keep recording.
+nlohmann::json dump();
+
+// dump() written to a file; throws std::runtime_error if the file cannot be written.
+void writeJson(const std::string& path);
+
+} // namespace Trace
@@ -1,115 +1,106 @@
 #include "tracker.h"
+#include "udp_tracker.h"
 #include "../utils/hash.h"
 #include "../utils/error.h"
 // Removed: #include "../lib/hash/HTTPRequest.hpp"
 #include "../utils/bencode.h"
+#include "http_client.h"
+#include "metrics.h"
+#include "trace.h"
+#include "../utils/logger.h"
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <optional>
-#include <regex>
 #include <stdexcept>
 
-// Boost headers
-#include <boost/beast/core.hpp>
-#include <boost/beast/http.hpp>
-#include <boost/beast/version.hpp>
-#include <boost/asio/ip/tcp.hpp>
-#include <boost/asio/connect.hpp>
-
 using namespace std;
 
-// For convenience
-namespace beast = boost::beast;         // Boost.Beast
-namespace http = beast::http;           // HTTP from Beast
-namespace net = boost::asio;            // Boost.Asio
-using tcp = net::ip::tcp;
-
-// Helper: parse URL into protocol, host, port and target
-// (This is a basic implementation that assumes the URL starts with "http://" or "https://")
-static void parseUrl(const std::string& url_str,
-                     std::string& protocol,
-                     std::string& host,
-                     std::string& port,
-                     std::string& target)
-{
-    // This regex will match URLs of the form:
-    //    http(s)://host[:port][target]
-    std::regex url_regex(R"(^(https?)://([^/:]+)(?::(\d+))?(/.*)?$)", std::regex::icase);
-    std::smatch url_match_result;
-    if (std::regex_match(url_str, url_match_result, url_regex))
-    {
-        protocol = url_match_result[1].str();
-        host = url_match_result[2].str();
-        // If port is specified in the URL, use it; otherwise, default based on protocol.
-        if (url_match_result[3].matched && !url_match_result[3].str().empty())
-            port = url_match_result[3].str();
-        else
-            port = (protocol == "http") ? "80" : "443";
-        // Target (path and query) if present; otherwise, use "/".
-        if (url_match_result[4].matched && !url_match_result[4].str().empty())
-            target = url_match_result[4].str();
-        else
-            target = "/";
-    }
-    else
-    {
-        throw std::invalid_argument("Invalid URL: " + url_str);
-    }
+namespace {
+
+struct AnnounceMetrics {
+    Metrics::Histogram& latency;
+    Metrics::Counter& failures;
+};
+
+AnnounceMetrics& announceMetrics(bool udp) {
+    auto make = [](const char* protocol) {
+        auto& registry = Metrics::Registry::global();
+        return AnnounceMetrics{
+            registry.histogram("bt_tracker_announce_microseconds", "Tracker announce round trip",
+                               {{"protocol", protocol}}),
+            registry.counter("bt_tracker_announce_failures_total", "Announces that got no usable answer",
+                             {{"protocol", protocol}})};
+    };
+    static AnnounceMetrics http = make("http");
+    static AnnounceMetrics udp_metrics = make("udp");
+    return udp ? udp_metrics : http;
 }
 
+} // namespace
+
 std::optional<Tracker::TrackerResponse> Tracker::getPeers(
     const TorrentMetadata& metadata,
     const std::string& peer_id,
     uint16_t port,
     int64_t uploaded,
     int64_t downloaded,
-    int64_t left)
+    int64_t left,
+    const std::string& event)
 {
-    cout << "getting peers " << endl;
+    return announce(metadata.getAnnounceUrl(), metadata, peer_id, port, uploaded, downloaded, left, event);
+}
+
+std::optional<Tracker::TrackerResponse> Tracker::announce(
+    const std::string& announce_url,
+    const TorrentMetadata& metadata,
+    const std::string& peer_id,
+    uint16_t port,
+    int64_t uploaded,
+    int64_t downloaded,
+    int64_t left,
+    const std::string& event,
+    std::chrono::seconds timeout)
+{
+    return announce(announce_url, metadata.getInfoHash(), peer_id, port, uploaded, downloaded, left, event, timeout);
+}
+
+std::optional<Tracker::TrackerResponse> Tracker::announce(
+    const std::string& announce_url,
+    const std::string& info_hash,
+    const std::string& peer_id,
+    uint16_t port,
+    int64_t uploaded,
+    int64_t downloaded,
+    int64_t left,
+    const std::string& event,
+    std::chrono::seconds timeout)
+{
+    BT_LOG_DEBUG("getting peers ");
+    const bool udp = announce_url.rfind("udp://", 0) == 0;
+    auto& metrics = announceMetrics(udp);
+    Metrics::ScopedTimer timer(metrics.latency);
+    Trace::Span span(udp ? "announce_udp" : "announce_http", "tracker");
+    // UDP trackers (BEP 15) speak a binary protocol instead of HTTP
+    if (udp) {
+        auto response = UdpTracker::announce(announce_url, info_hash, peer_id, port,
+                                             uploaded, downloaded, left, event, timeout);
+        if (!response) metrics.failures.add();
+        return response;
+    }
     try {
         // Build the full tracker URL with query parameters.
-        std::string request_url = buildTrackerUrl(metadata, peer_id, port, uploaded, downloaded, left);
-
-        // Parse URL components: protocol, host, port, target (path + query)
-        std::string protocol, host, portStr, target;
-        parseUrl(request_url, protocol, host, portStr, target);
-        std::cout << "Parsed values:" << std::endl;
-        std::cout << "  protocol: " << protocol << std::endl;
-        std::cout << "  host    : " << host << std::endl;
-        std::cout << "  port    : " << portStr << std::endl;
-        std::cout << "  target  : " << target << std::endl;
-        // Set up Boost.Asio I/O context and resolve the host.
-        net::io_context ioc;
-        tcp::resolver resolver(ioc);
-        auto const results = resolver.resolve(host, portStr);
-
-        // Set up a TCP stream using Beast.
-        beast::tcp_stream stream(ioc);
-        stream.connect(results);
-        cout << "connected";
-        // Set up the HTTP GET request.
-        http::request<http::string_body> req{ http::verb::get, target, 11 };
-        req.set(http::field::host, host);
-        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-
-        // Send the HTTP request.
-        http::write(stream, req);
-
-        // Buffer for reading.
-        beast::flat_buffer buffer;
-
-        // Container for the HTTP response.
-        http::response<http::dynamic_body> res;
-        http::read(stream, buffer, res);
-
-        // Gracefully close the socket.
-        beast::error_code ec;
-        stream.socket().shutdown(tcp::socket::shutdown_both, ec);
-        // Note: not critical if shutdown fails.
-
-        // Convert the response body to a string.
-        std::string response_body = beast::buffers_to_string(res.body().data());
-        cout << "response body " << response_body << endl;
+        std::string request_url = buildTrackerUrl(announce_url, info_hash, peer_id, port, uploaded, downloaded, left, event);
+
+        // Pooled keep-alive connection; DNS results are cached across announces
+        auto response = HttpClient::get(request_url, timeout > std::chrono::seconds::zero()
+                                                         ? timeout
+                                                         : std::chrono::seconds(ANNOUNCE_TIMEOUT_SECONDS));
+        if (response.status != 200) {
+            throw BitTorrent::NetworkError("Tracker returned HTTP " + std::to_string(response.status));
+        }
+        const std::string& response_body = response.body;
+        BT_LOG_TRACE("response body " << response_body);
 
         // Parse bencode response.
         auto [decoded_response, _] = BencodeUtils::decode(response_body);
@@ -138,62 +129,162 @@ std::optional<Tracker::TrackerResponse> Tracker::getPeers(
             result.incomplete = response_dict["incomplete"].get<int64_t>();
         }
 
-        // Parse peers.
-        if (!response_dict.contains("peers")) {
+        // Parse peers: compact IPv4 "peers", compact IPv6 "peers6" (BEP 7),
+        // or the original list of {ip, port, peer id} dictionaries.
+        if (!response_dict.contains("peers") && !response_dict.contains("peers6")) {
             throw BitTorrent::NetworkError("No peers in tracker response");
         }
+        if (response_dict.contains("peers")) {
+            const auto& peers = response_dict["peers"];
+            if (peers.is_string()) {
+                const auto& compact = peers.get_ref<const std::string&>();
+                parseCompactPeers(reinterpret_cast<const uint8_t*>(compact.data()), compact.size(),
+                                  PeerEndpoint::V4_SIZE, result.peers);
+            } else if (peers.is_array()) {
+                for (const auto& entry : peers) {
+                    if (!entry.is_object() || !entry.contains("ip") || !entry.contains("port")) {
+                        continue;
+                    }
+                    // Host names are allowed here but rare; only IP literals are used
+                    auto endpoint = PeerEndpoint::fromString(entry["ip"].get<std::string>(),
+                                                             static_cast<uint16_t>(entry["port"].get<int64_t>()));
+                    if (!endpoint) {
+                        continue;
+                    }
+                    PeerInfo peer;
+                    peer.endpoint = *endpoint;
+                    if (entry.contains("peer id") && entry["peer id"].is_string()) {
+                        peer.peer_id = entry["peer id"].get<std::string>();
+                    }
+                    result.peers.push_back(std::move(peer));
+                }
+            }
+        }
+        if (response_dict.contains("peers6") && response_dict["peers6"].is_string()) {
+            const auto& compact = response_dict["peers6"].get_ref<const std::string&>();
+            parseCompactPeers(reinterpret_cast<const uint8_t*>(compact.data()), compact.size(),
+                              PeerEndpoint::V6_SIZE, result.peers);
+        }
 
-        std::string peers_data = response_dict["peers"].get<std::string>();
-
-        // Parse compact peer format (6 bytes per peer).
-        for (size_t i = 0; i < peers_data.length(); i += 6) {
-            if (i + 6 > peers_data.length())
-                break;
+        return result;
+    }
+    catch (const std::exception& e) {
+        BT_LOG_WARN("Tracker request failed: " << e.what());
+        metrics.failures.add();
+        return std::nullopt;
+    }
+}
 
-            PeerInfo peer;
+std::optional<std::string> Tracker::getScrapeUrl(const std::string& announce_url) {
+    if (announce_url.rfind("udp://", 0) == 0) {
+        return announce_url;  // UDP trackers scrape on the same endpoint
+    }
+    // Only the last path component may be "announce"; the query string is kept
+    size_t query = announce_url.find('?');
+    size_t slash = announce_url.rfind('/', query);
+    if (slash == std::string::npos || announce_url.compare(slash + 1, 8, "announce") != 0) {
+        return std::nullopt;
+    }
+    return announce_url.substr(0, slash + 1) + "scrape" + announce_url.substr(slash + 9);
+}
 
-            // Parse IP (first 4 bytes).
-            peer.ip = std::to_string(static_cast<uint8_t>(peers_data[i])) + "." +
-                      std::to_string(static_cast<uint8_t>(peers_data[i + 1])) + "." +
-                      std::to_string(static_cast<uint8_t>(peers_data[i + 2])) + "." +
-                      std::to_string(static_cast<uint8_t>(peers_data[i + 3]));
+std::optional<std::unordered_map<std::string, Tracker::ScrapeEntry>> Tracker::scrape(
+    const std::string& announce_url,
+    const std::vector<std::string>& info_hashes)
+{
+    auto scrape_url = getScrapeUrl(announce_url);
+    if (!scrape_url) {
+        BT_LOG_WARN("Tracker does not support scrape: " << announce_url);
+        return std::nullopt;
+    }
+    const bool udp = scrape_url->rfind("udp://", 0) == 0;
+    const size_t batch_size = udp ? UdpTracker::MAX_SCRAPE_HASHES : MAX_HTTP_SCRAPE_HASHES;
 
-            // Parse port (last 2 bytes).
-            peer.port = static_cast<uint16_t>(
-                (static_cast<uint8_t>(peers_data[i + 4]) << 8) |
-                static_cast<uint8_t>(peers_data[i + 5])
-            );
+    std::unordered_map<std::string, ScrapeEntry> result;
+    bool answered = false;
+    for (size_t first = 0; first < info_hashes.size(); first += batch_size) {
+        size_t last = std::min(first + batch_size, info_hashes.size());
+        std::vector<std::string> batch(info_hashes.begin() + first, info_hashes.begin() + last);
 
-            // In compact format, peer_id is not provided.
-            peer.peer_id = "";
-            result.peers.push_back(peer);
+        if (udp) {
+            auto entries = UdpTracker::scrape(*scrape_url, batch);
+            if (!entries) continue;
+            for (size_t i = 0; i < batch.size(); i++) {
+                result[batch[i]] = (*entries)[i];
+            }
+            answered = true;
+            continue;
         }
 
-        return result;
+        try {
+            std::stringstream url;
+            url << *scrape_url;
+            char separator = scrape_url->find('?') == std::string::npos ? '?' : '&';
+            for (const auto& hash : batch) {
+                url << separator << "info_hash=" << HashUtils::urlEncode(HashUtils::hash_to_hex(hash));
+                separator = '&';
+            }
+            auto response = HttpClient::get(url.str(), std::chrono::seconds(ANNOUNCE_TIMEOUT_SECONDS));
+            if (response.status != 200) {
+                throw BitTorrent::NetworkError("Tracker returned HTTP " + std::to_string(response.status));
+            }
+            auto [decoded, _] = BencodeUtils::decode(response.body);
+            if (!decoded || !decoded->contains("files") || !(*decoded)["files"].is_object()) {
+                throw BitTorrent::BencodeError("Malformed scrape response");
+            }
+            // "files" maps each raw 20-byte info hash to its counts
+            for (const auto& [hash, stats] : (*decoded)["files"].items()) {
+                ScrapeEntry entry;
+                if (stats.contains("complete")) entry.seeders = stats["complete"].get<int64_t>();
+                if (stats.contains("downloaded")) entry.completed = stats["downloaded"].get<int64_t>();
+                if (stats.contains("incomplete")) entry.leechers = stats["incomplete"].get<int64_t>();
+                result[hash] = entry;
+            }
+            answered = true;
+        }
+        catch (const std::exception& e) {
+            BT_LOG_WARN("Scrape request failed: " << e.what());
+        }
     }
-    catch (const std::exception& e) {
-        std::cerr << "Tracker request failed: " << e.what() << std::endl;
+    if (!answered) {
         return std::nullopt;
     }
+    return result;
+}
+
+void Tracker::parseCompactPeers(const uint8_t* data, size_t length, size_t entry_size, std::vector<PeerInfo>& out) {
+    out.reserve(out.size() + length / entry_size);
+    // A trailing partial entry is ignored
+    for (size_t i = 0; i + entry_size <= length; i += entry_size) {
+        PeerInfo peer;
+        peer.endpoint = PeerEndpoint::fromCompact(data + i, entry_size);
+        out.push_back(std::move(peer));
+    }
 }
 
 std::string Tracker::buildTrackerUrl(
-    const TorrentMetadata& metadata,
+    const std::string& announce_url,
+    const std::string& info_hash,
     const std::string& peer_id,
     uint16_t port,
     int64_t uploaded,
     int64_t downloaded,
-    int64_t left)
+    int64_t left,
+    const std::string& event)
 {
     std::stringstream url;
-    url << metadata.getAnnounceUrl()
-        << "?info_hash=" << HashUtils::urlEncode(HashUtils::hash_to_hex(metadata.getInfoHash()))
+    url << announce_url
+        << (announce_url.find('?') == std::string::npos ? "?" : "&")
+        << "info_hash=" << HashUtils::urlEncode(HashUtils::hash_to_hex(info_hash))
         << "&peer_id=" << peer_id
         << "&port=" << port
         << "&uploaded=" << uploaded
         << "&downloaded=" << downloaded
         << "&left=" << left
         << "&compact=1";
+    if (!event.empty()) {
+        url << "&event=" << event;
+    }
 
     return url.str();
 }
@@ -2,15 +2,20 @@
 #include <string>
 #include <vector>
 #include <optional>
+#include <unordered_map>
 #include <cstdint>    // for int64_t
+#include <chrono>
 #include "torrent.h"
+#include "peer_endpoint.h"
 
 class Tracker {
 public:
     struct PeerInfo {
-        std::string ip;
-        uint16_t port;
-        std::string peer_id;
+        PeerEndpoint endpoint;  // Packed IPv4 or IPv6 address and port
+        std::string peer_id;    // Empty for compact peer lists
+
+        std::string ip() const { return endpoint.ip(); }
+        uint16_t port() const { return endpoint.port(); }
     };
 
     struct TrackerResponse {
@@ -21,22 +26,84 @@ public:
         int64_t incomplete = 0;
     };
 
+    // Swarm counts for one torrent as reported by a scrape.
+    struct ScrapeEntry {
+        int64_t seeders = 0;
+        int64_t completed = 0;  // Times the torrent has been fully downloaded
+        int64_t leechers = 0;
+    };
+
+    // Announce to the torrent's primary announce URL.
     static std::optional<TrackerResponse> getPeers(
         const TorrentMetadata& metadata,
         const std::string& peer_id,
         uint16_t port,
         int64_t uploaded,
         int64_t downloaded,
-        int64_t left
+        int64_t left,
+        const std::string& event = ""   // "started", "completed", "stopped" or empty
+    );
+
+    // Announce to a specific tracker (HTTP or UDP), e.g. one entry of an announce-list tier.
+    // `timeout` bounds the whole announce; zero keeps the protocol defaults
+    // (ANNOUNCE_TIMEOUT_SECONDS over HTTP, the full BEP 15 retry schedule over UDP).
+    static std::optional<TrackerResponse> announce(
+        const std::string& announce_url,
+        const TorrentMetadata& metadata,
+        const std::string& peer_id,
+        uint16_t port,
+        int64_t uploaded,
+        int64_t downloaded,
+        int64_t left,
+        const std::string& event = "",
+        std::chrono::seconds timeout = std::chrono::seconds::zero()
     );
 
+    // Same, by raw 20-byte info hash, for callers that must not hold on to the metadata.
+    static std::optional<TrackerResponse> announce(
+        const std::string& announce_url,
+        const std::string& info_hash,
+        const std::string& peer_id,
+        uint16_t port,
+        int64_t uploaded,
+        int64_t downloaded,
+        int64_t left,
+        const std::string& event = "",
+        std::chrono::seconds timeout = std::chrono::seconds::zero()
+    );
+
+    // Swarm counts for many torrents tracked by the same tracker, keyed by raw
+    // info hash, without announcing any of them. Hashes are sent in batches
+    // (MAX_HTTP_SCRAPE_HASHES per HTTP request, UdpTracker::MAX_SCRAPE_HASHES per
+    // UDP request). Torrents the tracker does not know are absent from the map;
+    // nullopt if the tracker cannot be scraped or every request failed.
+    static std::optional<std::unordered_map<std::string, ScrapeEntry>> scrape(
+        const std::string& announce_url,
+        const std::vector<std::string>& info_hashes
+    );
+
+    // Scrape URL for an HTTP announce URL by the usual convention (".../announce"
+    // becomes ".../scrape"); nullopt if the tracker does not support scraping.
+    static std::optional<std::string> getScrapeUrl(const std::string& announce_url);
+
+    // Keeps scrape URLs well below common 8 KB request-line limits
+    static constexpr size_t MAX_HTTP_SCRAPE_HASHES = 64;
+
+    // Upper bound for one HTTP announce (connect, request and response together)
+    static constexpr int ANNOUNCE_TIMEOUT_SECONDS = 20;
+
+    // Append the peers of a compact list (6 bytes per IPv4 peer, 18 per IPv6 peer).
+    static void parseCompactPeers(const uint8_t* data, size_t length, size_t entry_size, std::vector<PeerInfo>& out);
+
 private:
     static std::string buildTrackerUrl(
-        const TorrentMetadata& metadata,
+        const std::string& announce_url,
+        const std::string& info_hash,
         const std::string& peer_id,
         uint16_t port,
         int64_t uploaded,
         int64_t downloaded,
-        int64_t left
+        int64_t left,
+        const std::string& event
     );
 };
@@ -0,0 +1,225 @@
+#include "tracker_session.h"
+#include "../utils/logger.h"
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <thread>
+using namespace std;
+
+TrackerSession::Tier::Tier(boost::asio::io_context& io_context, std::vector<std::string> trackers)
+    : urls(std::move(trackers)),
+      strand(boost::asio::make_strand(io_context)),
+      timer(strand) {}
+
+TrackerSession::TrackerSession(boost::asio::io_context& io_context,
+                               ThreadPool& announcePool,
+                               const TorrentMetadata& metadata,
+                               std::string peer_id,
+                               uint16_t port,
+                               StatsProvider stats,
+                               PeersHandler onPeers)
+    : m_io_context(io_context),
+      m_announcePool(announcePool),
+      m_info_hash(metadata.getInfoHash()),
+      m_peer_id(std::move(peer_id)),
+      m_port(port),
+      m_stats(std::move(stats)),
+      m_onPeers(std::move(onPeers)) {
+    // BEP 12: trackers within a tier are shuffled once, then kept in success order
+    std::mt19937 gen{std::random_device{}()};
+    for (const auto& tier : metadata.getAnnounceTiers()) {
+        auto urls = tier;
+        std::shuffle(urls.begin(), urls.end(), gen);
+        m_tiers.push_back(std::make_unique<Tier>(io_context, std::move(urls)));
+    }
+}
+
+TrackerSession::~TrackerSession() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    for (auto& tier : m_tiers) {
+        tier->timer.cancel();
+    }
+}
+
+void TrackerSession::start() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) return;
+        m_running = true;
+    }
+    auto self = shared_from_this();
+    for (size_t i = 0; i < m_tiers.size(); i++) {
+        boost::asio::post(m_tiers[i]->strand, [self, i] { self->announce(i); });
+    }
+}
+
+void TrackerSession::completed() {
+    std::vector<size_t> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running || m_completed_sent) return;
+        m_completed_sent = true;
+        for (size_t i = 0; i < m_tiers.size(); i++) {
+            m_tiers[i]->completed_pending = true;
+            // A tier still retrying "started" sends "completed" right after it succeeds
+            if (m_tiers[i]->announced) {
+                ready.push_back(i);
+            }
+        }
+    }
+    auto self = shared_from_this();
+    for (size_t i : ready) {
+        boost::asio::post(m_tiers[i]->strand, [self, i] { self->announce(i); });
+    }
+}
+
+void TrackerSession::stop() {
+    Stats stats;
+    std::vector<std::pair<std::string, bool>> farewells;  // (tracker url, flush "completed")
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+        stats = m_stats();
+        for (auto& tier : m_tiers) {
+            tier->timer.cancel();
+            if (tier->announced) {
+                farewells.emplace_back(tier->urls.front(), tier->completed_pending);
+            }
+            tier->completed_pending = false;
+        }
+    }
+
+    // One thread per tier, each within STOP_TIMEOUT overall, so a dead tracker
+    // delays shutdown by seconds rather than by the full retry schedule
+    std::vector<std::thread> senders;
+    for (const auto& [url, flushCompleted] : farewells) {
+        senders.emplace_back([this, url = url, flushCompleted = flushCompleted, stats] {
+            const auto deadline = std::chrono::steady_clock::now() + STOP_TIMEOUT;
+            auto remaining = [&] {
+                auto left = std::chrono::duration_cast<std::chrono::seconds>(deadline - std::chrono::steady_clock::now());
+                return std::max(left, std::chrono::seconds(1));
+            };
+            // A download that just finished must still be counted as completed
+            if (flushCompleted) {
+                Tracker::announce(url, m_info_hash, m_peer_id, m_port, stats.uploaded, stats.downloaded, stats.left,
+                                  "completed", remaining());
+            }
+            // Best effort: let the tracker drop us from its swarm right away
+            Tracker::announce(url, m_info_hash, m_peer_id, m_port, stats.uploaded, stats.downloaded, stats.left,
+                              "stopped", remaining());
+        });
+    }
+    for (auto& sender : senders) {
+        sender.join();
+    }
+}
+
+int64_t TrackerSession::getInterval() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int64_t interval = DEFAULT_INTERVAL;
+    for (const auto& tier : m_tiers) {
+        interval = std::min(interval, tier->interval);
+    }
+    return interval;
+}
+
+void TrackerSession::announce(size_t tier_idx) {
+    Tier& tier = *m_tiers[tier_idx];
+    Stats stats;
+    std::vector<std::string> urls;
+    std::string event;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A busy tier picks up anything queued meanwhile once its announce returns
+        if (!m_running || tier.busy) return;
+        event = !tier.announced ? "started" : tier.completed_pending ? "completed" : "";
+        // Regular re-announces never go faster than the tracker's min interval
+        auto sinceLast = std::chrono::steady_clock::now() - tier.last_announce;
+        if (event.empty() && sinceLast < std::chrono::seconds(tier.min_interval)) {
+            scheduleNext(tier_idx, std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::seconds(tier.min_interval) - sinceLast));
+            return;
+        }
+        stats = m_stats();
+        urls = tier.urls;
+        tier.last_announce = std::chrono::steady_clock::now();
+        tier.busy = true;
+    }
+    auto self = shared_from_this();
+    m_announcePool.post([self, tier_idx, stats, urls = std::move(urls), event = std::move(event)] {
+        self->exchange(tier_idx, stats, urls, event);
+    });
+}
+
+void TrackerSession::exchange(size_t tier_idx, const Stats& stats, const std::vector<std::string>& urls,
+                              const std::string& event) {
+    Tier& tier = *m_tiers[tier_idx];
+    {
+        // Stopped while queued behind other announces
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+    }
+
+    // BEP 12: try the tier's trackers in order; the first one that answers wins
+    std::optional<Tracker::TrackerResponse> response;
+    size_t answered = 0;
+    for (; answered < urls.size() && !response; answered++) {
+        response = Tracker::announce(urls[answered], m_info_hash, m_peer_id, m_port,
+                                     stats.uploaded, stats.downloaded, stats.left, event);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    tier.busy = false;
+    if (!m_running) return;
+    if (!response) {
+        // Back off, but keep trying; a flaky tier must not end the download
+        BT_LOG_WARN("Announce to tier " << tier_idx << " failed, retrying in " << tier.retry_delay << "s");
+        scheduleNext(tier_idx, std::chrono::seconds(tier.retry_delay));
+        tier.retry_delay = std::min(tier.retry_delay * 2, MAX_RETRY_DELAY);
+        return;
+    }
+    // Move the responding tracker to the front of its tier
+    auto winner = std::find(tier.urls.begin(), tier.urls.end(), urls[answered - 1]);
+    if (winner != tier.urls.end()) {
+        std::rotate(tier.urls.begin(), winner, winner + 1);
+    }
+    if (event == "started") {
+        tier.announced = true;
+    } else if (event == "completed") {
+        tier.completed_pending = false;
+    }
+    tier.retry_delay = MIN_RETRY_DELAY;
+    tier.interval = response->interval > 0 ? response->interval : DEFAULT_INTERVAL;
+    tier.min_interval = std::max<int64_t>(response->min_interval, 0);
+
+    // Merge with what other tiers already returned; only new endpoints go out
+    std::vector<Tracker::PeerInfo> fresh;
+    for (const auto& peer : response->peers) {
+        if (m_seen_peers.insert(peer.endpoint)) {
+            fresh.push_back(peer);
+        }
+    }
+    if (!fresh.empty()) {
+        m_onPeers(fresh);
+    }
+    if (tier.completed_pending) {
+        // completed() came in while "started" or a re-announce was in flight
+        scheduleNext(tier_idx, std::chrono::seconds(0));
+        return;
+    }
+    scheduleNext(tier_idx, std::chrono::seconds(std::max(tier.interval, tier.min_interval)));
+}
+
+// Callers hold m_mutex, which also serializes every use of the tier timers.
+void TrackerSession::scheduleNext(size_t tier_idx, std::chrono::seconds delay) {
+    auto self = shared_from_this();
+    Tier& tier = *m_tiers[tier_idx];
+    tier.timer.expires_after(delay);
+    tier.timer.async_wait([self, tier_idx](const boost::system::error_code& ec) {
+        if (!ec) {
+            self->announce(tier_idx);
+        }
+    });
+}
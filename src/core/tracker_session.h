@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <boost/asio.hpp>
+#include "torrent.h"
+#include "tracker.h"
+#include "thread_pool.h"
+
+// Keeps one torrent announced to its trackers for the lifetime of a download.
+// Every tier of the announce-list (BEP 12) is announced independently: the
+// schedules run as timers on the shared event loop, and the blocking tracker
+// exchanges run on `announcePool`, so a slow or dead tracker never holds a loop
+// thread and never holds up the other tiers. How many tiers announce at once is
+// bounded by the pool's thread count. Within a tier, trackers are tried in order and the one
+// that answers moves to the front. Each tier sends "started" on start(),
+// re-announces every `interval` seconds (never sooner than `min interval`),
+// "completed" once and "stopped" on shutdown. Peers from all tiers are merged
+// and deduplicated before being handed to the peers handler, normally
+// DownloadManager::addPeers.
+//
+// Create with std::make_shared: queued handlers keep the session alive, and
+// after stop() they neither announce nor call back into the download.
+class TrackerSession : public std::enable_shared_from_this<TrackerSession> {
+public:
+    struct Stats {
+        int64_t uploaded = 0;
+        int64_t downloaded = 0;
+        int64_t left = 0;
+    };
+    using StatsProvider = std::function<Stats()>;
+    using PeersHandler = std::function<void(const std::vector<Tracker::PeerInfo>&)>;
+
+    // `announcePool` must outlive the session's queued announces; its owner
+    // destroys it (joining them) before the io_context.
+    TrackerSession(boost::asio::io_context& io_context,
+                   ThreadPool& announcePool,
+                   const TorrentMetadata& metadata,
+                   std::string peer_id,
+                   uint16_t port,
+                   StatsProvider stats,
+                   PeersHandler onPeers);
+    ~TrackerSession();
+
+    // Announce "started" to every tier now and keep re-announcing on each tier's schedule.
+    void start();
+
+    // Announce "completed" right away (only the first call has an effect).
+    void completed();
+
+    // Cancel the schedules and send a best-effort "stopped" to every tier that knows us.
+    // Blocks for at most about STOP_TIMEOUT: the tiers are told in parallel.
+    void stop();
+
+    // Smallest re-announce interval currently requested by any tier, in seconds.
+    int64_t getInterval() const;
+
+private:
+    static constexpr int64_t DEFAULT_INTERVAL = 1800;  // Used when the tracker gives none
+    static constexpr int64_t MIN_RETRY_DELAY = 15;     // First retry after a failed announce
+    static constexpr int64_t MAX_RETRY_DELAY = 900;
+    static constexpr auto STOP_TIMEOUT = std::chrono::seconds(5);  // "completed" + "stopped" per tier
+
+    // Schedule and failover state of one announce-list tier. A tier has at most
+    // one announce in flight; different tiers run concurrently.
+    struct Tier {
+        Tier(boost::asio::io_context& io_context, std::vector<std::string> trackers);
+
+        std::vector<std::string> urls;  // Preferred tracker first
+        boost::asio::strand<boost::asio::io_context::executor_type> strand;
+        boost::asio::steady_timer timer;
+        int64_t interval = DEFAULT_INTERVAL;
+        int64_t min_interval = 0;
+        int64_t retry_delay = MIN_RETRY_DELAY;
+        std::chrono::steady_clock::time_point last_announce{};
+        bool announced = false;          // A tracker in this tier has accepted "started"
+        bool completed_pending = false;  // Not yet accepted by this tier; stop() flushes it
+        bool busy = false;               // An announce is running on the pool
+    };
+
+    // Announce the tier's outstanding event: "started" until a tracker in the tier
+    // has accepted it, then a queued "completed", otherwise a regular re-announce.
+    // An event is only cleared once a tracker answers, so retries resend it.
+    // Hands the exchange to the announce pool; a no-op while one is in flight.
+    void announce(size_t tier_idx);
+    // Pool side: try the tier's trackers in order and apply the answer.
+    void exchange(size_t tier_idx, const Stats& stats, const std::vector<std::string>& urls, const std::string& event);
+    void scheduleNext(size_t tier_idx, std::chrono::seconds delay);
+
+    boost::asio::io_context& m_io_context;
+    ThreadPool& m_announcePool;
+    std::string m_info_hash;  // Copied: pool jobs may outlive the caller's metadata
+    std::string m_peer_id;
+    uint16_t m_port;
+    StatsProvider m_stats;
+    PeersHandler m_onPeers;
+    std::vector<std::unique_ptr<Tier>> m_tiers;
+
+    // Guards all tier state and the peer set, and is held while calling m_stats /
+    // m_onPeers so that once stop() returns no callback is running or will run.
+    mutable std::mutex m_mutex;
+    PeerEndpointSet m_seen_peers;  // Endpoints already handed out
+    bool m_running = false;
+    bool m_completed_sent = false;
+};
@@ -0,0 +1,291 @@
+#include "udp_tracker.h"
+#include "../utils/error.h"
+#include "../utils/logger.h"
+#include <iostream>
+#include <regex>
+#include <random>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+using namespace std;
+namespace net = boost::asio;
+using udp = net::ip::udp;
+
+namespace {
+
+constexpr uint64_t PROTOCOL_ID = 0x41727101980ULL;
+constexpr uint32_t ACTION_CONNECT = 0;
+constexpr uint32_t ACTION_ANNOUNCE = 1;
+constexpr uint32_t ACTION_SCRAPE = 2;
+constexpr uint32_t ACTION_ERROR = 3;
+
+// A connection id may be reused for one minute after it was received
+constexpr auto CONNECTION_ID_TTL = std::chrono::seconds(60);
+
+struct CachedConnection {
+    uint64_t id;
+    std::chrono::steady_clock::time_point expires;
+};
+
+std::mutex g_connection_mutex;
+std::unordered_map<std::string, CachedConnection> g_connections;  // "host:port" -> id
+
+void putU32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+void putU64(std::vector<uint8_t>& out, uint64_t v) {
+    for (int shift = 56; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+uint32_t getU32(const std::vector<uint8_t>& in, size_t pos) {
+    return (uint32_t(in[pos]) << 24) | (uint32_t(in[pos + 1]) << 16) |
+           (uint32_t(in[pos + 2]) << 8) | uint32_t(in[pos + 3]);
+}
+
+uint64_t getU64(const std::vector<uint8_t>& in, size_t pos) {
+    return (uint64_t(getU32(in, pos)) << 32) | getU32(in, pos + 4);
+}
+
+uint32_t randomU32() {
+    static thread_local std::mt19937 gen{std::random_device{}()};
+    return gen();
+}
+
+uint32_t eventCode(const std::string& event) {
+    if (event == "completed") return 1;
+    if (event == "started") return 2;
+    if (event == "stopped") return 3;
+    return 0;
+}
+
+// One tracker endpoint plus a socket; performs request/response exchanges with timeouts.
+class UdpExchange {
+public:
+    static constexpr auto NO_LIMIT = std::chrono::steady_clock::time_point::max();
+
+    explicit UdpExchange(const std::string& url) : m_socket(m_io_context) {
+        std::regex url_regex(R"(^udp://([^/:]+):(\d+)(/.*)?$)", std::regex::icase);
+        std::smatch match;
+        if (!std::regex_match(url, match, url_regex)) {
+            throw std::invalid_argument("Invalid UDP tracker URL: " + url);
+        }
+        m_key = match[1].str() + ":" + match[2].str();
+        udp::resolver resolver(m_io_context);
+        m_endpoint = *resolver.resolve(match[1].str(), match[2].str()).begin();
+        m_socket.open(m_endpoint.protocol());
+    }
+
+    // Sends `request` and waits for a response echoing `transaction_id`, retransmitting
+    // with the BEP 15 backoff but never past `limit`. Throws NetworkError on a tracker
+    // error response.
+    std::optional<std::vector<uint8_t>> transact(const std::vector<uint8_t>& request, uint32_t transaction_id,
+                                                 int attempt,
+                                                 std::chrono::steady_clock::time_point limit = NO_LIMIT) {
+        m_socket.send_to(net::buffer(request), m_endpoint);
+        auto timeout = std::chrono::seconds(UdpTracker::BASE_TIMEOUT_SECONDS << attempt);
+        auto deadline = std::min(std::chrono::steady_clock::now() + timeout, limit);
+
+        while (std::chrono::steady_clock::now() < deadline) {
+            auto response = receive(deadline);
+            if (!response) {
+                return std::nullopt;
+            }
+            // Ignore stray or short datagrams (e.g. answers to an earlier retransmit)
+            if (response->size() < 8 || getU32(*response, 4) != transaction_id) {
+                continue;
+            }
+            if (getU32(*response, 0) == ACTION_ERROR) {
+                throw BitTorrent::NetworkError("UDP tracker error: " +
+                                               std::string(response->begin() + 8, response->end()));
+            }
+            return response;
+        }
+        return std::nullopt;
+    }
+
+    // Connection id for this tracker, from the cache or via a connect exchange.
+    std::optional<uint64_t> connectionId(int attempt, std::chrono::steady_clock::time_point limit = NO_LIMIT) {
+        {
+            std::lock_guard<std::mutex> lock(g_connection_mutex);
+            auto it = g_connections.find(m_key);
+            if (it != g_connections.end() && it->second.expires > std::chrono::steady_clock::now()) {
+                return it->second.id;
+            }
+        }
+        uint32_t transaction_id = randomU32();
+        std::vector<uint8_t> request;
+        putU64(request, PROTOCOL_ID);
+        putU32(request, ACTION_CONNECT);
+        putU32(request, transaction_id);
+
+        auto response = transact(request, transaction_id, attempt, limit);
+        if (!response || response->size() < 16 || getU32(*response, 0) != ACTION_CONNECT) {
+            return std::nullopt;
+        }
+        uint64_t id = getU64(*response, 8);
+        std::lock_guard<std::mutex> lock(g_connection_mutex);
+        g_connections[m_key] = {id, std::chrono::steady_clock::now() + CONNECTION_ID_TTL};
+        return id;
+    }
+
+    bool isV6() const { return m_endpoint.address().is_v6(); }
+
+    void forgetConnection() {
+        std::lock_guard<std::mutex> lock(g_connection_mutex);
+        g_connections.erase(m_key);
+    }
+
+private:
+    std::optional<std::vector<uint8_t>> receive(std::chrono::steady_clock::time_point deadline) {
+        std::vector<uint8_t> buffer(2048);
+        udp::endpoint sender;
+        boost::system::error_code ec = net::error::would_block;
+        size_t bytes = 0;
+        m_socket.async_receive_from(net::buffer(buffer), sender,
+            [&](const boost::system::error_code& result, size_t n) { ec = result; bytes = n; });
+
+        m_io_context.restart();
+        m_io_context.run_until(deadline);
+        if (ec == net::error::would_block) {
+            // Timed out: cancel and let the aborted handler run before `buffer` goes away
+            m_socket.cancel();
+            m_io_context.restart();
+            m_io_context.run();
+            return std::nullopt;
+        }
+        if (ec) {
+            return std::nullopt;
+        }
+        buffer.resize(bytes);
+        return buffer;
+    }
+
+    net::io_context m_io_context;
+    udp::socket m_socket;
+    udp::endpoint m_endpoint;
+    std::string m_key;
+};
+
+} // namespace
+
+std::optional<Tracker::TrackerResponse> UdpTracker::announce(
+    const std::string& url,
+    const std::string& info_hash,
+    const std::string& peer_id,
+    uint16_t port,
+    int64_t uploaded,
+    int64_t downloaded,
+    int64_t left,
+    const std::string& event,
+    std::chrono::seconds timeout)
+{
+    const auto limit = timeout > std::chrono::seconds::zero() ? std::chrono::steady_clock::now() + timeout
+                                                              : UdpExchange::NO_LIMIT;
+    try {
+        UdpExchange exchange(url);
+        uint32_t key = randomU32();
+
+        for (int attempt = 0; attempt <= MAX_RETRIES && std::chrono::steady_clock::now() < limit; attempt++) {
+            auto connection_id = exchange.connectionId(attempt, limit);
+            if (!connection_id) {
+                continue;
+            }
+            uint32_t transaction_id = randomU32();
+            std::vector<uint8_t> request;
+            request.reserve(98);
+            putU64(request, *connection_id);
+            putU32(request, ACTION_ANNOUNCE);
+            putU32(request, transaction_id);
+            request.insert(request.end(), info_hash.begin(), info_hash.end());
+            request.insert(request.end(), peer_id.begin(), peer_id.end());
+            putU64(request, static_cast<uint64_t>(downloaded));
+            putU64(request, static_cast<uint64_t>(left));
+            putU64(request, static_cast<uint64_t>(uploaded));
+            putU32(request, eventCode(event));
+            putU32(request, 0);            // IP address: use the sender's
+            putU32(request, key);
+            putU32(request, 0xFFFFFFFF);   // num_want: tracker default
+            request.push_back(static_cast<uint8_t>(port >> 8));
+            request.push_back(static_cast<uint8_t>(port & 0xFF));
+
+            auto response = exchange.transact(request, transaction_id, attempt, limit);
+            if (!response) {
+                // The connection id may have expired on the tracker side
+                exchange.forgetConnection();
+                continue;
+            }
+            if (response->size() < 20 || getU32(*response, 0) != ACTION_ANNOUNCE) {
+                throw BitTorrent::NetworkError("Malformed UDP announce response");
+            }
+
+            Tracker::TrackerResponse result;
+            result.interval = getU32(*response, 8);
+            result.incomplete = getU32(*response, 12);
+            result.complete = getU32(*response, 16);
+            // Trackers reached over IPv6 answer with 18-byte IPv6 peers
+            size_t entry_size = exchange.isV6() ? PeerEndpoint::V6_SIZE : PeerEndpoint::V4_SIZE;
+            Tracker::parseCompactPeers(response->data() + 20, response->size() - 20, entry_size, result.peers);
+            return result;
+        }
+        BT_LOG_WARN("UDP tracker did not respond: " << url);
+        return std::nullopt;
+    }
+    catch (const std::exception& e) {
+        BT_LOG_WARN("UDP tracker request failed: " << e.what());
+        return std::nullopt;
+    }
+}
+
+std::optional<std::vector<UdpTracker::ScrapeEntry>> UdpTracker::scrape(
+    const std::string& url,
+    const std::vector<std::string>& info_hashes)
+{
+    if (info_hashes.empty() || info_hashes.size() > MAX_SCRAPE_HASHES) {
+        BT_LOG_WARN("UDP scrape needs 1.." << MAX_SCRAPE_HASHES << " info hashes");
+        return std::nullopt;
+    }
+    try {
+        UdpExchange exchange(url);
+        for (int attempt = 0; attempt <= MAX_RETRIES; attempt++) {
+            auto connection_id = exchange.connectionId(attempt);
+            if (!connection_id) {
+                continue;
+            }
+            uint32_t transaction_id = randomU32();
+            std::vector<uint8_t> request;
+            request.reserve(16 + 20 * info_hashes.size());
+            putU64(request, *connection_id);
+            putU32(request, ACTION_SCRAPE);
+            putU32(request, transaction_id);
+            for (const auto& hash : info_hashes) {
+                request.insert(request.end(), hash.begin(), hash.end());
+            }
+
+            auto response = exchange.transact(request, transaction_id, attempt);
+            if (!response) {
+                exchange.forgetConnection();
+                continue;
+            }
+            if (getU32(*response, 0) != ACTION_SCRAPE || response->size() < 8 + 12 * info_hashes.size()) {
+                throw BitTorrent::NetworkError("Malformed UDP scrape response");
+            }
+            std::vector<ScrapeEntry> entries(info_hashes.size());
+            for (size_t i = 0; i < entries.size(); i++) {
+                size_t pos = 8 + 12 * i;
+                entries[i].seeders = getU32(*response, pos);
+                entries[i].completed = getU32(*response, pos + 4);
+                entries[i].leechers = getU32(*response, pos + 8);
+            }
+            return entries;
+        }
+        BT_LOG_WARN("UDP tracker did not respond: " << url);
+        return std::nullopt;
+    }
+    catch (const std::exception& e) {
+        BT_LOG_WARN("UDP tracker request failed: " << e.what());
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <chrono>
+#include "tracker.h"
+
+// Client side of the UDP tracker protocol (BEP 15).
+// Each exchange is one small datagram each way: connect (cached per tracker
+// for a minute), then announce or scrape. Lost datagrams are retransmitted
+// with the spec's 15 * 2^n second timeout, up to MAX_RETRIES times.
+class UdpTracker {
+public:
+    using ScrapeEntry = Tracker::ScrapeEntry;
+
+    // A non-zero `timeout` caps the whole exchange, retransmits included.
+    static std::optional<Tracker::TrackerResponse> announce(
+        const std::string& url,
+        const std::string& info_hash,
+        const std::string& peer_id,
+        uint16_t port,
+        int64_t uploaded,
+        int64_t downloaded,
+        int64_t left,
+        const std::string& event,
+        std::chrono::seconds timeout = std::chrono::seconds::zero()
+    );
+
+    // One entry per info hash, in request order. At most MAX_SCRAPE_HASHES per call.
+    static std::optional<std::vector<ScrapeEntry>> scrape(
+        const std::string& url,
+        const std::vector<std::string>& info_hashes
+    );
+
+    static constexpr size_t MAX_SCRAPE_HASHES = 74;  // Keeps the request inside one datagram
+    static constexpr int MAX_RETRIES = 3;            // 15s + 30s + 60s + 120s worst case
+    static constexpr int BASE_TIMEOUT_SECONDS = 15;
+};
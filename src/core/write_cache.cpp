@@ -0,0 +1,190 @@
+#include "write_cache.h"
+#include "metrics.h"
+#include "../utils/logger.h"
+#include <algorithm>
+#include <cstring>
+#include <span>
+using namespace std;
+
+namespace {
+auto& g_registry = Metrics::Registry::global();
+Metrics::Gauge& g_cachedBytes = g_registry.gauge(
+    "bt_write_cache_bytes", "Verified piece bytes waiting in write-back caches");
+Metrics::Counter& g_stalls = g_registry.counter(
+    "bt_write_cache_stalls_total", "Pieces that waited for room in a full write-back cache");
+}
+
+WriteCache::WriteCache(const TorrentMetadata* metadata, std::string rootDir, Options options)
+    : m_storage(metadata, std::move(rootDir)), m_options(options) {
+    m_thread = std::thread(&WriteCache::run, this);
+}
+
+WriteCache::~WriteCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work.notify_all();
+    m_thread.join();
+}
+
+bool WriteCache::put(int piece_idx, std::vector<uint8_t> data) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_failed) {
+        return false;
+    }
+    if (m_pieces.count(piece_idx)) {
+        return true;  // Already cached; its bytes are the same
+    }
+    const size_t size = data.size();
+    // An empty cache always takes a piece, however large, so an oversized one cannot deadlock
+    auto hasRoom = [&] { return m_failed || m_bytes == 0 || m_bytes + size <= m_options.capacity; };
+    if (!hasRoom()) {
+        g_stalls.add();
+        m_work.notify_one();
+        m_space.wait(lock, hasRoom);
+        if (m_failed) {
+            return false;
+        }
+    }
+    m_pieces.emplace(piece_idx, Entry{std::move(data), Clock::now()});
+    m_bytes += size;
+    g_cachedBytes.add(static_cast<int64_t>(size));
+    m_work.notify_one();
+    return true;
+}
+
+bool WriteCache::read(int piece_idx, size_t begin, uint8_t* data, size_t length) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_pieces.find(piece_idx);
+        if (it != m_pieces.end()) {
+            const auto& piece = it->second.data;
+            if (begin + length > piece.size()) {
+                return false;
+            }
+            std::memcpy(data, piece.data() + begin, length);
+            return true;
+        }
+    }
+    // Pieces leave the cache only once written, so a miss is on disk
+    std::lock_guard<std::mutex> lock(m_storageMutex);
+    return m_storage.readBlock(piece_idx, begin, data, length);
+}
+
+bool WriteCache::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_flushWaiters++;
+    m_work.notify_one();
+    m_space.wait(lock, [&] { return m_pieces.empty(); });
+    m_flushWaiters--;
+    return !m_failed;
+}
+
+bool WriteCache::finalize() {
+    if (!flush()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_storageMutex);
+    return m_storage.finalize();
+}
+
+void WriteCache::setFileSkipped(size_t file_index, bool skipped) {
+    std::lock_guard<std::mutex> lock(m_storageMutex);
+    m_storage.setFileSkipped(file_index, skipped);
+}
+
+std::string WriteCache::getOutputPath() const {
+    return m_storage.getOutputPath();
+}
+
+size_t WriteCache::cachedBytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+bool WriteCache::failed() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failed;
+}
+
+std::pair<int, size_t> WriteCache::pickRun(bool drain, Clock::time_point now, Clock::time_point& wakeAt) const {
+    int bestFirst = -1;
+    size_t bestCount = 0;
+    size_t bestBytes = 0;
+    auto it = m_pieces.begin();
+    while (it != m_pieces.end()) {
+        if (it->second.writing) {
+            ++it;
+            continue;
+        }
+        // Extend the run while the next cached piece is the next index
+        const int first = it->first;
+        size_t count = 0;
+        size_t bytes = 0;
+        Clock::time_point oldest = Clock::time_point::max();
+        for (; it != m_pieces.end() && !it->second.writing && it->first == first + static_cast<int>(count); ++it) {
+            count++;
+            bytes += it->second.data.size();
+            oldest = std::min(oldest, it->second.added);
+        }
+        const bool due = drain || bytes >= m_options.flush_bytes || now - oldest >= m_options.max_age;
+        if (!due) {
+            wakeAt = std::min(wakeAt, oldest + m_options.max_age);
+        } else if (bytes > bestBytes) {
+            bestFirst = first;
+            bestCount = count;
+            bestBytes = bytes;
+        }
+    }
+    return {bestFirst, bestCount};
+}
+
+void WriteCache::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        // Past the high-water mark the longest run goes out whatever its length
+        const bool drain = m_stopping || m_flushWaiters > 0 || m_bytes >= m_options.capacity / 4 * 3;
+        auto wakeAt = Clock::time_point::max();
+        auto [first, count] = pickRun(drain, Clock::now(), wakeAt);
+        if (count == 0) {
+            if (m_stopping && m_pieces.empty()) {
+                break;
+            }
+            if (wakeAt == Clock::time_point::max()) {
+                m_work.wait(lock);
+            } else {
+                m_work.wait_until(lock, wakeAt);
+            }
+            continue;
+        }
+
+        // Entries stay in the map (and readable) until their bytes are on disk
+        std::vector<std::span<const uint8_t>> batch;
+        batch.reserve(count);
+        size_t bytes = 0;
+        for (auto it = m_pieces.find(first); batch.size() < count; ++it) {
+            it->second.writing = true;
+            batch.emplace_back(it->second.data);
+            bytes += it->second.data.size();
+        }
+        lock.unlock();
+        bool ok;
+        {
+            std::lock_guard<std::mutex> storageLock(m_storageMutex);
+            ok = m_storage.writePieces(first, batch);
+        }
+        lock.lock();
+
+        if (!ok && !m_failed) {
+            BT_LOG_ERROR("Write-back of pieces " << first << "-" << first + static_cast<int>(count) - 1
+                         << " failed; later pieces are dropped");
+            m_failed = true;
+        }
+        auto begin = m_pieces.find(first);
+        m_pieces.erase(begin, std::next(begin, static_cast<ptrdiff_t>(count)));
+        m_bytes -= bytes;
+        g_cachedBytes.add(-static_cast<int64_t>(bytes));
+        m_space.notify_all();
+    }
+}
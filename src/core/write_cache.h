@@ -0,0 +1,85 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "storage.h"
+#include "torrent.h"
+
+// Bounded write-back cache between the piece workers and Storage. Verified
+// pieces are parked in memory and a dedicated disk thread writes runs of
+// adjacent pieces with one pwritev batch each, so the disk sees a steady stream
+// of large sequential writes rather than a burst at the end or a small write
+// per piece.
+//
+// A run is written once it reaches `flush_bytes`, once its oldest piece has
+// waited `max_age`, or as soon as the cache is three quarters full. When the
+// cache is full put() blocks, which holds the calling worker off the network
+// until the disk catches up.
+class WriteCache {
+public:
+    struct Options {
+        size_t capacity = 64 << 20;               // Bytes of pieces held before put() blocks
+        size_t flush_bytes = 4 << 20;             // A run of adjacent pieces this long is written at once
+        std::chrono::milliseconds max_age{1000};  // Shorter runs are written once this old
+    };
+
+    // Files land under rootDir exactly as with Storage.
+    WriteCache(const TorrentMetadata* metadata, std::string rootDir, Options options);
+    // Writes whatever is still cached, then joins the disk thread.
+    ~WriteCache();
+
+    WriteCache(const WriteCache&) = delete;
+    WriteCache& operator=(const WriteCache&) = delete;
+
+    // Hand over one verified piece, blocking while the cache is full. Returns
+    // false once any write has failed; the piece is dropped in that case.
+    bool put(int piece_idx, std::vector<uint8_t> data);
+
+    // Copy bytes of a piece that was put() earlier, from memory if it is still
+    // cached and from disk otherwise.
+    bool read(int piece_idx, size_t begin, uint8_t* data, size_t length);
+
+    // Blocks until everything put() so far is on disk; false if a write failed.
+    bool flush();
+    // flush(), then let Storage create empty files and close everything.
+    bool finalize();
+
+    void setFileSkipped(size_t file_index, bool skipped);
+    std::string getOutputPath() const;
+    size_t cachedBytes() const;
+    bool failed() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::vector<uint8_t> data;
+        Clock::time_point added;
+        bool writing = false;  // Taken by the disk thread; still readable
+    };
+
+    void run();
+    // Next run of adjacent pieces to write, as (first piece, count); count is 0
+    // if none is due yet, with `wakeAt` set to when one will be (caller holds m_mutex).
+    std::pair<int, size_t> pickRun(bool drain, Clock::time_point now, Clock::time_point& wakeAt) const;
+
+    Storage m_storage;
+    std::mutex m_storageMutex;  // Storage is single-threaded; readers share it with the disk thread
+    Options m_options;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_work;   // Wakes the disk thread
+    std::condition_variable m_space;  // Wakes put() and flush() as pieces leave the cache
+    std::map<int, Entry> m_pieces;    // By piece index, so adjacent pieces are neighbours
+    size_t m_bytes = 0;
+    int m_flushWaiters = 0;           // Write everything regardless of run length while > 0
+    bool m_stopping = false;
+    bool m_failed = false;
+    std::thread m_thread;
+};
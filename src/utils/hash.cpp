@@ -86,14 +86,6 @@ std::string HashUtils::urlEncode(const std::string& hex_string) {
     return result;
 }
 
-std::vector<std::string> HashUtils::splitPieceHashes(const std::string& pieces) {
-    std::vector<std::string> hashes;
-    for (size_t i = 0; i < pieces.length(); i += 20) {
-        hashes.push_back(pieces.substr(i, 20));
-    }
-    return hashes;
-} 
-
 std::pair<bool,std::string> HashUtils::verifyHandshakeResponse(const std::array<unsigned char, 68> response, const std::string& info_hash) {
     if (response.size() < 68) {
         return {false,""};
@@ -14,9 +14,6 @@ public:
     static std::pair<bool, std::string> verifyHandshakeResponse(const std::array<unsigned char, 68> response, const std::string& info_hash);
 
     
-    // Helper method to split piece hashes
-    static std::vector<std::string> splitPieceHashes(const std::string& pieces);
-    
 private:
     static constexpr std::array<char, 16> HEX_CHARS = {
         '0', '1', '2', '3', '4', '5', '6', '7',
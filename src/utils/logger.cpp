@@ -0,0 +1,290 @@
+#include "logger.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+std::atomic<int> Logger::s_level{static_cast<int>(LogLevel::Info)};
+
+namespace {
+
+// Level named by BT_LOG_LEVEL, or Info.
+LogLevel environmentLevel() {
+    if (const char* env = std::getenv("BT_LOG_LEVEL")) {
+        static const std::pair<const char*, LogLevel> names[] = {
+            {"trace", LogLevel::Trace}, {"debug", LogLevel::Debug}, {"info", LogLevel::Info},
+            {"warn", LogLevel::Warn}, {"error", LogLevel::Error}};
+        for (const auto& [name, level] : names) {
+            if (std::strcmp(env, name) == 0) return level;
+        }
+    }
+    return LogLevel::Info;
+}
+
+// Applied during static initialization, so the level holds from process start
+// rather than from the first line that reaches the writer. s_level itself is
+// constant-initialized, so anything logged before this runs still sees Info.
+const bool g_environmentLevelApplied = (Logger::setLevel(environmentLevel()), true);
+
+struct Record {
+    LogLevel level = LogLevel::Info;
+    Logger::Stream stream = Logger::Stream::Out;
+    bool raw = false;  // Already formatted by the caller
+    std::chrono::system_clock::time_point when;
+    std::string text;
+};
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Trace: return "TRACE";
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO ";
+    case LogLevel::Warn: return "WARN ";
+    case LogLevel::Error: return "ERROR";
+    }
+    return "?";
+}
+
+void formatRecord(const Record& record, std::string& out) {
+    if (record.raw) {
+        out += record.text;
+        out += '\n';
+        return;
+    }
+    auto time = std::chrono::system_clock::to_time_t(record.when);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+        record.when.time_since_epoch()).count() % 1000;
+    std::tm local{};
+    localtime_r(&time, &local);
+    char stamp[32];
+    size_t n = std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &local);
+    std::snprintf(stamp + n, sizeof(stamp) - n, ".%03d", static_cast<int>(millis));
+    out += '[';
+    out += stamp;
+    out += "] ";
+    out += levelName(record.level);
+    out += ' ';
+    out += record.text;
+    out += '\n';
+}
+
+// Bounded multi-producer ring (Vyukov): each slot carries a sequence number
+// saying whose turn it is, so producers claim slots with one CAS on m_head and
+// the single consumer needs no atomics beyond the slot sequence.
+class LogRing {
+public:
+    LogRing() : m_slots(std::make_unique<Slot[]>(Logger::CAPACITY)) {
+        for (size_t i = 0; i < Logger::CAPACITY; i++) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(Record&& record) {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = m_slots[pos & MASK];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.record = std::move(record);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // Full
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side only.
+    bool pop(Record& record) {
+        Slot& slot = m_slots[m_tail & MASK];
+        if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1) {
+            return false;
+        }
+        record = std::move(slot.record);
+        slot.sequence.store(m_tail + Logger::CAPACITY, std::memory_order_release);
+        m_tail++;
+        return true;
+    }
+
+private:
+    static constexpr size_t MASK = Logger::CAPACITY - 1;
+    static_assert((Logger::CAPACITY & MASK) == 0, "capacity must be a power of two");
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) size_t m_tail = 0;
+};
+
+// The ring plus its writer thread. Never destroyed: it is drained and stopped
+// from an atexit handler, after which logging falls back to direct writes.
+class AsyncWriter {
+public:
+    static AsyncWriter& instance() {
+        static AsyncWriter* writer = [] {
+            auto* w = new AsyncWriter();
+            std::atexit([] { instance().stop(); });
+            return w;
+        }();
+        return *writer;
+    }
+
+    void submit(Record&& record) {
+        if (m_stopped.load(std::memory_order_acquire)) {
+            writeDirect(record);
+            return;
+        }
+        if (!m_ring.push(std::move(record))) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_queued.fetch_add(1, std::memory_order_release);
+        m_queued.notify_one();
+    }
+
+    void flush() {
+        if (m_stopped.load(std::memory_order_acquire) || std::this_thread::get_id() == m_thread.get_id()) {
+            return;
+        }
+        uint64_t target = m_queued.load(std::memory_order_acquire);
+        for (uint64_t written = m_written.load(std::memory_order_acquire); written < target;
+             written = m_written.load(std::memory_order_acquire)) {
+            m_written.wait(written);
+        }
+    }
+
+    void setHooks(std::function<void()> before, std::function<void()> after) {
+        std::lock_guard<std::mutex> lock(m_hookMutex);
+        m_beforeWrite = std::move(before);
+        m_afterWrite = std::move(after);
+    }
+
+    void stop() {
+        if (m_stopped.exchange(true)) {
+            return;
+        }
+        m_stopping.store(true, std::memory_order_release);
+        m_queued.fetch_add(1, std::memory_order_release);  // Wake the writer
+        m_queued.notify_one();
+        m_thread.join();
+    }
+
+private:
+    AsyncWriter() {
+        m_thread = std::thread([this] { run(); });
+    }
+
+    void run() {
+        uint64_t seen = 0;
+        std::string out, err;
+        for (;;) {
+            m_queued.wait(seen, std::memory_order_acquire);
+            seen = m_queued.load(std::memory_order_acquire);
+
+            uint64_t drained = 0;
+            Record record;
+            while (m_ring.pop(record)) {
+                formatRecord(record, record.stream == Logger::Stream::Err ? err : out);
+                drained++;
+            }
+            if (uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed)) {
+                err += "[logger] " + std::to_string(dropped) + " lines dropped (queue full)\n";
+            }
+            // One write per stream per batch
+            if (!out.empty() || !err.empty()) {
+                std::lock_guard<std::mutex> lock(m_hookMutex);
+                if (m_beforeWrite) m_beforeWrite();
+                if (!out.empty()) {
+                    std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+                    std::cout.flush();
+                    out.clear();
+                }
+                if (!err.empty()) {
+                    std::cerr.write(err.data(), static_cast<std::streamsize>(err.size()));
+                    err.clear();
+                }
+                if (m_afterWrite) m_afterWrite();
+            }
+            m_written.fetch_add(drained, std::memory_order_release);
+            m_written.notify_all();
+
+            if (m_stopping.load(std::memory_order_acquire)) {
+                // Producers racing with stop() may still land a line; take it too
+                while (m_ring.pop(record)) {
+                    writeDirect(record);
+                }
+                return;
+            }
+        }
+    }
+
+    static void writeDirect(const Record& record) {
+        std::string line;
+        formatRecord(record, line);
+        auto& stream = record.stream == Logger::Stream::Err ? std::cerr : std::cout;
+        stream.write(line.data(), static_cast<std::streamsize>(line.size()));
+        stream.flush();
+    }
+
+    LogRing m_ring;
+    std::atomic<uint64_t> m_queued{0};   // Lines pushed (plus stop wake-ups)
+    std::atomic<uint64_t> m_written{0};  // Lines written by the writer thread
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<bool> m_stopping{false};
+    std::atomic<bool> m_stopped{false};
+    std::thread m_thread;
+    std::mutex m_hookMutex;  // Writer thread and setHooks() only
+    std::function<void()> m_beforeWrite;
+    std::function<void()> m_afterWrite;
+};
+
+} // namespace
+
+void Logger::setLevel(LogLevel level) {
+    s_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void Logger::log(LogLevel level, std::string message) {
+    Record record;
+    record.level = level;
+    record.stream = level >= LogLevel::Warn ? Stream::Err : Stream::Out;
+    record.when = std::chrono::system_clock::now();
+    record.text = std::move(message);
+    AsyncWriter::instance().submit(std::move(record));
+}
+
+void Logger::write(LogLevel level, std::string line, Stream stream) {
+    if (!enabled(level)) {
+        return;
+    }
+    Record record;
+    record.level = level;
+    record.stream = stream;
+    record.raw = true;
+    record.text = std::move(line);
+    AsyncWriter::instance().submit(std::move(record));
+}
+
+void Logger::flush() {
+    AsyncWriter::instance().flush();
+}
+
+void Logger::setConsoleHooks(std::function<void()> beforeWrite, std::function<void()> afterWrite) {
+    AsyncWriter::instance().setHooks(std::move(beforeWrite), std::move(afterWrite));
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <functional>
+
+// Leveled, asynchronous logging. Producers format the line and push it into a
+// fixed-size lock-free ring; a background thread drains the ring and writes the
+// lines in batches, so a log call on the download path costs a string build and
+// one CAS instead of a flushed write to the terminal. When the ring is full the
+// line is dropped and counted rather than blocking the caller.
+//
+// Levels below BT_LOG_MIN_LEVEL (default: Info) are removed at compile time by
+// the BT_LOG_* macros; build with -DBT_LOG_MIN_LEVEL=0 to keep trace logging.
+// Within the compiled-in levels, BT_LOG_LEVEL=trace|debug|info|warn|error in the
+// environment picks the runtime threshold.
+enum class LogLevel : int {
+    Trace = 0,
+    Debug = 1,
+    Info = 2,
+    Warn = 3,
+    Error = 4
+};
+
+#ifndef BT_LOG_MIN_LEVEL
+#define BT_LOG_MIN_LEVEL 2
+#endif
+
+class Logger {
+public:
+    enum class Stream { Out, Err };
+
+    static constexpr size_t CAPACITY = 8192;  // Lines; a power of two
+
+    static bool enabled(LogLevel level) {
+        return static_cast<int>(level) >= s_level.load(std::memory_order_relaxed);
+    }
+    static void setLevel(LogLevel level);
+
+    // Queue a diagnostic message; it is written as "[time] LEVEL message".
+    static void log(LogLevel level, std::string message);
+
+    // Queue an already formatted line (TerminalUI's coloured output). No newline needed.
+    static void write(LogLevel level, std::string line, Stream stream);
+
+    // Block until every line queued so far is on the terminal. Callers that print
+    // directly to std::cout do this first so their output keeps its place.
+    static void flush();
+
+    // Called on the writer thread around every batch it puts on the terminal, so
+    // a live display at the bottom of the screen can erase itself and redraw
+    // below the new lines. Pass empty functions to remove them.
+    static void setConsoleHooks(std::function<void()> beforeWrite, std::function<void()> afterWrite);
+
+private:
+    static std::atomic<int> s_level;
+};
+
+#define BT_LOG(level, expr)                                                        \
+    do {                                                                           \
+        if constexpr (static_cast<int>(level) >= BT_LOG_MIN_LEVEL) {               \
+            if (Logger::enabled(level)) {                                          \
+                std::ostringstream bt_log_line;                                    \
+                bt_log_line << expr;                                               \
+                Logger::log(level, bt_log_line.str());                             \
+            }                                                                      \
+        }                                                                          \
+    } while (0)
+
+#define BT_LOG_TRACE(expr) BT_LOG(LogLevel::Trace, expr)
+#define BT_LOG_DEBUG(expr) BT_LOG(LogLevel::Debug, expr)
+#define BT_LOG_INFO(expr) BT_LOG(LogLevel::Info, expr)
+#define BT_LOG_WARN(expr) BT_LOG(LogLevel::Warn, expr)
+#define BT_LOG_ERROR(expr) BT_LOG(LogLevel::Error, expr)
@@ -4,6 +4,8 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <vector>
+#include "logger.h"
 
 namespace TerminalUI {
     // ANSI Color Codes
@@ -91,6 +93,7 @@ namespace TerminalUI {
     
     // Print banner
     inline void printBanner() {
+        Logger::flush();
         std::cout << Colors::BRIGHT_CYAN << Colors::BOLD
                   << "╔══════════════════════════════════════════════════════════════╗\n"
                   << "║                    " << Symbols::TORRENT << " BitTorrent Client v2.0 " << Symbols::TORRENT << "                    ║\n"
@@ -99,45 +102,49 @@ namespace TerminalUI {
                   << Colors::RESET << std::endl << std::endl;
     }
     
-    // Logging functions with different levels
+    // Logging functions with different levels. Lines go through the async
+    // logger so callers on the download path never wait on the terminal.
+    inline void logLine(LogLevel level, const std::string& label, const std::string& labelColor,
+                        const std::string& textColor, const std::string& symbol, const std::string& message,
+                        Logger::Stream stream = Logger::Stream::Out) {
+        if (!Logger::enabled(level)) {
+            return;
+        }
+        std::ostringstream line;
+        line << Colors::DIM << "[" << getCurrentTime() << "] "
+             << labelColor << Colors::BOLD << label << " " << Colors::RESET
+             << textColor << symbol << " " << message << Colors::RESET;
+        Logger::write(level, line.str(), stream);
+    }
+    
     inline void logInfo(const std::string& message) {
-        std::cout << Colors::DIM << "[" << getCurrentTime() << "] "
-                  << Colors::BRIGHT_BLUE << Colors::BOLD << "INFO " << Colors::RESET 
-                  << Colors::BLUE << Symbols::BULLET << " " << message << Colors::RESET << std::endl;
+        logLine(LogLevel::Info, "INFO", Colors::BRIGHT_BLUE, Colors::BLUE, Symbols::BULLET, message);
     }
     
     inline void logSuccess(const std::string& message) {
-        std::cout << Colors::DIM << "[" << getCurrentTime() << "] "
-                  << Colors::BRIGHT_GREEN << Colors::BOLD << "SUCCESS " << Colors::RESET 
-                  << Colors::GREEN << Symbols::CHECK << " " << message << Colors::RESET << std::endl;
+        logLine(LogLevel::Info, "SUCCESS", Colors::BRIGHT_GREEN, Colors::GREEN, Symbols::CHECK, message);
     }
     
     inline void logWarning(const std::string& message) {
-        std::cout << Colors::DIM << "[" << getCurrentTime() << "] "
-                  << Colors::BRIGHT_YELLOW << Colors::BOLD << "WARNING " << Colors::RESET 
-                  << Colors::YELLOW << "⚠ " << message << Colors::RESET << std::endl;
+        logLine(LogLevel::Warn, "WARNING", Colors::BRIGHT_YELLOW, Colors::YELLOW, "⚠", message);
     }
     
     inline void logError(const std::string& message) {
-        std::cerr << Colors::DIM << "[" << getCurrentTime() << "] "
-                  << Colors::BRIGHT_RED << Colors::BOLD << "ERROR " << Colors::RESET 
-                  << Colors::RED << Symbols::CROSS << " " << message << Colors::RESET << std::endl;
+        logLine(LogLevel::Error, "ERROR", Colors::BRIGHT_RED, Colors::RED, Symbols::CROSS, message,
+                Logger::Stream::Err);
     }
     
     inline void logDownload(const std::string& message) {
-        std::cout << Colors::DIM << "[" << getCurrentTime() << "] "
-                  << Colors::BRIGHT_MAGENTA << Colors::BOLD << "DOWNLOAD " << Colors::RESET 
-                  << Colors::MAGENTA << Symbols::DOWNLOAD << " " << message << Colors::RESET << std::endl;
+        logLine(LogLevel::Info, "DOWNLOAD", Colors::BRIGHT_MAGENTA, Colors::MAGENTA, Symbols::DOWNLOAD, message);
     }
     
     inline void logNetwork(const std::string& message) {
-        std::cout << Colors::DIM << "[" << getCurrentTime() << "] "
-                  << Colors::BRIGHT_CYAN << Colors::BOLD << "NETWORK " << Colors::RESET 
-                  << Colors::CYAN << Symbols::NETWORK << " " << message << Colors::RESET << std::endl;
+        logLine(LogLevel::Info, "NETWORK", Colors::BRIGHT_CYAN, Colors::CYAN, Symbols::NETWORK, message);
     }
     
     // Progress bar
     inline void showProgress(int current, int total, const std::string& prefix = "") {
+        Logger::flush();
         const int barWidth = 50;
         float progress = static_cast<float>(current) / total;
         int pos = static_cast<int>(barWidth * progress);
@@ -164,6 +171,7 @@ namespace TerminalUI {
     
     // Section headers
     inline void printSectionHeader(const std::string& title, const std::string& symbol = Symbols::GEAR) {
+        Logger::flush();
         std::cout << std::endl << Colors::BRIGHT_WHITE << Colors::BOLD 
                   << "┌─ " << symbol << " " << title << " " << symbol << " ─┐" << Colors::RESET << std::endl;
     }
@@ -171,6 +179,7 @@ namespace TerminalUI {
     // Print torrent info in a nice format
     inline void printTorrentInfo(const std::string& infoHash, const std::string& trackerUrl, 
                                 long long totalLength, int pieceLength, int totalPieces) {
+        Logger::flush();
         printSectionHeader("Torrent Information", Symbols::FILE);
         
         std::cout << Colors::BRIGHT_WHITE << "  Info Hash:    " << Colors::RESET 
@@ -190,6 +199,7 @@ namespace TerminalUI {
     
     // Print peer list
     inline void printPeerList(const std::vector<std::string>& peers) {
+        Logger::flush();
         printSectionHeader("Peer Discovery", Symbols::NETWORK);
         
         std::cout << Colors::BRIGHT_WHITE << "  Found " << Colors::BRIGHT_GREEN 
@@ -204,18 +214,66 @@ namespace TerminalUI {
                   << Colors::RESET << std::endl;
     }
     
+    // Print the file table of a multi-file torrent (path, size)
+    inline void printFileList(const std::vector<std::pair<std::string, long long>>& files, size_t maxShown = 20) {
+        Logger::flush();
+        printSectionHeader("Files", Symbols::FOLDER);
+        
+        for (size_t i = 0; i < files.size() && i < maxShown; ++i) {
+            std::cout << Colors::DIM << "  " << std::setw(4) << i << ". " << Colors::RESET
+                      << Colors::CYAN << files[i].first << Colors::RESET
+                      << Colors::DIM << " (" << formatFileSize(files[i].second) << ")" << Colors::RESET << std::endl;
+        }
+        if (files.size() > maxShown) {
+            std::cout << Colors::DIM << "  ... and " << (files.size() - maxShown) << " more" << Colors::RESET << std::endl;
+        }
+        
+        std::cout << Colors::DIM << "└─────────────────────────────────────────────────────────────┘" 
+                  << Colors::RESET << std::endl;
+    }
+    
     // Print usage information
     inline void printUsage(const std::string& programName) {
         printBanner();
         
         std::cout << Colors::BRIGHT_WHITE << Colors::BOLD << "USAGE:" << Colors::RESET << std::endl;
-        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " download_file <torrent_file>" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " download_file <torrent_file> [options]" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " scrape <torrent_file>..." << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " session <torrent_file>... [--active N] [--max-peers N]" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "           [--max-memory MB] [--write-cache MB] [--rate-limit KBps] [--metrics-port <port>]" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " daemon [torrent_file...] [session options] [--socket <path>]" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " ctl [--socket <path>] <add <torrent_file>|remove <id>|pause <id>|resume <id>|status [id]|shutdown>" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " simulate [--seeds N] [--size MB] [--piece-kb K] [--latency MS]" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "           [--bandwidth KBps] [--loss P] [--udp] [--json] [--trace <file>] [--disk <dir>]" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << programName << " bench [--filter <substr>] [--min-time <ms>] [--json]" << Colors::RESET << std::endl;
         std::cout << "  " << Colors::BRIGHT_CYAN << programName << " --help" << Colors::RESET << std::endl << std::endl;
         
+        std::cout << Colors::BRIGHT_WHITE << Colors::BOLD << "OPTIONS:" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--only <i,j,...>" << Colors::RESET << "                       Download only these files (multi-file torrents)" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--priority <i>=<skip|low|normal|high>" << Colors::RESET << "  Set a file's priority (repeatable)" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--stream <pieces>" << Colors::RESET << "                      Stream sequentially with a priority window" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--metrics-port <port>" << Colors::RESET << "                  Serve Prometheus metrics at /metrics" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--metrics-bind <address>" << Colors::RESET << "               Metrics listen address (default 127.0.0.1)" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--trace <file>" << Colors::RESET << "                         Write a Chrome trace of the download (also on SIGUSR1)" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--write-cache <MB>" << Colors::RESET << "                     Write-back cache size (default 64, 0 = write at the end)" << std::endl;
+        std::cout << "  " << Colors::BRIGHT_CYAN << "--socket <path>" << Colors::RESET << "                        Control socket (default $XDG_RUNTIME_DIR/bittorrent.sock," << std::endl;
+        std::cout << "                                         else /tmp/bittorrent-<uid>/bittorrent.sock)" << std::endl << std::endl;
+        
         std::cout << Colors::BRIGHT_WHITE << Colors::BOLD << "EXAMPLES:" << Colors::RESET << std::endl;
         std::cout << "  " << Colors::DIM << "# Download a torrent file" << Colors::RESET << std::endl;
         std::cout << "  " << Colors::BRIGHT_GREEN << programName << " download_file sample.torrent" << Colors::RESET << std::endl;
-        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " download_file /path/to/movie.torrent" << Colors::RESET << std::endl << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " download_file /path/to/movie.torrent" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::DIM << "# Fetch only files 0 and 2 of a multi-file torrent" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " download_file dataset.torrent --only 0,2" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::DIM << "# Check swarm health of several torrents without announcing" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " scrape a.torrent b.torrent" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::DIM << "# Download three torrents, two at a time, capped at 2 MB/s in total" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " session a.torrent b.torrent c.torrent --active 2 --rate-limit 2048" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::DIM << "# Run a daemon and queue a torrent on it" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " daemon --active 2 &" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " ctl add movie.torrent" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::DIM << "# Benchmark against 8 local seeds with 20ms latency and 1% loss" << Colors::RESET << std::endl;
+        std::cout << "  " << Colors::BRIGHT_GREEN << programName << " simulate --seeds 8 --latency 20 --loss 0.01" << Colors::RESET << std::endl << std::endl;
         
         std::cout << Colors::BRIGHT_WHITE << Colors::BOLD << "FEATURES:" << Colors::RESET << std::endl;
         std::cout << "  " << Colors::GREEN << Symbols::CHECK << " Block-based piece downloading" << Colors::RESET << std::endl;
@@ -227,11 +285,13 @@ namespace TerminalUI {
     
     // Clear line (for progress updates)
     inline void clearLine() {
+        Logger::flush();
         std::cout << "\r\033[K";
     }
     
     // Print final success message
     inline void printDownloadComplete(const std::string& filePath, long long fileSize) {
+        Logger::flush();
         std::cout << std::endl;
         std::cout << Colors::BRIGHT_GREEN << Colors::BOLD 
                   << "╔══════════════════════════════════════════════════════════════╗" << std::endl;